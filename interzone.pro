@@ -23,8 +23,10 @@ HEADERS += src/activemasternode.h \
            src/addrman.h \
            src/alert.h \
            src/allocators.h \
+           src/arith_uint256.h \
            src/base58.h \
            src/bignum.h \
+           src/blockencodings.h \
            src/bloom.h \
            src/interzone-config.h \
            src/chainparams.h \
@@ -32,6 +34,7 @@ HEADERS += src/activemasternode.h \
            src/checkqueue.h \
            src/clientversion.h \
            src/coincontrol.h \
+           src/coinselection.h \
            src/coins.h \
            src/common.h \
            src/compat.h \
@@ -44,6 +47,7 @@ HEADERS += src/activemasternode.h \
            src/hmac_sha256.h \
            src/init.h \
            src/instantx.h \
+           src/jsonreader.h \
            src/keepass.h \
            src/key.h \
            src/keystore.h \
@@ -64,6 +68,7 @@ HEADERS += src/activemasternode.h \
            src/rpcclient.h \
            src/rpcprotocol.h \
            src/rpcserver.h \
+           src/scheduler.h \
            src/script.h \
            src/serialize.h \
            src/sha256.h \
@@ -84,6 +89,7 @@ HEADERS += src/activemasternode.h \
            src/threadsafety.h \
            src/tinyformat.h \
            src/torcontrol.h \
+           src/trace.h \
            src/txdb.h \
            src/txmempool.h \
            src/ui_interface.h \
@@ -294,8 +300,10 @@ SOURCES += src/activemasternode.cpp \
            src/aes_helper.c \
            src/alert.cpp \
            src/allocators.cpp \
+           src/arith_uint256.cpp \
            src/base58.cpp \
            src/blake.c \
+           src/blockencodings.cpp \
            src/bloom.cpp \
            src/bmw.c \
            src/interzone-cli.cpp \
@@ -303,6 +311,7 @@ SOURCES += src/activemasternode.cpp \
            src/chainparams.cpp \
            src/checkpoints.cpp \
            src/coins.cpp \
+           src/coinselection.cpp \
            src/core.cpp \
            src/crypter.cpp \
            src/cubehash.c \
@@ -316,6 +325,7 @@ SOURCES += src/activemasternode.cpp \
            src/init.cpp \
            src/instantx.cpp \
            src/jh.c \
+           src/jsonreader.cpp \
            src/keccak.c \
            src/keepass.cpp \
            src/key.cpp \
@@ -344,6 +354,7 @@ SOURCES += src/activemasternode.cpp \
            src/rpcrawtransaction.cpp \
            src/rpcserver.cpp \
            src/rpcwallet.cpp \
+           src/scheduler.cpp \
            src/script.cpp \
            src/sha256.cpp \
            src/shavite.c \
@@ -352,6 +363,7 @@ SOURCES += src/activemasternode.cpp \
            src/spork.cpp \
            src/sync.cpp \
            src/torcontrol.cpp \
+           src/trace.cpp \
            src/txdb.cpp \
            src/txmempool.cpp \
            src/util.cpp \
@@ -437,20 +449,25 @@ SOURCES += src/activemasternode.cpp \
            src/test/accounting_tests.cpp \
            src/test/alert_tests.cpp \
            src/test/allocator_tests.cpp \
+           src/test/arith_uint256_tests.cpp \
            src/test/base32_tests.cpp \
            src/test/base58_tests.cpp \
            src/test/base64_tests.cpp \
            src/test/bignum_tests.cpp \
            src/test/bip32_tests.cpp \
+           src/test/blockencodings_tests.cpp \
            src/test/bloom_tests.cpp \
            src/test/canonical_tests.cpp \
            src/test/checkblock_tests.cpp \
            src/test/Checkpoints_tests.cpp \
+           src/test/coinselection_tests.cpp \
            src/test/compress_tests.cpp \
+           src/test/darksend_tests.cpp \
            src/test/DoS_tests.cpp \
            src/test/getarg_tests.cpp \
            src/test/hash_tests.cpp \
            src/test/hmac_tests.cpp \
+           src/test/jsonreader_tests.cpp \
            src/test/key_tests.cpp \
            src/test/main_tests.cpp \
            src/test/miner_tests.cpp \
@@ -460,14 +477,18 @@ SOURCES += src/activemasternode.cpp \
            src/test/pmt_tests.cpp \
            src/test/rpc_tests.cpp \
            src/test/rpc_wallet_tests.cpp \
+           src/test/scheduler_tests.cpp \
            src/test/script_P2SH_tests.cpp \
            src/test/script_tests.cpp \
            src/test/scriptnum_tests.cpp \
            src/test/serialize_tests.cpp \
            src/test/sighash_tests.cpp \
            src/test/sigopcount_tests.cpp \
+           src/test/skiplist_tests.cpp \
+           src/test/sync_tests.cpp \
            src/test/test_interzone.cpp \
            src/test/test_darkcoin.cpp \
+           src/test/trace_tests.cpp \
            src/test/transaction_tests.cpp \
            src/test/uint256_tests.cpp \
            src/test/util_tests.cpp \
@@ -0,0 +1,208 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2014 The Bitcoin developers
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ARITH_UINT256_H
+#define BITCOIN_ARITH_UINT256_H
+
+#include "uint256.h"
+
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+
+class uint_error : public std::runtime_error {
+public:
+    explicit uint_error(const std::string& str) : std::runtime_error(str) {}
+};
+
+/**
+ * 256-bit unsigned integer for proof-of-work arithmetic: targets, chain work
+ * and retargeting. Lives entirely on the stack, unlike CBigNum which allocates
+ * an OpenSSL BIGNUM per value and per intermediate result. Arithmetic wraps
+ * modulo 2^256; SetCompact and GetCompact produce the same results as
+ * CBigNum's for every non-negative value that fits.
+ */
+class arith_uint256
+{
+private:
+    enum { WIDTH = 8 };
+    uint32_t pn[WIDTH];
+
+public:
+    arith_uint256()
+    {
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] = 0;
+    }
+
+    arith_uint256(uint64_t b)
+    {
+        pn[0] = (uint32_t)b;
+        pn[1] = (uint32_t)(b >> 32);
+        for (int i = 2; i < WIDTH; i++)
+            pn[i] = 0;
+    }
+
+    explicit arith_uint256(const uint256& b)
+    {
+        // Both are little endian 32-bit words
+        memcpy(pn, b.begin(), sizeof(pn));
+    }
+
+    uint256 getuint256() const
+    {
+        uint256 ret;
+        memcpy(ret.begin(), pn, sizeof(pn));
+        return ret;
+    }
+
+    bool operator!() const
+    {
+        for (int i = 0; i < WIDTH; i++)
+            if (pn[i] != 0)
+                return false;
+        return true;
+    }
+
+    const arith_uint256 operator~() const
+    {
+        arith_uint256 ret;
+        for (int i = 0; i < WIDTH; i++)
+            ret.pn[i] = ~pn[i];
+        return ret;
+    }
+
+    const arith_uint256 operator-() const
+    {
+        arith_uint256 ret = ~*this;
+        ++ret;
+        return ret;
+    }
+
+    arith_uint256& operator^=(const arith_uint256& b)
+    {
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] ^= b.pn[i];
+        return *this;
+    }
+
+    arith_uint256& operator&=(const arith_uint256& b)
+    {
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] &= b.pn[i];
+        return *this;
+    }
+
+    arith_uint256& operator|=(const arith_uint256& b)
+    {
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] |= b.pn[i];
+        return *this;
+    }
+
+    arith_uint256& operator<<=(unsigned int shift);
+    arith_uint256& operator>>=(unsigned int shift);
+
+    arith_uint256& operator+=(const arith_uint256& b)
+    {
+        uint64_t carry = 0;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            uint64_t n = carry + pn[i] + b.pn[i];
+            pn[i] = n & 0xffffffff;
+            carry = n >> 32;
+        }
+        return *this;
+    }
+
+    arith_uint256& operator-=(const arith_uint256& b)
+    {
+        *this += -b;
+        return *this;
+    }
+
+    arith_uint256& operator*=(uint32_t b32);
+    arith_uint256& operator*=(const arith_uint256& b);
+    /** Throws uint_error on division by zero */
+    arith_uint256& operator/=(const arith_uint256& b);
+
+    arith_uint256& operator++()
+    {
+        // prefix operator
+        int i = 0;
+        while (++pn[i] == 0 && i < WIDTH-1)
+            i++;
+        return *this;
+    }
+
+    arith_uint256& operator--()
+    {
+        // prefix operator
+        int i = 0;
+        while (--pn[i] == (uint32_t)-1 && i < WIDTH-1)
+            i++;
+        return *this;
+    }
+
+    int CompareTo(const arith_uint256& b) const;
+    bool EqualTo(uint64_t b) const;
+
+    friend inline const arith_uint256 operator+(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) += b; }
+    friend inline const arith_uint256 operator-(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) -= b; }
+    friend inline const arith_uint256 operator*(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) *= b; }
+    friend inline const arith_uint256 operator/(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) /= b; }
+    friend inline const arith_uint256 operator|(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) |= b; }
+    friend inline const arith_uint256 operator&(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) &= b; }
+    friend inline const arith_uint256 operator^(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) ^= b; }
+    friend inline const arith_uint256 operator>>(const arith_uint256& a, int shift) { return arith_uint256(a) >>= shift; }
+    friend inline const arith_uint256 operator<<(const arith_uint256& a, int shift) { return arith_uint256(a) <<= shift; }
+    friend inline const arith_uint256 operator*(const arith_uint256& a, uint32_t b) { return arith_uint256(a) *= b; }
+    friend inline bool operator==(const arith_uint256& a, const arith_uint256& b) { return memcmp(a.pn, b.pn, sizeof(a.pn)) == 0; }
+    friend inline bool operator!=(const arith_uint256& a, const arith_uint256& b) { return memcmp(a.pn, b.pn, sizeof(a.pn)) != 0; }
+    friend inline bool operator>(const arith_uint256& a, const arith_uint256& b) { return a.CompareTo(b) > 0; }
+    friend inline bool operator<(const arith_uint256& a, const arith_uint256& b) { return a.CompareTo(b) < 0; }
+    friend inline bool operator>=(const arith_uint256& a, const arith_uint256& b) { return a.CompareTo(b) >= 0; }
+    friend inline bool operator<=(const arith_uint256& a, const arith_uint256& b) { return a.CompareTo(b) <= 0; }
+    friend inline bool operator==(const arith_uint256& a, uint64_t b) { return a.EqualTo(b); }
+    friend inline bool operator!=(const arith_uint256& a, uint64_t b) { return !a.EqualTo(b); }
+
+    /** Position of the highest set bit plus one, or zero for zero */
+    unsigned int bits() const;
+
+    double getdouble() const;
+
+    uint64_t GetLow64() const
+    {
+        return pn[0] | (uint64_t)pn[1] << 32;
+    }
+
+    std::string GetHex() const
+    {
+        return getuint256().GetHex();
+    }
+
+    std::string ToString() const
+    {
+        return GetHex();
+    }
+
+    /**
+     * The "compact" format is a representation of a whole number N using an
+     * unsigned 32bit number similar to a floating point format: the most
+     * significant 8 bits are the unsigned exponent of base 256, the next bit
+     * is the sign and the lower 23 bits the mantissa, so
+     * N = (-1^sign) * mantissa * 256^(exponent-3).
+     *
+     * This type has no sign, so a set sign bit on a non-zero mantissa is
+     * reported through pfNegative, and values that do not fit in 256 bits
+     * through pfOverflow. Callers must check both where CBigNum would have
+     * produced a negative or oversized target.
+     */
+    arith_uint256& SetCompact(uint32_t nCompact, bool* pfNegative = NULL, bool* pfOverflow = NULL);
+    uint32_t GetCompact(bool fNegative = false) const;
+};
+
+#endif // BITCOIN_ARITH_UINT256_H
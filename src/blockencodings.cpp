@@ -0,0 +1,168 @@
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+
+#include "hash.h"
+#include "main.h"
+#include "random.h"
+#include "txmempool.h"
+
+#include <limits>
+
+#include <boost/foreach.hpp>
+#include <boost/unordered_map.hpp>
+
+using namespace std;
+
+// the smallest transaction that can be serialized, for bounding the count
+static const unsigned int MIN_TRANSACTION_SIZE = 60;
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block) :
+    header(block.GetBlockHeader())
+{
+    nNonce = GetRand(std::numeric_limits<uint64_t>::max());
+    FillShortTxIDSelector();
+
+    vPrefilledTxn.push_back(CPrefilledTransaction(0, block.vtx[0]));
+    vShortTxIds.reserve(block.vtx.size() - 1);
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+        vShortTxIds.push_back(GetShortID(block.vtx[i].GetHash()));
+}
+
+void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector()
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << header << nNonce;
+    uint256 hashSelector = ss.GetHash();
+    k0 = hashSelector.Get64(0);
+    k1 = hashSelector.Get64(1);
+}
+
+uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const
+{
+    return SipHashUint256(k0, k1, txhash);
+}
+
+ReadStatus CPartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const CTxMemPool& pool)
+{
+    if (cmpctblock.header.IsNull() || cmpctblock.BlockTxCount() == 0)
+        return READ_STATUS_INVALID;
+    if (cmpctblock.BlockTxCount() > MAX_BLOCK_SIZE / MIN_TRANSACTION_SIZE)
+        return READ_STATUS_INVALID;
+
+    header = cmpctblock.header;
+    unsigned int nCount = cmpctblock.BlockTxCount();
+    vtxAvailable.assign(nCount, CTransaction());
+    vfAvailable.assign(nCount, false);
+    nMempoolCount = 0;
+
+    // prefilled transactions take their own index, short ids fill the rest in order
+    BOOST_FOREACH(const CPrefilledTransaction& prefilled, cmpctblock.vPrefilledTxn)
+    {
+        if (prefilled.nIndex >= nCount || vfAvailable[prefilled.nIndex])
+            return READ_STATUS_INVALID;
+        vtxAvailable[prefilled.nIndex] = prefilled.tx;
+        vfAvailable[prefilled.nIndex] = true;
+    }
+
+    // Index the block's short ids rather than the mempool: the key changes
+    // with every block, so one pass over mapTx hashing each txid is the least
+    // work there is, and the table stays the size of the block.
+    boost::unordered_map<uint64_t, unsigned int> mapShortIds;
+    mapShortIds.rehash(cmpctblock.vShortTxIds.size());
+    unsigned int nIndex = 0;
+    BOOST_FOREACH(uint64_t nShortId, cmpctblock.vShortTxIds)
+    {
+        while (vfAvailable[nIndex])
+            nIndex++;
+        // two transactions of the block with the same id can't be told apart
+        if (!mapShortIds.insert(make_pair(nShortId, nIndex)).second)
+            return READ_STATUS_FAILED;
+        nIndex++;
+    }
+
+    // an id matched by two mempool transactions is left for the peer to send
+    vector<char> vfCollision(nCount, false);
+    unsigned int nLeft = mapShortIds.size();
+    {
+        LOCK(pool.cs);
+        for (map<uint256, CTxMemPoolEntry>::const_iterator mi = pool.mapTx.begin(); mi != pool.mapTx.end() && nLeft > 0; ++mi)
+        {
+            boost::unordered_map<uint64_t, unsigned int>::iterator it = mapShortIds.find(cmpctblock.GetShortID(mi->first));
+            if (it == mapShortIds.end())
+                continue;
+            unsigned int n = it->second;
+            if (vfCollision[n])
+                continue;
+            if (vfAvailable[n])
+            {
+                vtxAvailable[n] = CTransaction();
+                vfAvailable[n] = false;
+                vfCollision[n] = true;
+                nMempoolCount--;
+                continue;
+            }
+            vtxAvailable[n] = mi->second.GetTx();
+            vfAvailable[n] = true;
+            nMempoolCount++;
+            nLeft--;
+        }
+    }
+
+    LogPrint("net", "compact block %s: %u of %u transactions from the mempool\n",
+        header.GetHash().ToString(), nMempoolCount, cmpctblock.vShortTxIds.size());
+    return READ_STATUS_OK;
+}
+
+void CPartiallyDownloadedBlock::GetMissing(vector<unsigned int>& vIndexes) const
+{
+    vIndexes.clear();
+    for (unsigned int i = 0; i < vfAvailable.size(); i++)
+        if (!vfAvailable[i])
+            vIndexes.push_back(i);
+}
+
+bool CBlockTransactionsRequest::CheckIndexes(unsigned int nTxCount) const
+{
+    for (unsigned int i = 0; i < vIndexes.size(); i++)
+    {
+        if (vIndexes[i] >= nTxCount)
+            return false;
+        if (i > 0 && vIndexes[i] <= vIndexes[i - 1])
+            return false;
+    }
+    return true;
+}
+
+ReadStatus CPartiallyDownloadedBlock::FillBlock(CBlock& block, const vector<CTransaction>& vtxMissing) const
+{
+    if (header.IsNull())
+        return READ_STATUS_INVALID;
+
+    block = CBlock(header);
+    block.vtx.reserve(vtxAvailable.size());
+    unsigned int nMissing = 0;
+    for (unsigned int i = 0; i < vtxAvailable.size(); i++)
+    {
+        if (vfAvailable[i])
+            block.vtx.push_back(vtxAvailable[i]);
+        else
+        {
+            if (nMissing >= vtxMissing.size())
+                return READ_STATUS_INVALID;
+            block.vtx.push_back(vtxMissing[nMissing++]);
+        }
+    }
+    if (nMissing != vtxMissing.size())
+        return READ_STATUS_INVALID;
+
+    // A short id collision with a mempool transaction gives a block that
+    // doesn't match its header. That is no fault of the peer: the caller
+    // should fetch the full block rather than let it fail validation.
+    if (block.BuildMerkleTree() != header.hashMerkleRoot)
+        return READ_STATUS_FAILED;
+
+    return READ_STATUS_OK;
+}
@@ -0,0 +1,149 @@
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKENCODINGS_H
+#define BITCOIN_BLOCKENCODINGS_H
+
+#include "core.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <vector>
+
+class CTxMemPool;
+
+/** A transaction sent in full inside a compact block, at its index in the block */
+class CPrefilledTransaction
+{
+public:
+    unsigned int nIndex;
+    CTransaction tx;
+
+    CPrefilledTransaction()
+    {
+        nIndex = 0;
+    }
+
+    CPrefilledTransaction(unsigned int nIndexIn, const CTransaction& txIn) : nIndex(nIndexIn), tx(txIn) {}
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(VARINT(nIndex));
+        READWRITE(tx);
+    )
+};
+
+/** Used to relay a new block as its header and a short id per transaction.
+ * The receiver rebuilds the block from its mempool and asks for the
+ * transactions it doesn't have with getblocktxn. The short ids are SipHash
+ * of the txid under a key taken from the header and a random nonce, so two
+ * transactions that collide in one block won't collide in the next.
+ *
+ * The coinbase can't be in anyone's mempool and is always sent in full.
+ */
+class CBlockHeaderAndShortTxIDs
+{
+public:
+    CBlockHeader header;
+    uint64_t nNonce;
+    // the transactions not prefilled, in block order
+    std::vector<uint64_t> vShortTxIds;
+    std::vector<CPrefilledTransaction> vPrefilledTxn;
+
+    CBlockHeaderAndShortTxIDs()
+    {
+        nNonce = 0;
+        k0 = k1 = 0;
+    }
+
+    CBlockHeaderAndShortTxIDs(const CBlock& block);
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(header);
+        READWRITE(nNonce);
+        READWRITE(vShortTxIds);
+        READWRITE(vPrefilledTxn);
+        if (fRead)
+            const_cast<CBlockHeaderAndShortTxIDs*>(this)->FillShortTxIDSelector();
+    )
+
+    uint64_t GetShortID(const uint256& txhash) const;
+
+    unsigned int BlockTxCount() const { return vShortTxIds.size() + vPrefilledTxn.size(); }
+
+private:
+    uint64_t k0, k1;
+
+    void FillShortTxIDSelector();
+};
+
+enum ReadStatus
+{
+    READ_STATUS_OK,
+    READ_STATUS_INVALID, // the peer sent something malformed
+    READ_STATUS_FAILED,  // the block could not be rebuilt, fetch it in full
+};
+
+/** A block being rebuilt from a compact block and our mempool */
+class CPartiallyDownloadedBlock
+{
+public:
+    CBlockHeader header;
+
+    CPartiallyDownloadedBlock()
+    {
+        nMempoolCount = 0;
+    }
+
+    /** Fill in what the mempool has. Takes pool.cs. */
+    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const CTxMemPool& pool);
+    /** The indexes of the transactions still missing, in ascending order */
+    void GetMissing(std::vector<unsigned int>& vIndexes) const;
+    /** Build the block with vtxMissing filling the gaps, in order, and check its merkle root */
+    ReadStatus FillBlock(CBlock& block, const std::vector<CTransaction>& vtxMissing) const;
+
+    /** Transactions found in the mempool */
+    unsigned int GetMempoolCount() const { return nMempoolCount; }
+
+private:
+    std::vector<CTransaction> vtxAvailable;
+    std::vector<char> vfAvailable;
+    unsigned int nMempoolCount;
+};
+
+/** getblocktxn: the transactions of a block the requester couldn't rebuild */
+class CBlockTransactionsRequest
+{
+public:
+    uint256 blockhash;
+    std::vector<unsigned int> vIndexes;
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(blockhash);
+        READWRITE(vIndexes);
+    )
+
+    /** Indexes must be strictly increasing and inside a block of nTxCount
+     * transactions, so the answer is never larger than the block itself */
+    bool CheckIndexes(unsigned int nTxCount) const;
+};
+
+/** blocktxn: the answer to getblocktxn, transactions in the requested order */
+class CBlockTransactions
+{
+public:
+    uint256 blockhash;
+    std::vector<CTransaction> vtx;
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(blockhash);
+        READWRITE(vtx);
+    )
+};
+
+#endif
@@ -37,7 +37,7 @@ public:
         vAlertPubKey = ParseHex("04c4d925d462a89054155314a7068bb8cf6d7c030d76491e6cc97fefcc4ab8c3665bfb34c3aba0e12b9fb4fab47502a00938dd93e0e675c4713ee47200046de2e3");
         nDefaultPort = 21817;
         nRPCPort = 21818;
-        bnProofOfWorkLimit = CBigNum(~uint256(0) >> 20);
+        bnProofOfWorkLimit = arith_uint256(~uint256(0) >> 20);
         nSubsidyHalvingInterval = 500000; 
 
         // Genesis block
@@ -153,7 +153,7 @@ public:
         pchMessageStart[2] = 0xc3;
         pchMessageStart[3] = 0x56;
         nSubsidyHalvingInterval = 150;
-        bnProofOfWorkLimit = CBigNum(~uint256(0) >> 20);
+        bnProofOfWorkLimit = arith_uint256(~uint256(0) >> 20);
         genesis.nTime = 1296688602;
         genesis.nBits = 0x207fffff;
         genesis.nNonce = 3;
@@ -0,0 +1,138 @@
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinselection.h"
+
+#include "random.h"
+
+#include <boost/foreach.hpp>
+
+using namespace std;
+
+bool SelectCoinsBnB(const vector<CSelectionCoin>& vCoins, int64_t nTargetValue, int64_t nMaxExcess,
+                    vector<char>& vfBest, int64_t& nBest, int nMaxTries)
+{
+    vfBest.assign(vCoins.size(), false);
+    nBest = 0;
+
+    // value of the coins not decided on yet, an upper bound of what this branch can still add
+    int64_t nRemaining = 0;
+    BOOST_FOREACH(const CSelectionCoin& coin, vCoins)
+        nRemaining += coin.nValue;
+    if (nRemaining < nTargetValue)
+        return false;
+
+    vector<char> vfIncluded(vCoins.size(), false);
+    vector<unsigned int> vSelected;
+    int64_t nTotal = 0;
+    int64_t nBestExcess = nMaxExcess + 1;
+    unsigned int i = 0; // next coin to decide on
+
+    for (int nTries = 0; nTries < nMaxTries; nTries++)
+    {
+        bool fBacktrack = false;
+        if (nTotal + nRemaining < nTargetValue || nTotal > nTargetValue + nMaxExcess)
+        {
+            // this branch can't reach the target any more, or is already past the window
+            fBacktrack = true;
+        }
+        else if (nTotal >= nTargetValue)
+        {
+            if (nTotal - nTargetValue < nBestExcess)
+            {
+                nBestExcess = nTotal - nTargetValue;
+                nBest = nTotal;
+                vfBest = vfIncluded;
+                if (nBestExcess == 0)
+                    break;
+            }
+            // adding more coins only moves further away from the target
+            fBacktrack = true;
+        }
+
+        if (fBacktrack)
+        {
+            // walk back to the last included coin and continue with the branch that leaves it out
+            while (!vSelected.empty() && i > vSelected.back() + 1)
+            {
+                i--;
+                nRemaining += vCoins[i].nValue;
+            }
+            if (vSelected.empty())
+                break; // every branch has been searched
+
+            unsigned int nLast = vSelected.back();
+            vSelected.pop_back();
+            vfIncluded[nLast] = false;
+            nTotal -= vCoins[nLast].nValue;
+        }
+        else
+        {
+            nRemaining -= vCoins[i].nValue;
+
+            // leaving out a coin and then taking one of equal value gives a subset
+            // that was already searched, so only the first of a run of equal coins
+            // starts an inclusion branch after its predecessor was left out
+            if (i > 0 && vCoins[i].nValue == vCoins[i - 1].nValue &&
+                (vSelected.empty() || vSelected.back() != i - 1))
+            {
+                i++;
+                continue;
+            }
+
+            vSelected.push_back(i);
+            vfIncluded[i] = true;
+            nTotal += vCoins[i].nValue;
+            i++;
+        }
+    }
+
+    return nBestExcess <= nMaxExcess;
+}
+
+void ApproximateBestSubset(const vector<CSelectionCoin>& vCoins, int64_t nTotalLower, int64_t nTargetValue,
+                           vector<char>& vfBest, int64_t& nBest, int iterations)
+{
+    vector<char> vfIncluded;
+
+    vfBest.assign(vCoins.size(), true);
+    nBest = nTotalLower;
+
+    seed_insecure_rand();
+
+    for (int nRep = 0; nRep < iterations && nBest != nTargetValue; nRep++)
+    {
+        vfIncluded.assign(vCoins.size(), false);
+        int64_t nTotal = 0;
+        bool fReachedTarget = false;
+        for (int nPass = 0; nPass < 2 && !fReachedTarget; nPass++)
+        {
+            for (unsigned int i = 0; i < vCoins.size(); i++)
+            {
+                //The solver here uses a randomized algorithm,
+                //the randomness serves no real security purpose but is just
+                //needed to prevent degenerate behavior and it is important
+                //that the rng fast. We do not use a constant random sequence,
+                //because there may be some privacy improvement by making
+                //the selection random.
+                if (nPass == 0 ? insecure_rand()&1 : !vfIncluded[i])
+                {
+                    nTotal += vCoins[i].nValue;
+                    vfIncluded[i] = true;
+                    if (nTotal >= nTargetValue)
+                    {
+                        fReachedTarget = true;
+                        if (nTotal < nBest)
+                        {
+                            nBest = nTotal;
+                            vfBest = vfIncluded;
+                        }
+                        nTotal -= vCoins[i].nValue;
+                        vfIncluded[i] = false;
+                    }
+                }
+            }
+        }
+    }
+}
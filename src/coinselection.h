@@ -0,0 +1,52 @@
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSELECTION_H
+#define BITCOIN_COINSELECTION_H
+
+#include <stdint.h>
+#include <vector>
+
+/** Number of search steps the branch and bound solver may take before giving up */
+static const int BNB_MAX_TRIES = 100000;
+
+/**
+ * A spendable output as seen by the coin selection solvers: its value and
+ * its position in the caller's list of candidate outputs. Solvers only
+ * touch this compact array; the caller maps the selected positions back
+ * to wallet transactions.
+ */
+class CSelectionCoin
+{
+public:
+    int64_t nValue;
+    unsigned int nIndex;
+
+    CSelectionCoin(int64_t nValueIn, unsigned int nIndexIn) : nValue(nValueIn), nIndex(nIndexIn) {}
+
+    friend bool operator>(const CSelectionCoin& a, const CSelectionCoin& b)
+    {
+        return a.nValue > b.nValue;
+    }
+};
+
+/**
+ * Exact solver. Depth-first branch and bound search for a subset of
+ * vCoins whose total lies in [nTargetValue, nTargetValue + nMaxExcess],
+ * so the transaction needs no change output. Among the subsets found the
+ * one with the smallest excess wins; an exact match ends the search.
+ * vCoins must be sorted by descending value. Returns false if no such
+ * subset exists or nMaxTries steps were not enough to find one.
+ */
+bool SelectCoinsBnB(const std::vector<CSelectionCoin>& vCoins, int64_t nTargetValue, int64_t nMaxExcess,
+                    std::vector<char>& vfBest, int64_t& nBest, int nMaxTries = BNB_MAX_TRIES);
+
+/**
+ * Fallback solver. Stochastic approximation of the smallest subset total
+ * of at least nTargetValue; nTotalLower is the sum of all of vCoins.
+ */
+void ApproximateBestSubset(const std::vector<CSelectionCoin>& vCoins, int64_t nTotalLower, int64_t nTargetValue,
+                           std::vector<char>& vfBest, int64_t& nBest, int iterations = 1000);
+
+#endif
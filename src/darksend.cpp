@@ -9,6 +9,7 @@
 #include "masternodeman.h"
 #include "instantx.h"
 #include "ui_interface.h"
+#include "trace.h"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -27,13 +28,15 @@ CDarksendPool darkSendPool;
 // A helper object for signing messages from Masternodes
 CDarkSendSigner darkSendSigner;
 // The current Darksends in progress on the network
-std::vector<CDarksendQueue> vecDarksendQueue;
+CDarksendQueueIndex darkSendQueues;
 // Keep track of the used Masternodes
 std::vector<CTxIn> vecMasternodesUsed;
 // Keep track of the scanning errors I've seen
 map<uint256, CDarksendBroadcastTx> mapDarksendBroadcastTxes;
 // Keep track of the active Masternode
 CActiveMasternode activeMasternode;
+// Runs the Darksend and Masternode tasks on the Darksend thread
+CScheduler darkSendScheduler;
 
 // Count peers we've requested the list from
 int RequestedMasterNodeList = 0;
@@ -46,6 +49,7 @@ int RequestedMasterNodeList = 0;
 
 void CDarksendPool::ProcessMessageDarksend(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
 {
+    CTraceSpan span("ProcessMessageDarksend", strCommand);
     if(fLiteMode) return; //disable all Darksend/Masternode related functionality
     if(IsInitialBlockDownload()) return;
 
@@ -112,17 +116,26 @@ void CDarksendPool::ProcessMessageDarksend(CNode* pfrom, std::string& strCommand
         CDarksendQueue dsq;
         vRecv >> dsq;
 
-        CService addr;
-        if(!dsq.GetAddress(addr)) return;
-        if(!dsq.CheckSignature()) return;
-
         if(dsq.IsExpired()) return;
 
+        // every dsq is checked once, repeats only cost a lookup
+        if(darkSendQueues.Seen(dsq.GetHash())) return;
+        // one queue per Masternode at a time
+        if(!dsq.ready && darkSendQueues.HasMasternode(dsq.vin)) return;
+
         CMasternode* pmn = mnodeman.Find(dsq.vin);
         if(pmn == NULL) return;
+        CService addr = pmn->addr;
+
+        if(!dsq.CheckSignature(*pmn)) {
+            darkSendQueues.Add(dsq, false);
+            return;
+        }
 
         // if the queue is ready, submit if we can
         if(dsq.ready) {
+            darkSendQueues.Add(dsq, false);
+
             if(!pSubmittedToMasternode) return;
             if((CNetAddr)pSubmittedToMasternode->addr != (CNetAddr)addr){
                 LogPrintf("dsq - message doesn't match current Masternode - %s != %s\n", pSubmittedToMasternode->addr.ToString().c_str(), addr.ToString().c_str());
@@ -134,15 +147,12 @@ void CDarksendPool::ProcessMessageDarksend(CNode* pfrom, std::string& strCommand
                 PrepareDarksendDenominate();
             }
         } else {
-            BOOST_FOREACH(CDarksendQueue q, vecDarksendQueue){
-                if(q.vin == dsq.vin) return;
-            }
-
             if(fDebug) LogPrintf("dsq last %d last2 %d count %d\n", pmn->nLastDsq, pmn->nLastDsq + mnodeman.size()/5, mnodeman.nDsqCount);
             //don't allow a few nodes to dominate the queuing process
             if(pmn->nLastDsq != 0 &&
                 pmn->nLastDsq + mnodeman.CountMasternodesAboveProtocol(MIN_POOL_PEER_PROTO_VERSION)/5 > mnodeman.nDsqCount){
                 if(fDebug) LogPrintf("dsq -- Masternode sending too many dsq messages. %s \n", pmn->addr.ToString().c_str());
+                darkSendQueues.Add(dsq, false);
                 return;
             }
             mnodeman.nDsqCount++;
@@ -150,9 +160,8 @@ void CDarksendPool::ProcessMessageDarksend(CNode* pfrom, std::string& strCommand
             pmn->allowFreeTx = true;
 
             if(fDebug) LogPrintf("dsq - new Darksend queue object - %s\n", addr.ToString().c_str());
-            vecDarksendQueue.push_back(dsq);
+            darkSendQueues.Add(dsq, true);
             dsq.Relay();
-            dsq.time = GetTime();
         }
 
     } else if (strCommand == "dsi") { //DarkSend vIn
@@ -415,7 +424,7 @@ int GetInputDarksendRounds(CTxIn in, int rounds)
         }
 
         mDenomWtxes[hash].vout[nout].nRounds = -3;
-        if(pwalletMain->IsCollateralAmount(wtx.vout[nout].nValue))
+        if(wtx.GetOutputClass(nout) == OUTPUT_CLASS_COLLATERAL)
         {
             mDenomWtxes[hash].vout[nout].nRounds = -3;
             if(fDebug) LogPrintf("GetInputDarksendRounds UPDATED   %s %3d %d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
@@ -424,7 +433,7 @@ int GetInputDarksendRounds(CTxIn in, int rounds)
 
         //make sure the final output is non-denominate
         mDenomWtxes[hash].vout[nout].nRounds = -2;
-        if(/*rounds == 0 && */!pwalletMain->IsDenominatedAmount(wtx.vout[nout].nValue)) //NOT DENOM
+        if(/*rounds == 0 && */!wtx.IsDenominatedOutput(nout)) //NOT DENOM
         {
             mDenomWtxes[hash].vout[nout].nRounds = -2;
             if(fDebug) LogPrintf("GetInputDarksendRounds UPDATED   %s %3d %d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
@@ -432,10 +441,8 @@ int GetInputDarksendRounds(CTxIn in, int rounds)
         }
 
         bool fAllDenoms = true;
-        BOOST_FOREACH(CTxOut out, wtx.vout)
-        {
-            fAllDenoms = fAllDenoms && pwalletMain->IsDenominatedAmount(out.nValue);
-        }
+        for(unsigned int i = 0; i < wtx.vout.size() && fAllDenoms; i++)
+            fAllDenoms = wtx.IsDenominatedOutput(i);
         // this one is denominated but there is another non-denominated output found in the same tx
         if(!fAllDenoms)
         {
@@ -530,6 +537,13 @@ void CDarksendPool::UnlockCoins(){
     lockedCoins.clear();
 }
 
+// Mix another round if the pool isn't busy
+static void AutomaticDenominating()
+{
+    if(darkSendPool.GetState() == POOL_STATUS_IDLE)
+        darkSendPool.DoAutomaticDenominating();
+}
+
 //
 // Check the Darksend progress and send client updates if a Masternode
 //
@@ -591,6 +605,9 @@ void CDarksendPool::Check()
         SetNull(true);
         if(fMasterNode) RelayStatus(darkSendPool.sessionID, darkSendPool.GetState(), darkSendPool.GetEntriesCount(), MASTERNODE_RESET);
         UnlockCoins();
+
+        // start on the next session right away instead of at the next round
+        if(!fMasterNode) darkSendScheduler.ScheduleNow(&AutomaticDenominating);
     }
 }
 
@@ -837,22 +854,8 @@ void CDarksendPool::CheckTimeout(){
         }
     }
 
-{
-         TRY_LOCK(cs_darksend, lockDS);
-         if(!lockDS) return; // it's ok to fail here, we run this quite frequently
-         // check Darksend queue objects for timeouts
-         int c = 0;
-         vector<CDarksendQueue>::iterator it;
-         for(it=vecDarksendQueue.begin();it<vecDarksendQueue.end();it++){
-             if((*it).IsExpired()){
-                 if(fDebug) LogPrintf("CDarksendPool::CheckTimeout() : Removing expired queue entry - %d\n", c);
-                 vecDarksendQueue.erase(it);
-                 break;
-             }
-             c++;
-        }
-        c++;
-    }
+    // check Darksend queue objects for timeouts
+    darkSendQueues.Expire();
 
     int addLagTime = 0;
     if(!fMasterNode) addLagTime = 10000; //if we're the client, give the server a few extra seconds before resetting.
@@ -1510,9 +1513,13 @@ bool CDarksendPool::DoAutomaticDenominating(bool fDryRun, bool ready)
         if(nUseQueue > 33){
 
             // Look through the queues and see if anything matches
-            BOOST_FOREACH(CDarksendQueue& dsq, vecDarksendQueue){
+            std::vector<CDarksendQueue> vQueues;
+            darkSendQueues.GetQueues(vQueues);
+            // denominations our coins couldn't match, no need to try them again
+            std::set<int> setUnmatchedDenoms;
+            BOOST_FOREACH(CDarksendQueue& dsq, vQueues){
                 CService addr;
-                if(dsq.time == 0) continue;
+                if(setUnmatchedDenoms.count(dsq.nDenom)) continue;
 
                 if(!dsq.GetAddress(addr)) continue;
                 if(dsq.IsExpired()) continue;
@@ -1536,6 +1543,7 @@ bool CDarksendPool::DoAutomaticDenominating(bool fDryRun, bool ready)
                 // Try to match their denominations if possible
                 if (!pwalletMain->SelectCoinsByDenominations(dsq.nDenom, nValueMin, nBalanceNeedsAnonymized, vTempCoins, vTempCoins2, nValueIn, 0, nDarksendRounds)){
                     LogPrintf("DoAutomaticDenominating - Couldn't match denominations %d\n", dsq.nDenom);
+                    setUnmatchedDenoms.insert(dsq.nDenom);
                     continue;
                 }
 
@@ -1565,13 +1573,13 @@ bool CDarksendPool::DoAutomaticDenominating(bool fDryRun, bool ready)
                         pNode->PushMessage("dsa", sessionDenom, txCollateral);
                         LogPrintf("DoAutomaticDenominating --- connected (from queue), sending dsa for %d %d - %s\n", sessionDenom, GetDenominationsByAmount(sessionTotalValue), pNode->addr.ToString().c_str());
                         strAutoDenomResult = "";
-                        dsq.time = 0; //remove node
+                        darkSendQueues.Remove(dsq);
                         return true;
                     }
                 } else {
                     LogPrintf("DoAutomaticDenominating --- error connecting \n");
                     strAutoDenomResult = _("Error connecting to Masternode.");
-                    dsq.time = 0; //remove node
+                    darkSendQueues.Remove(dsq);
                     return DoAutomaticDenominating();
                 }
             }
@@ -1886,6 +1894,9 @@ bool CDarksendPool::IsCompatibleWithSession(int64_t nDenom, CTransaction txColla
     lastTimeChanged = GetTimeMillis();
     vecSessionCollateral.push_back(txCollateral);
 
+    // the queue may be full now, announce it without waiting for the next check
+    if(!unitTest) darkSendScheduler.ScheduleNow(boost::bind(&CDarksendPool::CheckForCompleteQueue, this));
+
     return true;
 }
 
@@ -2142,18 +2153,90 @@ bool CDarksendQueue::CheckSignature()
     CMasternode* pmn = mnodeman.Find(vin);
 
     if(pmn != NULL)
-    {
-        std::string strMessage = vin.ToString() + boost::lexical_cast<std::string>(nDenom) + boost::lexical_cast<std::string>(time) + boost::lexical_cast<std::string>(ready);
+        return CheckSignature(*pmn);
 
-        std::string errorMessage = "";
-        if(!darkSendSigner.VerifyMessage(pmn->pubkey2, vchSig, strMessage, errorMessage)){
-            return error("CDarksendQueue::CheckSignature() - Got bad Masternode address signature %s \n", vin.ToString().c_str());
-        }
+    return false;
+}
 
-        return true;
+bool CDarksendQueue::CheckSignature(const CMasternode& mn)
+{
+    std::string strMessage = vin.ToString() + boost::lexical_cast<std::string>(nDenom) + boost::lexical_cast<std::string>(time) + boost::lexical_cast<std::string>(ready);
+
+    std::string errorMessage = "";
+    if(!darkSendSigner.VerifyMessage(mn.pubkey2, vchSig, strMessage, errorMessage)){
+        return error("CDarksendQueue::CheckSignature() - Got bad Masternode address signature %s \n", vin.ToString().c_str());
     }
 
-    return false;
+    return true;
+}
+
+bool CDarksendQueueIndex::Seen(const uint256& hash) const
+{
+    LOCK(cs);
+    return setSeen.count(hash);
+}
+
+void CDarksendQueueIndex::Add(const CDarksendQueue& dsq, bool fAccepted)
+{
+    LOCK(cs);
+
+    uint256 hash = dsq.GetHash();
+    QueueKey key = make_pair(dsq.vin.prevout, dsq.nDenom);
+
+    setSeen.insert(hash);
+    if(fAccepted) mapQueues[key] = dsq;
+
+    // a dsq signed with a time ahead of ours is still forgotten one timeout after it arrived
+    int64_t nExpire = std::min(dsq.time, GetTime()) + DARKSEND_QUEUE_TIMEOUT;
+    heapExpiry.push(make_pair(nExpire, make_pair(hash, key)));
+}
+
+void CDarksendQueueIndex::Remove(const CDarksendQueue& dsq)
+{
+    LOCK(cs);
+    mapQueues.erase(make_pair(dsq.vin.prevout, dsq.nDenom));
+}
+
+bool CDarksendQueueIndex::HasMasternode(const CTxIn& vin) const
+{
+    LOCK(cs);
+    std::map<QueueKey, CDarksendQueue>::const_iterator it = mapQueues.lower_bound(make_pair(vin.prevout, std::numeric_limits<int>::min()));
+    return it != mapQueues.end() && it->first.first == vin.prevout;
+}
+
+void CDarksendQueueIndex::GetQueues(std::vector<CDarksendQueue>& vQueues) const
+{
+    LOCK(cs);
+    vQueues.clear();
+    vQueues.reserve(mapQueues.size());
+    for(std::map<QueueKey, CDarksendQueue>::const_iterator it = mapQueues.begin(); it != mapQueues.end(); ++it)
+        if(!it->second.IsExpired()) vQueues.push_back(it->second);
+}
+
+void CDarksendQueueIndex::Expire()
+{
+    LOCK(cs);
+
+    int64_t nNow = GetTime();
+    while(!heapExpiry.empty() && heapExpiry.top().first < nNow) {
+        uint256 hash = heapExpiry.top().second.first;
+        QueueKey key = heapExpiry.top().second.second;
+        heapExpiry.pop();
+
+        setSeen.erase(hash);
+        // the Masternode may have announced a newer queue of this denomination since
+        std::map<QueueKey, CDarksendQueue>::iterator it = mapQueues.find(key);
+        if(it != mapQueues.end() && it->second.GetHash() == hash) {
+            if(fDebug) LogPrintf("CDarksendQueueIndex::Expire() : Removing expired queue entry - %s\n", it->second.vin.ToString());
+            mapQueues.erase(it);
+        }
+    }
+}
+
+unsigned int CDarksendQueueIndex::size() const
+{
+    LOCK(cs);
+    return mapQueues.size();
 }
 
 
@@ -2203,80 +2286,74 @@ void CDarksendPool::RelayCompletedTransaction(const int sessionID, const bool er
 }
 
 //TODO: Rename/move to core
-void ThreadCheckDarkSendPool()
+static void DarkSendMaintenance()
 {
-    if(fLiteMode) return; //disable all Darksend/Masternode related functionality
-
-    // Make this thread recognisable as the wallet flushing thread
-    RenameThread("testinterzone-darksend");
-
-    unsigned int c = 0;
-    std::string errorMessage;
-
-    while (true)
     {
-        c++;
-
-        MilliSleep(1000);
-        //LogPrintf("ThreadCheckDarkSendPool::check timeout\n");
+        LOCK(cs_main);
+        /*
+            cs_main is required for doing CMasternode.Check because something
+            is modifying the coins view without a mempool lock. It causes
+            segfaults from this code without the cs_main lock.
+        */
+        mnodeman.CheckAndRemove();
+        mnodeman.ProcessMasternodeConnections();
+        masternodePayments.CleanPaymentList();
+        CleanTransactionLocksList();
+    }
+
+    //if we've used 1/5 of the Masternode list, then clear the list.
+    if((int)vecMasternodesUsed.size() > (int)mnodeman.size() / 5)
+        vecMasternodesUsed.clear();
+}
 
-        darkSendPool.CheckTimeout();
-        darkSendPool.CheckForCompleteQueue();
+//try to sync the Masternode list and payment list every 5 seconds from at least 3 nodes
+static void RequestMasternodeList()
+{
+    if(RequestedMasterNodeList >= 3) return;
 
-        if(c % 60 == 0)
+    bool fIsInitialDownload = IsInitialBlockDownload();
+    if(!fIsInitialDownload) {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
         {
-            LOCK(cs_main);
-            /*
-                cs_main is required for doing CMasternode.Check because something
-                is modifying the coins view without a mempool lock. It causes
-                segfaults from this code without the cs_main lock.
-            */
-            mnodeman.CheckAndRemove();
-            mnodeman.ProcessMasternodeConnections();
-            masternodePayments.CleanPaymentList();
-            CleanTransactionLocksList();
-        }
+            if (pnode->nVersion >= MIN_POOL_PEER_PROTO_VERSION) {
 
-        if(c % MASTERNODE_PING_SECONDS == 0) activeMasternode.ManageStatus();
+                //keep track of who we've asked for the list
+                if(pnode->HasFulfilledRequest("mnsync")) continue;
+                pnode->FulfilledRequest("mnsync");
 
-        if(c % MASTERNODES_DUMP_SECONDS == 0) DumpMasternodes();
+                LogPrintf("Successfully synced, asking for Masternode list and payment list\n");
 
-        //try to sync the Masternode list and payment list every 5 seconds from at least 3 nodes
-        if(c % 5 == 0 && RequestedMasterNodeList < 3){
-            bool fIsInitialDownload = IsInitialBlockDownload();
-            if(!fIsInitialDownload) {
-                LOCK(cs_vNodes);
-                BOOST_FOREACH(CNode* pnode, vNodes)
-                {
-                    if (pnode->nVersion >= MIN_POOL_PEER_PROTO_VERSION) {
+                //request full mn list only if Masternodes.dat was updated quite a long time ago
+                mnodeman.DsegUpdate(pnode);
 
-                        //keep track of who we've asked for the list
-                        if(pnode->HasFulfilledRequest("mnsync")) continue;
-                        pnode->FulfilledRequest("mnsync");
-
-                        LogPrintf("Successfully synced, asking for Masternode list and payment list\n");
-
-                        //request full mn list only if Masternodes.dat was updated quite a long time ago
-                        mnodeman.DsegUpdate(pnode);
-
-                        pnode->PushMessage("mnget"); //sync payees
-                        pnode->PushMessage("getsporks"); //get current network sporks
-                        RequestedMasterNodeList++;
-                    }
-                }
+                pnode->PushMessage("mnget"); //sync payees
+                pnode->PushMessage("getsporks"); //get current network sporks
+                RequestedMasterNodeList++;
             }
         }
+    }
+}
 
-        if(c % 60 == 0){
-            //if we've used 1/5 of the Masternode list, then clear the list.
-            if((int)vecMasternodesUsed.size() > (int)mnodeman.size() / 5)
-                vecMasternodesUsed.clear();
-        }
+void ThreadCheckDarkSendPool()
+{
+    if(fLiteMode) return; //disable all Darksend/Masternode related functionality
 
-        if(darkSendPool.GetState() == POOL_STATUS_IDLE && c % 6 == 0){
-            darkSendPool.DoAutomaticDenominating();
-        }
-    }
+    // Make this thread recognisable as the wallet flushing thread
+    RenameThread("testinterzone-darksend");
+
+    // Timeouts are still checked every second; everything that follows from a
+    // message (a full queue, a finished session) is scheduled to run now by
+    // the code that handles it.
+    darkSendScheduler.ScheduleEvery(boost::bind(&CDarksendPool::CheckTimeout, &darkSendPool), 1000, 1000);
+    darkSendScheduler.ScheduleEvery(&DarkSendMaintenance, 60 * 1000, 60 * 1000);
+    darkSendScheduler.ScheduleEvery(boost::bind(&CActiveMasternode::ManageStatus, &activeMasternode),
+        MASTERNODE_PING_SECONDS * 1000, MASTERNODE_PING_SECONDS * 1000);
+    darkSendScheduler.ScheduleEvery(&DumpMasternodesAsync, MASTERNODES_DUMP_SECONDS * 1000, MASTERNODES_DUMP_SECONDS * 1000);
+    darkSendScheduler.ScheduleEvery(&RequestMasternodeList, 5 * 1000, 5 * 1000);
+    darkSendScheduler.ScheduleEvery(&AutomaticDenominating, 6 * 1000, 6 * 1000);
+
+    darkSendScheduler.ServiceQueue();
 }
 
 
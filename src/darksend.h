@@ -11,6 +11,12 @@
 #include "activemasternode.h"
 #include "masternodeman.h"
 #include "darksend-relay.h"
+#include "scheduler.h"
+
+#include <functional>
+#include <queue>
+
+#include <boost/bind.hpp>
 
 class CTxIn;
 class CDarksendPool;
@@ -18,6 +24,7 @@ class CDarkSendSigner;
 class CMasterNodeVote;
 class CBitcoinAddress;
 class CDarksendQueue;
+class CDarksendQueueIndex;
 class CDarksendBroadcastTx;
 class CActiveMasternode;
 
@@ -49,10 +56,11 @@ class CActiveMasternode;
 
 extern CDarksendPool darkSendPool;
 extern CDarkSendSigner darkSendSigner;
-extern std::vector<CDarksendQueue> vecDarksendQueue;
+extern CDarksendQueueIndex darkSendQueues;
 extern std::string strMasterNodePrivKey;
 extern map<uint256, CDarksendBroadcastTx> mapDarksendBroadcastTxes;
 extern CActiveMasternode activeMasternode;
+extern CScheduler darkSendScheduler;
 
 // get the Darksend chain depth for a given input
 int GetInputDarksendRounds(CTxIn in, int rounds=0);
@@ -183,6 +191,8 @@ public:
         READWRITE(vchSig);
     )
 
+    uint256 GetHash() const {return SerializeHash(*this);}
+
     bool GetAddress(CService &addr)
     {
         CMasternode* pmn = mnodeman.Find(vin);
@@ -218,14 +228,52 @@ public:
     bool Relay();
 
     /// Is this Darksend expired?
-    bool IsExpired()
+    bool IsExpired() const
     {
         return (GetTime() - time) > DARKSEND_QUEUE_TIMEOUT;// 120 seconds
     }
 
     /// Check if we have a valid Masternode address
     bool CheckSignature();
+    /// Check the signature against an already looked up Masternode
+    bool CheckSignature(const CMasternode& mn);
+
+};
 
+/** The Darksend queues announced on the network, by Masternode input and
+ *  denomination. Every dsq is verified once and remembered until it
+ *  expires, so repeats cost a lookup instead of a signature check, and
+ *  a heap of expiry times lets timeouts pop entries instead of scanning.
+ */
+class CDarksendQueueIndex
+{
+private:
+    // critical section to protect the inner data structures
+    mutable CCriticalSection cs;
+
+    typedef std::pair<COutPoint, int> QueueKey;
+    // (expiry time, (dsq hash, queue key)), the earliest on top
+    typedef std::pair<int64_t, std::pair<uint256, QueueKey> > ExpiryEntry;
+
+    // accepted queues
+    std::map<QueueKey, CDarksendQueue> mapQueues;
+    // every dsq handled already, accepted or not
+    std::set<uint256> setSeen;
+    std::priority_queue<ExpiryEntry, std::vector<ExpiryEntry>, std::greater<ExpiryEntry> > heapExpiry;
+
+public:
+    /// Has the dsq been handled before
+    bool Seen(const uint256& hash) const;
+    /// Remember the dsq as handled until it expires, and keep it as a queue if accepted
+    void Add(const CDarksendQueue& dsq, bool fAccepted);
+    void Remove(const CDarksendQueue& dsq);
+    /// Does the Masternode have a queue of any denomination
+    bool HasMasternode(const CTxIn& vin) const;
+    /// The queues that haven't expired, in Masternode input order
+    void GetQueues(std::vector<CDarksendQueue>& vQueues) const;
+    /// Drop the queues and seen entries that have timed out
+    void Expire();
+    unsigned int size() const;
 };
 
 /** Helper class to store Darksend transaction (tx) information.
@@ -404,6 +452,9 @@ public:
             if(fMasterNode) {
                 RelayStatus(darkSendPool.sessionID, darkSendPool.GetState(), darkSendPool.GetEntriesCount(), MASTERNODE_RESET);
             }
+            // come back to reset the pool once the result has been shown long enough
+            if(newState == POOL_STATUS_ERROR || newState == POOL_STATUS_SUCCESS)
+                darkSendScheduler.Schedule(boost::bind(&CDarksendPool::Check, this), 10000);
         }
         state = newState;
     }
@@ -222,7 +222,7 @@ void CDBEnv::CheckpointLSN(std::string strFile)
 
 
 CDB::CDB(const char *pszFile, const char* pszMode) :
-    pdb(NULL), activeTxn(NULL)
+    pdb(NULL), activeTxn(NULL), fDirty(false)
 {
     int ret;
     if (pszFile == NULL)
@@ -289,9 +289,10 @@ void CDB::Flush()
     if (activeTxn)
         return;
 
-    // Flush database activity from memory pool to disk log
+    // Flush database activity from memory pool to disk log. Handles that only
+    // read or queued writes on the journal checkpoint lazily like read-only ones.
     unsigned int nMinutes = 0;
-    if (fReadOnly)
+    if (fReadOnly || !fDirty)
         nMinutes = 1;
 
     bitdb.dbenv.txn_checkpoint(nMinutes ? GetArg("-dblogsize", 100)*1024 : 0, nMinutes, 0);
@@ -340,6 +341,7 @@ bool CDBEnv::RemoveDb(const string& strFile)
 
 bool CDB::Rewrite(const string& strFile, const char* pszSkip)
 {
+    bitdb.journal.Flush(strFile);
     while (true)
     {
         {
@@ -439,6 +441,9 @@ void CDBEnv::Flush(bool fShutdown)
     LogPrint("db", "CDBEnv::Flush : Flush(%s)%s\n", fShutdown ? "true" : "false", fDbEnvInit ? "" : " database not started");
     if (!fDbEnvInit)
         return;
+    if (fShutdown)
+        journal.SetEnabled(false);
+    journal.Flush();
     {
         LOCK(cs_db);
         map<string, int>::iterator mi = mapFileUseCount.begin();
@@ -477,3 +482,181 @@ void CDBEnv::Flush(bool fShutdown)
     }
 }
 
+
+//
+// CDBWriteJournal
+//
+
+/** Applies one journal batch to a database file in a single transaction */
+class CDBJournalWriter : public CDB
+{
+public:
+    CDBJournalWriter(const string& strFileIn) : CDB(strFileIn.c_str(), "r+") {}
+
+    bool Apply(const CDBWriteJournal::Batch& batch)
+    {
+        if (!pdb)
+            return false;
+        activeTxn = bitdb.TxnBegin();
+        if (!activeTxn)
+            return false;
+        int ret = 0;
+        for (CDBWriteJournal::Batch::const_iterator it = batch.begin(); it != batch.end(); ++it)
+        {
+            Dbt datKey((void*)&it->first[0], it->first.size());
+            if (it->second.fErase)
+            {
+                ret = pdb->del(activeTxn, &datKey, 0);
+                if (ret == DB_NOTFOUND)
+                    ret = 0;
+            }
+            else
+            {
+                Dbt datValue((void*)&it->second.value[0], it->second.value.size());
+                ret = pdb->put(activeTxn, &datKey, &datValue, 0);
+            }
+            if (ret != 0)
+                break;
+        }
+        if (ret != 0)
+        {
+            activeTxn->abort();
+            activeTxn = NULL;
+            return error("CDBJournalWriter::Apply : Error %d writing %s: %s", ret, strFile, DbEnv::strerror(ret));
+        }
+        // One log sync for the whole group
+        ret = activeTxn->commit(DB_TXN_SYNC);
+        activeTxn = NULL;
+        if (ret != 0)
+            return error("CDBJournalWriter::Apply : Error %d committing %s: %s", ret, strFile, DbEnv::strerror(ret));
+        return true;
+    }
+};
+
+void CDBWriteJournal::SetEnabled(bool fEnabledIn)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    fEnabled = fEnabledIn;
+}
+
+bool CDBWriteJournal::Queue(const string& strFile, const CSerializeData& key, const CSerializeData* pvalue)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    if (!fEnabled)
+        return false;
+    fHasRecords = true;
+    Entry& entry = mapQueued[strFile][key];
+    entry.fErase = (pvalue == NULL);
+    if (pvalue)
+        entry.value = *pvalue;
+    else
+        entry.value.clear();
+    condQueued.notify_one();
+    return true;
+}
+
+bool CDBWriteJournal::Lookup(const string& strFile, const CSerializeData& key, Entry& entryRet) const
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    const std::map<string, Batch>* maps[] = { &mapQueued, &mapCommitting };
+    for (int i = 0; i < 2; i++)
+    {
+        std::map<string, Batch>::const_iterator mi = maps[i]->find(strFile);
+        if (mi == maps[i]->end())
+            continue;
+        Batch::const_iterator it = mi->second.find(key);
+        if (it != mi->second.end())
+        {
+            entryRet = it->second;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CDBWriteJournal::HasPending(const string& strFile) const
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    return mapQueued.count(strFile) || mapCommitting.count(strFile);
+}
+
+bool CDBWriteJournal::CommitBatch(const string& strFile, const Batch& batch)
+{
+    int64_t nStart = GetTimeMicros();
+    bool fSuccess;
+    {
+        CDBJournalWriter db(strFile);
+        fSuccess = db.Apply(batch);
+    }
+    nWalletDBUpdated++;
+    LogPrint("db", "CDBWriteJournal : committed %u records to %s in %.2fms\n",
+             batch.size(), strFile, (GetTimeMicros() - nStart) * 0.001);
+    return fSuccess;
+}
+
+bool CDBWriteJournal::Flush(const string& strFile)
+{
+    boost::unique_lock<boost::mutex> lockCommit(csCommit);
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (strFile.empty())
+            mapCommitting.swap(mapQueued);
+        else
+        {
+            std::map<string, Batch>::iterator mi = mapQueued.find(strFile);
+            if (mi == mapQueued.end())
+                return true;
+            mapCommitting[strFile].swap(mi->second);
+            mapQueued.erase(mi);
+        }
+    }
+
+    bool fSuccess = true;
+    for (std::map<string, Batch>::const_iterator mi = mapCommitting.begin(); mi != mapCommitting.end(); ++mi)
+    {
+        if (CommitBatch(mi->first, mi->second))
+            continue;
+        fSuccess = false;
+
+        // Keep the failed records queued behind anything newer and retry with the next commit
+        boost::unique_lock<boost::mutex> lock(cs);
+        Batch& batchQueued = mapQueued[mi->first];
+        for (Batch::const_iterator it = mi->second.begin(); it != mi->second.end(); ++it)
+            batchQueued.insert(*it);
+    }
+
+    boost::unique_lock<boost::mutex> lock(cs);
+    mapCommitting.clear();
+    fHasRecords = !mapQueued.empty();
+    return fSuccess;
+}
+
+void CDBWriteJournal::WaitAndCommit(int64_t nDelayMillis)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (mapQueued.empty())
+            condQueued.wait(lock);
+    }
+    // Group commit: whatever else is queued during the window goes in the same transaction
+    MilliSleep(nDelayMillis);
+    Flush();
+}
+
+void ThreadDBWriteBehind(int64_t nDelayMillis)
+{
+    RenameThread("testinterzone-dbwriter");
+    bitdb.journal.SetEnabled(true);
+    try
+    {
+        while (true)
+            bitdb.journal.WaitAndCommit(nDelayMillis);
+    }
+    catch (boost::thread_interrupted)
+    {
+        // Later writes go straight to the database
+        bitdb.journal.SetEnabled(false);
+        bitdb.journal.Flush();
+        throw;
+    }
+}
@@ -15,6 +15,8 @@
 #include <vector>
 
 #include <boost/filesystem/path.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
 #include <db_cxx.h>
 
 class CAddrMan;
@@ -24,7 +26,61 @@ class COutPoint;
 
 extern unsigned int nWalletDBUpdated;
 
+/** Default group commit window for queued wallet writes, in milliseconds (0 writes synchronously) */
+static const int64_t DEFAULT_WALLET_WRITE_DELAY = 50;
+
 void ThreadFlushWalletDB(const std::string& strWalletFile);
+void ThreadDBWriteBehind(int64_t nDelayMillis);
+
+/**
+ * Write-behind journal for database records. Queued puts and erases are
+ * coalesced per key and committed in one transaction per file, so a record
+ * is never committed after a record that was queued later. Reads see queued
+ * records; cursors, explicit transactions and synchronous writes commit the
+ * file's queue first.
+ */
+class CDBWriteJournal
+{
+public:
+    /** Queued record: fErase, or the serialized value to put */
+    struct Entry
+    {
+        bool fErase;
+        CSerializeData value;
+    };
+    typedef std::map<CSerializeData, Entry> Batch;
+
+    CDBWriteJournal() : fEnabled(false), fHasRecords(false) {}
+
+    /** While disabled nothing can be queued and CDB writes synchronously */
+    bool IsEnabled() const { return fEnabled; }
+    void SetEnabled(bool fEnabledIn);
+    /** Whether reads need to consult the journal */
+    bool IsActive() const { return fEnabled || fHasRecords; }
+
+    /** Queue a put of *pvalue, or an erase if pvalue is NULL. Returns false if disabled */
+    bool Queue(const std::string& strFile, const CSerializeData& key, const CSerializeData* pvalue);
+    /** Find a record that is queued or being committed. Returns false if the database is authoritative */
+    bool Lookup(const std::string& strFile, const CSerializeData& key, Entry& entryRet) const;
+    /** Whether strFile has records that are queued or being committed */
+    bool HasPending(const std::string& strFile) const;
+    /** Commit everything queued for strFile, or for all files if empty, before returning */
+    bool Flush(const std::string& strFile = "");
+    /** Wait for queued records, let more gather for nDelayMillis, then commit them all */
+    void WaitAndCommit(int64_t nDelayMillis);
+
+private:
+    volatile bool fEnabled;
+    volatile bool fHasRecords;
+    mutable boost::mutex cs;
+    boost::condition_variable condQueued;
+    std::map<std::string, Batch> mapQueued;
+    std::map<std::string, Batch> mapCommitting;
+    // Held while a batch is written so batches commit in the order they were taken
+    boost::mutex csCommit;
+
+    bool CommitBatch(const std::string& strFile, const Batch& batch);
+};
 
 
 class CDBEnv
@@ -41,6 +97,7 @@ public:
     DbEnv dbenv;
     std::map<std::string, int> mapFileUseCount;
     std::map<std::string, Db*> mapDb;
+    CDBWriteJournal journal;
 
     CDBEnv();
     ~CDBEnv();
@@ -94,6 +151,7 @@ protected:
     std::string strFile;
     DbTxn *activeTxn;
     bool fReadOnly;
+    bool fDirty;
 
     explicit CDB(const char* pszFile, const char* pszMode="r+");
     ~CDB() { Close(); }
@@ -117,6 +175,26 @@ protected:
         ssKey << key;
         Dbt datKey(&ssKey[0], ssKey.size());
 
+        // Queued writes are newer than anything in the database
+        if (bitdb.journal.IsActive())
+        {
+            CDBWriteJournal::Entry entry;
+            if (bitdb.journal.Lookup(strFile, CSerializeData(ssKey.begin(), ssKey.end()), entry))
+            {
+                memset(datKey.get_data(), 0, datKey.get_size());
+                if (entry.fErase)
+                    return false;
+                try {
+                    CDataStream ssValue(entry.value.begin(), entry.value.end(), SER_DISK, CLIENT_VERSION);
+                    ssValue >> value;
+                }
+                catch (std::exception &e) {
+                    return false;
+                }
+                return true;
+            }
+        }
+
         // Read
         Dbt datValue;
         datValue.set_flags(DB_DBT_MALLOC);
@@ -147,6 +225,7 @@ protected:
             return false;
         if (fReadOnly)
             assert(!"Write called on database in read-only mode");
+        FlushJournal();
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
@@ -162,6 +241,7 @@ protected:
 
         // Write
         int ret = pdb->put(activeTxn, &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
+        fDirty = true;
 
         // Clear memory in case it was a private key
         memset(datKey.get_data(), 0, datKey.get_size());
@@ -176,6 +256,7 @@ protected:
             return false;
         if (fReadOnly)
             assert(!"Erase called on database in read-only mode");
+        FlushJournal();
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
@@ -185,6 +266,7 @@ protected:
 
         // Erase
         int ret = pdb->del(activeTxn, &datKey, 0);
+        fDirty = true;
 
         // Clear memory
         memset(datKey.get_data(), 0, datKey.get_size());
@@ -203,6 +285,16 @@ protected:
         ssKey << key;
         Dbt datKey(&ssKey[0], ssKey.size());
 
+        if (bitdb.journal.IsActive())
+        {
+            CDBWriteJournal::Entry entry;
+            if (bitdb.journal.Lookup(strFile, CSerializeData(ssKey.begin(), ssKey.end()), entry))
+            {
+                memset(datKey.get_data(), 0, datKey.get_size());
+                return !entry.fErase;
+            }
+        }
+
         // Exists
         int ret = pdb->exists(activeTxn, &datKey, 0);
 
@@ -211,10 +303,61 @@ protected:
         return (ret == 0);
     }
 
+    /** Queue a write on the write-behind journal, or write now if the journal is not running */
+    template<typename K, typename T>
+    bool WriteBehind(const K& key, const T& value)
+    {
+        if (activeTxn || !bitdb.journal.IsEnabled())
+            return Write(key, value);
+        if (!pdb)
+            return false;
+        if (fReadOnly)
+            assert(!"Write called on database in read-only mode");
+
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(1000);
+        ssKey << key;
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue.reserve(10000);
+        ssValue << value;
+        CSerializeData vchValue(ssValue.begin(), ssValue.end());
+        if (!bitdb.journal.Queue(strFile, CSerializeData(ssKey.begin(), ssKey.end()), &vchValue))
+            return Write(key, value);
+        return true;
+    }
+
+    /** Queue an erase on the write-behind journal, or erase now if the journal is not running */
+    template<typename K>
+    bool EraseBehind(const K& key)
+    {
+        if (activeTxn || !bitdb.journal.IsEnabled())
+            return Erase(key);
+        if (!pdb)
+            return false;
+        if (fReadOnly)
+            assert(!"Erase called on database in read-only mode");
+
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(1000);
+        ssKey << key;
+        if (!bitdb.journal.Queue(strFile, CSerializeData(ssKey.begin(), ssKey.end()), NULL))
+            return Erase(key);
+        return true;
+    }
+
+    /** Commit this file's queued writes, unless inside a transaction (TxnBegin already did) */
+    void FlushJournal()
+    {
+        if (!activeTxn && bitdb.journal.HasPending(strFile))
+            bitdb.journal.Flush(strFile);
+    }
+
     Dbc* GetCursor()
     {
         if (!pdb)
             return NULL;
+        // Cursors read the database directly
+        FlushJournal();
         Dbc* pcursor = NULL;
         int ret = pdb->cursor(NULL, &pcursor, 0);
         if (ret != 0)
@@ -261,11 +404,48 @@ protected:
         return 0;
     }
 
+    /**
+     * Read the records following the cursor with one bulk get, as many as fit
+     * in vchBuffer (grown if a single record does not fit). Returns DB_NOTFOUND
+     * at the end. The caller wipes vchBuffer's contents through its allocator.
+     */
+    int ReadAtCursorBulk(Dbc* pcursor, CSerializeData& vchBuffer, std::vector<std::pair<CSerializeData, CSerializeData> >& vRecords)
+    {
+        Dbt datKey;
+        Dbt datValue;
+        int ret;
+        while (true)
+        {
+            datValue.set_data(&vchBuffer[0]);
+            datValue.set_ulen(vchBuffer.size());
+            datValue.set_flags(DB_DBT_USERMEM);
+            ret = pcursor->get(&datKey, &datValue, DB_NEXT | DB_MULTIPLE_KEY);
+            if (ret != DB_BUFFER_SMALL)
+                break;
+            // Bulk buffers must be a multiple of 1024 bytes
+            vchBuffer.resize(((datValue.get_size() + 1023) / 1024) * 1024);
+        }
+        if (ret != 0)
+            return ret;
+
+        DbMultipleKeyDataIterator it(datValue);
+        Dbt datRecordKey, datRecordValue;
+        while (it.next(datRecordKey, datRecordValue))
+        {
+            const char* pkey = (const char*)datRecordKey.get_data();
+            const char* pvalue = (const char*)datRecordValue.get_data();
+            vRecords.push_back(std::make_pair(CSerializeData(pkey, pkey + datRecordKey.get_size()),
+                                              CSerializeData(pvalue, pvalue + datRecordValue.get_size())));
+        }
+        return 0;
+    }
+
 public:
     bool TxnBegin()
     {
         if (!pdb || activeTxn)
             return false;
+        FlushJournal();
         DbTxn* ptxn = bitdb.TxnBegin();
         if (!ptxn)
             return false;
@@ -279,6 +459,7 @@ public:
             return false;
         int ret = activeTxn->commit(0);
         activeTxn = NULL;
+        fDirty = true;
         return (ret == 0);
     }
 
@@ -0,0 +1,410 @@
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "jsonreader.h"
+
+#include <limits>
+#include <new>
+#include <locale>
+#include <sstream>
+#include <stdint.h>
+#include <string.h>
+
+using namespace json_spirit;
+using namespace std;
+
+// Containers nested deeper than this are not pre-counted, which keeps the
+// counting pass linear for pathological input
+static const unsigned int MAX_JSON_COUNT_DEPTH = 8;
+
+static const double dPow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool IsJSONSpace(char c)
+{
+    // Same set as the isspace() skipper json_spirit parses with
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/**
+ * Value::operator= copies its argument twice more on the way in, which dominates
+ * parsing time. Every slot filled here is either a freshly pushed null or the
+ * caller's result, so replace it by constructing in place instead.
+ */
+template<typename T>
+static inline void SetValue(Value& slot, const T& x)
+{
+    slot.~Value();
+    try {
+        new (&slot) Value(x);
+    } catch (...) {
+        new (&slot) Value();
+        throw;
+    }
+}
+
+static inline int HexDigit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Recursive descent parser that builds values in place in their parent
+ * container, so nothing is copied after it has been parsed.
+ */
+class CJSONReader
+{
+public:
+    CJSONReader(const char* pbeginIn, const char* pendIn) : p(pbeginIn), pend(pendIn) {}
+
+    bool ReadDocument(Value& valRet)
+    {
+        SkipSpace();
+        if (!ReadValue(valRet, 0))
+            return false;
+        SkipSpace();
+        return p == pend;
+    }
+
+private:
+    const char* p;
+    const char* pend;
+
+    void SkipSpace()
+    {
+        while (p < pend && IsJSONSpace(*p))
+            p++;
+    }
+
+    bool ReadLiteral(const char* pszLiteral, size_t nLen)
+    {
+        if ((size_t)(pend - p) < nLen || memcmp(p, pszLiteral, nLen) != 0)
+            return false;
+        p += nLen;
+        return true;
+    }
+
+    bool ReadValue(Value& val, unsigned int nDepth)
+    {
+        if (p >= pend)
+            return false;
+        switch (*p)
+        {
+        case '{':
+            return ReadObject(val, nDepth + 1);
+        case '[':
+            return ReadArray(val, nDepth + 1);
+        case '"':
+        {
+            string str;
+            if (!ReadString(str))
+                return false;
+            SetValue(val, str);
+            return true;
+        }
+        case 't':
+            SetValue(val, true);
+            return ReadLiteral("true", 4);
+        case 'f':
+            SetValue(val, false);
+            return ReadLiteral("false", 5);
+        case 'n':
+            SetValue(val, Value());
+            return ReadLiteral("null", 4);
+        default:
+            return ReadNumber(val);
+        }
+    }
+
+    /** Number of elements in the object or array starting at p, found by a quick scan */
+    size_t CountElements() const
+    {
+        const char* q = p + 1;
+        int nLevel = 0;
+        size_t nCommas = 0;
+        bool fEmpty = true;
+        for (; q < pend; q++)
+        {
+            char c = *q;
+            if (c == '"')
+            {
+                // Jump to the closing quote: one not preceded by an odd run of backslashes
+                while (true)
+                {
+                    q = (const char*)memchr(q + 1, '"', pend - q - 1);
+                    if (!q)
+                        return nCommas + 1;
+                    const char* r = q;
+                    while (r[-1] == '\\')
+                        r--;
+                    if ((q - r) % 2 == 0)
+                        break;
+                }
+            }
+            else if (c == '{' || c == '[')
+                nLevel++;
+            else if (c == '}' || c == ']')
+            {
+                if (nLevel-- == 0)
+                    break;
+            }
+            else if (c == ',' && nLevel == 0)
+                nCommas++;
+            if (!IsJSONSpace(c))
+                fEmpty = false;
+        }
+        return fEmpty ? 0 : nCommas + 1;
+    }
+
+    bool ReadObject(Value& val, unsigned int nDepth)
+    {
+        if (nDepth > MAX_JSON_DEPTH)
+            return false;
+        SetValue(val, Object());
+        Object& obj = val.get_obj();
+        if (nDepth <= MAX_JSON_COUNT_DEPTH)
+            obj.reserve(CountElements());
+        p++;
+        SkipSpace();
+        if (p < pend && *p == '}')
+        {
+            p++;
+            return true;
+        }
+        while (true)
+        {
+            if (p >= pend || *p != '"')
+                return false;
+            obj.push_back(Pair(string(), Value()));
+            Pair& pair = obj.back();
+            if (!ReadString(pair.name_))
+                return false;
+            SkipSpace();
+            if (p >= pend || *p != ':')
+                return false;
+            p++;
+            SkipSpace();
+            if (!ReadValue(pair.value_, nDepth))
+                return false;
+            SkipSpace();
+            if (p >= pend)
+                return false;
+            if (*p == '}')
+            {
+                p++;
+                return true;
+            }
+            if (*p != ',')
+                return false;
+            p++;
+            SkipSpace();
+        }
+    }
+
+    bool ReadArray(Value& val, unsigned int nDepth)
+    {
+        if (nDepth > MAX_JSON_DEPTH)
+            return false;
+        SetValue(val, Array());
+        Array& arr = val.get_array();
+        if (nDepth <= MAX_JSON_COUNT_DEPTH)
+            arr.reserve(CountElements());
+        p++;
+        SkipSpace();
+        if (p < pend && *p == ']')
+        {
+            p++;
+            return true;
+        }
+        while (true)
+        {
+            arr.push_back(Value());
+            if (!ReadValue(arr.back(), nDepth))
+                return false;
+            SkipSpace();
+            if (p >= pend)
+                return false;
+            if (*p == ']')
+            {
+                p++;
+                return true;
+            }
+            if (*p != ',')
+                return false;
+            p++;
+            SkipSpace();
+        }
+    }
+
+    bool ReadString(string& str)
+    {
+        p++; // opening quote
+        while (true)
+        {
+            const char* pstart = p;
+            while (p < pend && *p != '"' && *p != '\\')
+                p++;
+            if (p >= pend)
+                return false;
+            str.append(pstart, p);
+            if (*p == '"')
+            {
+                p++;
+                return true;
+            }
+
+            // Escapes decode exactly as json_spirit's do, so strings escaped by
+            // its writer (single bytes as \u00XX) read back unchanged
+            if (++p >= pend)
+                return false;
+            switch (*p++)
+            {
+            case '"':  str += '"'; break;
+            case '\\': str += '\\'; break;
+            case '/':  str += '/'; break;
+            case 'b':  str += '\b'; break;
+            case 'f':  str += '\f'; break;
+            case 'n':  str += '\n'; break;
+            case 'r':  str += '\r'; break;
+            case 't':  str += '\t'; break;
+            case 'x':
+            case 'u':
+            {
+                int nDigits = (p[-1] == 'x') ? 2 : 4;
+                if (pend - p < nDigits)
+                    return false;
+                unsigned int nChar = 0;
+                for (int i = 0; i < nDigits; i++)
+                {
+                    int n = HexDigit(*p++);
+                    if (n < 0)
+                        return false;
+                    nChar = (nChar << 4) | n;
+                }
+                str += (char)nChar;
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+    }
+
+    bool ReadNumber(Value& val)
+    {
+        const char* pstart = p;
+        bool fNegative = false;
+        if (*p == '-' || *p == '+')
+            fNegative = (*p++ == '-');
+
+        // Up to 19 significant digits fit in the mantissa; the rest only move the exponent
+        const char* pdigits = p;
+        uint64_t nMantissa = 0;
+        int nDigits = 0;
+        int nExp10 = 0;
+        bool fTruncated = false;
+        bool fReal = false;
+        for (; p < pend && *p >= '0' && *p <= '9'; p++, nDigits++)
+        {
+            if (nMantissa < 1000000000000000000ULL)
+                nMantissa = nMantissa * 10 + (*p - '0');
+            else
+            {
+                nExp10++;
+                fTruncated = true;
+            }
+        }
+        if (p < pend && *p == '.')
+        {
+            fReal = true;
+            for (p++; p < pend && *p >= '0' && *p <= '9'; p++, nDigits++)
+            {
+                if (nMantissa < 1000000000000000000ULL)
+                {
+                    nMantissa = nMantissa * 10 + (*p - '0');
+                    nExp10--;
+                }
+                else
+                    fTruncated = true;
+            }
+        }
+        if (nDigits == 0)
+            return false;
+        if (p < pend && (*p == 'e' || *p == 'E'))
+        {
+            fReal = true;
+            p++;
+            bool fExpNegative = false;
+            if (p < pend && (*p == '-' || *p == '+'))
+                fExpNegative = (*p++ == '-');
+            if (p >= pend || *p < '0' || *p > '9')
+                return false;
+            int nExp = 0;
+            for (; p < pend && *p >= '0' && *p <= '9'; p++)
+                if (nExp < 100000)
+                    nExp = nExp * 10 + (*p - '0');
+            nExp10 += fExpNegative ? -nExp : nExp;
+        }
+
+        if (!fReal)
+        {
+            // Integers are int64 where they fit and uint64 above that, as in json_spirit
+            uint64_t nValue = 0;
+            for (const char* q = pdigits; q < p; q++)
+            {
+                uint64_t nDigit = *q - '0';
+                if (nValue > (std::numeric_limits<uint64_t>::max() - nDigit) / 10)
+                    return false;
+                nValue = nValue * 10 + nDigit;
+            }
+            if (fNegative)
+            {
+                if (nValue > (uint64_t)std::numeric_limits<int64_t>::max() + 1)
+                    return false;
+                SetValue(val, (int64_t)(0 - nValue));
+            }
+            else if (nValue > (uint64_t)std::numeric_limits<int64_t>::max())
+                SetValue(val, nValue);
+            else
+                SetValue(val, (int64_t)nValue);
+            return true;
+        }
+
+        double d;
+        if (!fTruncated && nMantissa < (1ULL << 53) && nExp10 >= -22 && nExp10 <= 22)
+        {
+            // Both operands are exact, so a single IEEE operation rounds correctly
+            d = (double)nMantissa;
+            if (nExp10 < 0)
+                d /= dPow10[-nExp10];
+            else
+                d *= dPow10[nExp10];
+            if (fNegative)
+                d = -d;
+        }
+        else
+        {
+            // Rare long or extreme values: let the C++ library do it, independent of
+            // the process locale (the GUI sets LC_NUMERIC from the environment)
+            std::istringstream ss(string(pstart, p));
+            ss.imbue(std::locale::classic());
+            ss >> d;
+            if (ss.fail())
+                return false;
+        }
+        SetValue(val, d);
+        return true;
+    }
+};
+
+bool ReadJSON(const string& strJSON, Value& valRet)
+{
+    CJSONReader reader(strJSON.data(), strJSON.data() + strJSON.size());
+    return reader.ReadDocument(valRet);
+}
@@ -0,0 +1,23 @@
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_JSONREADER_H
+#define BITCOIN_JSONREADER_H
+
+#include <string>
+
+#include "json/json_spirit_value.h"
+
+/** Deepest nesting of objects and arrays ReadJSON accepts */
+static const unsigned int MAX_JSON_DEPTH = 512;
+
+/**
+ * Single-pass replacement for json_spirit::read_string on RPC input.
+ * Produces the same Values as json_spirit for well-formed JSON (including its
+ * \xHH and 8-bit \uHHHH string escapes), but rejects trailing garbage and
+ * nesting deeper than MAX_JSON_DEPTH.
+ */
+bool ReadJSON(const std::string& strJSON, json_spirit::Value& valRet);
+
+#endif // BITCOIN_JSONREADER_H
@@ -8,6 +8,7 @@
 
 #include "addrman.h"
 #include "alert.h"
+#include "blockencodings.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -21,13 +22,18 @@
 #include "ui_interface.h"
 #include "util.h"
 #include "spork.h"
+#include "trace.h"
 
+#include <limits>
+#include <new>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 
 using namespace std;
 using namespace boost;
@@ -44,7 +50,7 @@ CCriticalSection cs_main;
 
 CTxMemPool mempool;
 
-map<uint256, CBlockIndex*> mapBlockIndex;
+BlockMap mapBlockIndex;
 CChain chainActive;
 CChain chainMostWork;
 int64_t nTimeBestReceived = 0;
@@ -136,6 +142,65 @@ namespace {
     map<uint256, pair<NodeId, list<uint256>::iterator> > mapBlocksToDownload;
 }
 
+BlockHasher::BlockHasher()
+{
+    k0 = GetRand(std::numeric_limits<uint64_t>::max());
+    k1 = GetRand(std::numeric_limits<uint64_t>::max());
+}
+
+size_t BlockHasher::operator()(const uint256& hash) const
+{
+    return (size_t)SipHashUint256(k0, k1, hash);
+}
+
+namespace {
+    /** Block index entries stay alive until shutdown and are never freed one at a
+     * time, so they are carved out of large chunks instead of being allocated
+     * separately. Entries created together (a whole index load) end up next to
+     * each other in memory.
+     */
+    class CBlockIndexArena
+    {
+    private:
+        static const size_t CHUNK_ENTRIES = 4096;
+        std::vector<CBlockIndex*> vChunks;
+        size_t nUsed; // entries constructed in the last chunk
+
+        void* Allocate()
+        {
+            if (nUsed == CHUNK_ENTRIES)
+            {
+                vChunks.push_back(static_cast<CBlockIndex*>(::operator new(sizeof(CBlockIndex) * CHUNK_ENTRIES)));
+                nUsed = 0;
+            }
+            return vChunks.back() + nUsed++;
+        }
+
+    public:
+        CBlockIndexArena() : nUsed(CHUNK_ENTRIES) {}
+        ~CBlockIndexArena() { Clear(); }
+
+        CBlockIndex* New() { return new (Allocate()) CBlockIndex(); }
+        CBlockIndex* New(CBlockHeader& block) { return new (Allocate()) CBlockIndex(block); }
+
+        /** Destroys every entry; all CBlockIndex pointers handed out become invalid */
+        void Clear()
+        {
+            for (size_t i = 0; i < vChunks.size(); i++)
+            {
+                size_t nEntries = (i + 1 == vChunks.size()) ? nUsed : CHUNK_ENTRIES;
+                for (size_t j = 0; j < nEntries; j++)
+                    vChunks[i][j].~CBlockIndex();
+                ::operator delete(vChunks[i]);
+            }
+            vChunks.clear();
+            nUsed = CHUNK_ENTRIES;
+        }
+    };
+
+    CBlockIndexArena blockIndexArena;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // dispatching functions
@@ -188,6 +253,7 @@ void UnregisterAllWallets() {
 }
 
 void SyncWithWallets(const uint256 &hash, const CTransaction &tx, const CBlock *pblock) {
+    CTraceSpan span("SyncWithWallets");
     g_signals.SyncTransaction(hash, tx, pblock);
 }
 
@@ -223,6 +289,8 @@ struct CNodeState {
     int nBlocksToDownload;
     int64_t nLastBlockReceive;
     int64_t nLastBlockProcess;
+    // Compact blocks from this peer waiting for a blocktxn, all of them in flight.
+    map<uint256, CPartiallyDownloadedBlock> mapPartialBlocks;
 
     CNodeState() {
         nMisbehavior = 0;
@@ -285,6 +353,7 @@ void MarkBlockAsReceived(const uint256 &hash, NodeId nodeFrom = -1) {
         CNodeState *state = State(itInFlight->second.first);
         state->vBlocksInFlight.erase(itInFlight->second.second);
         state->nBlocksInFlight--;
+        state->mapPartialBlocks.erase(hash);
         if (itInFlight->second.first == nodeFrom)
             state->nLastBlockReceive = GetTimeMicros();
         mapBlocksInFlight.erase(itInFlight);
@@ -386,12 +455,13 @@ CBlockLocator CChain::GetLocator(const CBlockIndex *pindex) const {
             break;
         // Exponentially larger steps back, plus the genesis block.
         int nHeight = std::max(pindex->nHeight - nStep, 0);
-        // In case pindex is not in this chain, iterate pindex->pprev to find blocks.
-        while (pindex->nHeight > nHeight && !Contains(pindex))
-            pindex = pindex->pprev;
-        // If pindex is in this chain, use direct height-based access.
-        if (pindex->nHeight > nHeight)
+        if (Contains(pindex)) {
+            // Use O(1) CChain index if possible.
             pindex = (*this)[nHeight];
+        } else {
+            // Otherwise, use O(log n) skiplist.
+            pindex = pindex->GetAncestor(nHeight);
+        }
         if (vHave.size() > 10)
             nStep *= 2;
     }
@@ -402,7 +472,7 @@ CBlockLocator CChain::GetLocator(const CBlockIndex *pindex) const {
 CBlockIndex *CChain::FindFork(const CBlockLocator &locator) const {
     // Find the first block the caller has in the main chain
     BOOST_FOREACH(const uint256& hash, locator.vHave) {
-        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
         if (mi != mapBlockIndex.end())
         {
             CBlockIndex* pindex = (*mi).second;
@@ -744,7 +814,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
     }
 
     // Is the tx in a block that's in the main chain
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -874,6 +944,7 @@ int64_t GetMinFee(const CTransaction& tx, unsigned int nBytes, bool fAllowFree,
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
 {
+    CTraceSpan span("AcceptToMemoryPool");
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
         *pfMissingInputs = false;
@@ -1155,7 +1226,7 @@ int CMerkleTx::GetDepthInMainChainINTERNAL(CBlockIndex* &pindexRet) const
     AssertLockHeld(cs_main);
 
     // Find the block it claims to be in
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -1477,13 +1548,13 @@ static const int64_t nMaxAdjustUp = 3; // 1% adjustment up
 //
 unsigned int ComputeMinWork(unsigned int nBase, int64_t nTime)
 {
-    const CBigNum &bnLimit = Params().ProofOfWorkLimit();
+    const arith_uint256 &bnLimit = Params().ProofOfWorkLimit();
     // Testnet has min-difficulty blocks
     // after nTargetSpacing*2 time between blocks:
     if (TestNet() && nTime > nTargetSpacing*2)
         return bnLimit.GetCompact();
 
-    CBigNum bnResult;
+    arith_uint256 bnResult;
     bnResult.SetCompact(nBase);
     while (nTime > 0 && bnResult < bnLimit)
     {
@@ -1769,11 +1840,13 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
     if (nActualTimespan > nMaxActualTimespan)
         nActualTimespan = nMaxActualTimespan;
 
-    // Retarget
-    CBigNum bnNew;
+    // Retarget; the product stays below 2^256 as targets are capped at the limit
+    arith_uint256 bnNew;
+    arith_uint256 bnOld;
     bnNew.SetCompact(pindexLast->nBits);
-    bnNew *= nActualTimespan;
-    bnNew /= nAveragingTargetTimespan;
+    bnOld = bnNew;
+    bnNew *= arith_uint256(nActualTimespan);
+    bnNew /= arith_uint256(nAveragingTargetTimespan);
 
     if (bnNew > Params().ProofOfWorkLimit())
         bnNew = Params().ProofOfWorkLimit();
@@ -1781,7 +1854,7 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
     /// debug print
     LogPrintf("GetNextWorkRequired RETARGET\n");
     LogPrintf("nTargetTimespan = %d    nActualTimespan = %d\n", nAveragingTargetTimespan, nActualTimespan);
-    LogPrintf("Before: %08x  %s\n", pindexLast->nBits, CBigNum().SetCompact(pindexLast->nBits).getuint256().ToString().c_str());
+    LogPrintf("Before: %08x  %s\n", pindexLast->nBits, bnOld.getuint256().ToString().c_str());
     LogPrintf("After:  %08x  %s\n", bnNew.GetCompact(), bnNew.getuint256().ToString().c_str());
 
     return bnNew.GetCompact();
@@ -1789,11 +1862,13 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits)
 {
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
+    bool fNegative;
+    bool fOverflow;
+    arith_uint256 bnTarget;
+    bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
 
     // Check range
-    if (bnTarget <= 0 || bnTarget > Params().ProofOfWorkLimit())
+    if (fNegative || bnTarget == 0 || fOverflow || bnTarget > Params().ProofOfWorkLimit())
         return error("CheckProofOfWork() : nBits below minimum work");
 
     // Check proof of work matches claimed amount
@@ -2208,6 +2283,7 @@ void ThreadScriptCheck() {
 
 bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck)
 {
+    CTraceSpan span("ConnectBlock");
     AssertLockHeld(cs_main);
     // Check it again in case a previous version let a bad block in
     if (!CheckBlock(block, state, !fJustCheck, !fJustCheck))
@@ -2655,6 +2731,7 @@ void static FindMostWorkChain() {
 
 // Try to activate to the most-work chain (thereby connecting it).
 bool ActivateBestChain(CValidationState &state) {
+    CTraceSpan span("ActivateBestChain");
     LOCK(cs_main);
     CBlockIndex *pindexOldTip = chainActive.Tip();
     bool fComplete = false;
@@ -2710,19 +2787,19 @@ bool AddToBlockIndex(CBlock& block, CValidationState& state, const CDiskBlockPos
         return state.Invalid(error("AddToBlockIndex() : %s already exists", hash.ToString()), 0, "duplicate");
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.New(block);
     {
          LOCK(cs_nBlockSequenceId);
          pindexNew->nSequenceId = nBlockSequenceId++;
     }
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+    BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
-    map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
+    BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
     {
         pindexNew->pprev = (*miPrev).second;
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
+        pindexNew->BuildSkip();
     }
     pindexNew->nTx = block.vtx.size();
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + pindexNew->GetBlockWork().getuint256();
@@ -2858,7 +2935,7 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
 }
 
 
-bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot)
+bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckLocksAndPayments)
 {
     // These are checks that are independent of context
     // that can be verified before saving an orphan block.
@@ -2890,7 +2967,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
 
     // ----------- instantX transaction scanning -----------
 
-    if(IsSporkActive(SPORK_3_INSTANTX_BLOCK_FILTERING)){
+    if(fCheckLocksAndPayments && IsSporkActive(SPORK_3_INSTANTX_BLOCK_FILTERING)){
         BOOST_FOREACH(const CTransaction& tx, block.vtx){
             if (!tx.IsCoinBase()){
                 //only reject blocks when it's based on complete consensus
@@ -2920,7 +2997,9 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         if(block.nTime > START_MASTERNODE_PAYMENTS) MasternodePayments = true;
     }
 
-    if(!IsSporkActive(SPORK_1_MASTERNODE_PAYMENTS_ENFORCEMENT)){
+    if(!fCheckLocksAndPayments){
+        MasternodePayments = false;
+    } else if(!IsSporkActive(SPORK_1_MASTERNODE_PAYMENTS_ENFORCEMENT)){
         MasternodePayments = false;
         if(fDebug) LogPrintf("CheckBlock() : Masternode payment enforcement is off\n");
     }
@@ -3033,7 +3112,7 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CDiskBlockPos* dbp)
     CBlockIndex* pindexPrev = NULL;
     int nHeight = 0;
     if (hash != Params().HashGenesisBlock()) {
-        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+        BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
         if (mi == mapBlockIndex.end())
             return state.DoS(10, error("AcceptBlock() : prev block not found"), 0, "bad-prevblk");
         pindexPrev = (*mi).second;
@@ -3077,7 +3156,7 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CDiskBlockPos* dbp)
                              REJECT_CHECKPOINT, "checkpoint mismatch");
 
         // Don't accept any forks from the main chain prior to last checkpoint
-        CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint(mapBlockIndex);
+        CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint();
         if (pcheckpoint && nHeight < pcheckpoint->nHeight)
             return state.DoS(100, error("AcceptBlock() : forked chain older than last checkpoint (height %d)", nHeight));
 
@@ -3172,6 +3251,56 @@ int64_t CBlockIndex::GetMedianTime() const
     return pindex->GetMedianTimePast();
 }
 
+/** Turn the lowest '1' bit in the binary representation of a number into a '0'. */
+int static inline InvertLowestOne(int n) { return n & (n - 1); }
+
+/** Compute what height to jump back to with the CBlockIndex::pskip pointer. */
+int static inline GetSkipHeight(int height) {
+    if (height < 2)
+        return 0;
+
+    // Determine which height to jump back to. Any number strictly lower than height is acceptable,
+    // but the following expression seems to perform well in simulations (max 110 steps to go back
+    // up to 2**18 blocks).
+    return (height & 1) ? InvertLowestOne(InvertLowestOne(height - 1)) + 1 : InvertLowestOne(height);
+}
+
+CBlockIndex* CBlockIndex::GetAncestor(int height)
+{
+    if (height > nHeight || height < 0)
+        return NULL;
+
+    CBlockIndex* pindexWalk = this;
+    int heightWalk = nHeight;
+    while (heightWalk > height) {
+        int heightSkip = GetSkipHeight(heightWalk);
+        int heightSkipPrev = GetSkipHeight(heightWalk - 1);
+        if (pindexWalk->pskip != NULL &&
+            (heightSkip == height ||
+             (heightSkip > height && !(heightSkipPrev < heightSkip - 2 &&
+                                       heightSkipPrev >= height)))) {
+            // Only follow pskip if pprev->pskip isn't better than pskip->pprev.
+            pindexWalk = pindexWalk->pskip;
+            heightWalk = heightSkip;
+        } else {
+            pindexWalk = pindexWalk->pprev;
+            heightWalk--;
+        }
+    }
+    return pindexWalk;
+}
+
+const CBlockIndex* CBlockIndex::GetAncestor(int height) const
+{
+    return const_cast<CBlockIndex*>(this)->GetAncestor(height);
+}
+
+void CBlockIndex::BuildSkip()
+{
+    if (pprev)
+        pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
+}
+
 void PushGetBlocks(CNode* pnode, CBlockIndex* pindexBegin, uint256 hashEnd)
 {
     AssertLockHeld(cs_main);
@@ -3209,7 +3338,7 @@ bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBl
     if (!CheckBlock(*pblock, state))
         return error("ProcessBlock() : CheckBlock FAILED");
 
-    CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint(mapBlockIndex);
+    CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint();
     if (pcheckpoint && pblock->hashPrevBlock != (chainActive.Tip() ? chainActive.Tip()->GetBlockHash() : uint256(0)))
     {
         // Extra checks to prevent "fill up memory by spamming with bogus blocks"
@@ -3219,11 +3348,15 @@ bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBl
             return state.DoS(100, error("ProcessBlock() : block with timestamp before last checkpoint"),
                              REJECT_CHECKPOINT, "time-too-old");
         }
-        CBigNum bnNewBlock;
-        bnNewBlock.SetCompact(pblock->nBits);
-        CBigNum bnRequired;
+        // A negative target compares below any requirement and an oversized
+        // one above it, as they did as CBigNums
+        bool fNegative;
+        bool fOverflow;
+        arith_uint256 bnNewBlock;
+        bnNewBlock.SetCompact(pblock->nBits, &fNegative, &fOverflow);
+        arith_uint256 bnRequired;
         bnRequired.SetCompact(ComputeMinWork(pcheckpoint->nBits, deltaTime));
-        if (bnNewBlock > bnRequired)
+        if (!fNegative && (fOverflow || bnNewBlock > bnRequired))
         {
             return state.DoS(100, error("ProcessBlock() : block with too little proof-of-work"),
                              REJECT_INVALID, "bad-diffbits");
@@ -3514,14 +3647,12 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return NULL;
 
     // Return existing
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    BlockMap::iterator mi = mapBlockIndex.find(hash);
     if (mi != mapBlockIndex.end())
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.New();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
@@ -3549,6 +3680,8 @@ bool static LoadBlockIndexDB()
         CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + pindex->GetBlockWork().getuint256();
         pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
+        if (pindex->pprev)
+            pindex->BuildSkip();
         if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS && !(pindex->nStatus & BLOCK_FAILED_MASK))
             setBlockIndexValid.insert(pindex);
         if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
@@ -3571,7 +3704,7 @@ bool static LoadBlockIndexDB()
     LogPrintf("LoadBlockIndexDB(): transaction index %s\n", fTxIndex ? "enabled" : "disabled");
 
     // Load pointer to end of best chain
-    std::map<uint256, CBlockIndex*>::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
+    BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
         return true;
     chainActive.SetTip(it->second);
@@ -3583,6 +3716,215 @@ bool static LoadBlockIndexDB()
     return true;
 }
 
+// Check levels 0 to 2 of a block in the best chain. These depend on nothing
+// but the block, its index entry and its undo data.
+bool static VerifyBlockLevels(CBlock& block, CBlockIndex* pindex, int nCheckLevel, std::string& strError)
+{
+    // check level 0: read from disk
+    if (!ReadBlockFromDisk(block, pindex)) {
+        strError = strprintf("ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+        return false;
+    }
+    // check level 1: verify block validity. The instantX lock and masternode
+    // payment checks only concern a block on top of the current tip.
+    CValidationState state;
+    if (nCheckLevel >= 1 && !CheckBlock(block, state, true, true, false)) {
+        strError = strprintf("found bad block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+        return false;
+    }
+    // check level 2: verify undo validity
+    if (nCheckLevel >= 2) {
+        CBlockUndo undo;
+        CDiskBlockPos pos = pindex->GetUndoPos();
+        if (!pos.IsNull()) {
+            if (!undo.ReadFromDisk(pos, pindex->pprev->GetBlockHash())) {
+                strError = strprintf("found bad undo data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Runs check levels 0 to 2 of VerifyDB on worker threads. Workers claim
+ * blocks from the tip down; the level 3 pass waits for each block's result
+ * in the same order before disconnecting it, and takes over the copy a
+ * worker already read when it is close enough to still be kept.
+ */
+class CVerifyDBQueue
+{
+private:
+    // Blocks this far ahead of the level 3 pass are kept in memory for it
+    static const size_t KEEP_AHEAD = 64;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    boost::thread_group threadGroup;
+
+    const std::vector<CBlockIndex*>& vIndex; // tip first
+    int nCheckLevel;
+    size_t nNext;    // next position to claim
+    size_t nChecked; // positions with a result
+    std::vector<char> vResult; // 0 pending, 1 passed, -1 failed
+    size_t nFailure; // lowest failing position, vIndex.size() if none
+    std::string strFailure;
+    size_t nKeepBefore;
+    std::map<size_t, boost::shared_ptr<CBlock> > mapKept;
+    bool fShutdown;
+
+    // Progress reporting, only touched by the thread running VerifyDB
+    int64_t nStart;
+    int64_t nLastLog;
+    int nLastPercent;
+
+    void Thread()
+    {
+        while (true)
+        {
+            size_t nPos;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (fShutdown || nNext >= nFailure)
+                    return;
+                nPos = nNext++;
+            }
+
+            boost::shared_ptr<CBlock> pblock(new CBlock());
+            std::string strError;
+            bool fOk = VerifyBlockLevels(*pblock, vIndex[nPos], nCheckLevel, strError);
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            vResult[nPos] = fOk ? 1 : -1;
+            nChecked++;
+            if (!fOk && nPos < nFailure) {
+                nFailure = nPos;
+                strFailure = strError;
+            }
+            if (fOk && nPos < nKeepBefore)
+                mapKept[nPos] = pblock;
+            if (ShutdownRequested())
+                fShutdown = true;
+            cond.notify_all();
+        }
+    }
+
+    // Caller holds mutex
+    bool Finished()
+    {
+        return fShutdown || (nChecked == nNext && nNext >= std::min(vIndex.size(), nFailure));
+    }
+
+public:
+    CVerifyDBQueue(const std::vector<CBlockIndex*>& vIndexIn, int nCheckLevelIn) :
+        vIndex(vIndexIn), nCheckLevel(nCheckLevelIn), nNext(0), nChecked(0),
+        vResult(vIndexIn.size(), 0), nFailure(vIndexIn.size()), fShutdown(false)
+    {
+        // Keep blocks for the level 3 pass only if there is one
+        nKeepBefore = (nCheckLevel >= 3) ? KEEP_AHEAD : 0;
+        nStart = nLastLog = GetTimeMillis();
+        nLastPercent = -1;
+    }
+
+    ~CVerifyDBQueue()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fShutdown = true;
+        }
+        threadGroup.join_all();
+    }
+
+    void Start(int nThreads)
+    {
+        for (int i = 0; i < nThreads; i++) {
+            try {
+                threadGroup.create_thread(boost::bind(&CVerifyDBQueue::Thread, this));
+            } catch (boost::thread_resource_error& e) {
+                LogPrintf("VerifyDB() : could only start %d of %d threads: %s\n", i, nThreads, e.what());
+                break;
+            }
+        }
+        if (threadGroup.size() == 0)
+            Thread();
+        LogPrintf("Verifying blocks on %d threads\n", std::max((int)threadGroup.size(), 1));
+    }
+
+    /**
+     * Wait for levels 0 to 2 of the block at nPos. Returns false if it or a
+     * block closer to the tip failed, or on shutdown. pblock is the copy read
+     * by the worker, or empty if it was not kept.
+     */
+    bool Wait(size_t nPos, boost::shared_ptr<CBlock>& pblock)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nKeepBefore = std::max(nKeepBefore, nPos + KEEP_AHEAD);
+        while (vResult[nPos] == 0 && !fShutdown && nPos < nFailure)
+            cond.wait(lock);
+        if (vResult[nPos] != 1 || fShutdown)
+            return false;
+        std::map<size_t, boost::shared_ptr<CBlock> >::iterator it = mapKept.find(nPos);
+        if (it != mapKept.end()) {
+            pblock = it->second;
+            mapKept.erase(it);
+        }
+        return true;
+    }
+
+    /** The level 3 pass is over; stop keeping blocks for it */
+    void StopKeeping()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nKeepBefore = 0;
+        mapKept.clear();
+    }
+
+    /** Log progress and an estimate of the time left, at most every ten seconds */
+    void ReportProgress()
+    {
+        size_t nDone;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nDone = nChecked;
+        }
+        int nPercent = vIndex.empty() ? 100 : (int)(nDone * 100 / vIndex.size());
+        if (nPercent != nLastPercent) {
+            uiInterface.InitMessage(strprintf("%s %d%%", _("Verifying blocks..."), nPercent));
+            nLastPercent = nPercent;
+        }
+        int64_t nNow = GetTimeMillis();
+        if (nNow - nLastLog < 10000 || nDone == 0)
+            return;
+        int64_t nLeft = (nNow - nStart) * (int64_t)(vIndex.size() - nDone) / (int64_t)nDone;
+        LogPrintf("Verifying blocks: %u of %u checked, about %ds left\n", nDone, vIndex.size(), nLeft / 1000);
+        nLastLog = nNow;
+    }
+
+    /**
+     * Wait for every claimed block. Returns false with the error of the block
+     * closest to the tip if any failed. Sets fInterrupted on shutdown.
+     */
+    bool WaitAll(std::string& strError, bool& fInterrupted)
+    {
+        while (true)
+        {
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (Finished())
+                    break;
+                cond.timed_wait(lock, boost::posix_time::seconds(1));
+            }
+            boost::this_thread::interruption_point();
+            ReportProgress();
+        }
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fInterrupted = fShutdown;
+        strError = strFailure;
+        LogPrintf("Checked %u blocks in %dms\n", nChecked, GetTimeMillis() - nStart);
+        return nFailure == vIndex.size();
+    }
+};
+
 bool VerifyDB(int nCheckLevel, int nCheckDepth)
 {
     LOCK(cs_main);
@@ -3596,44 +3938,62 @@ bool VerifyDB(int nCheckLevel, int nCheckDepth)
         nCheckDepth = chainActive.Height();
     nCheckLevel = std::max(0, std::min(4, nCheckLevel));
     LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
+
+    std::vector<CBlockIndex*> vIndex;
+    for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev)
+    {
+        if (pindex->nHeight < chainActive.Height()-nCheckDepth)
+            break;
+        vIndex.push_back(pindex);
+    }
+
+    // Levels 0 to 2 run on the workers while this thread does level 3
+    CVerifyDBQueue queue(vIndex, nCheckLevel);
+    int nThreads = GetArg("-checkthreads", 0);
+    if (nThreads <= 0)
+        nThreads = std::max(nScriptCheckThreads, 1);
+    queue.Start(std::min(nThreads, (int)vIndex.size()));
+
     CCoinsViewCache coins(*pcoinsTip, true);
     CBlockIndex* pindexState = chainActive.Tip();
     CBlockIndex* pindexFailure = NULL;
     int nGoodTransactions = 0;
     CValidationState state;
-    for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev)
+    // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
+    for (size_t nPos = 0; nCheckLevel >= 3 && nPos < vIndex.size(); nPos++)
     {
         boost::this_thread::interruption_point();
-        if (pindex->nHeight < chainActive.Height()-nCheckDepth)
+        CBlockIndex* pindex = vIndex[nPos];
+        if ((coins.GetCacheSize() + pcoinsTip->GetCacheSize()) > 2*nCoinCacheSize + 32000)
             break;
-        CBlock block;
-        // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex))
-            return error("VerifyDB() : *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state))
-            return error("VerifyDB() : *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
-            CDiskBlockPos pos = pindex->GetUndoPos();
-            if (!pos.IsNull()) {
-                if (!undo.ReadFromDisk(pos, pindex->pprev->GetBlockHash()))
-                    return error("VerifyDB() : *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-            }
-        }
-        // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= 2*nCoinCacheSize + 32000) {
-            bool fClean = true;
-            if (!DisconnectBlock(block, state, pindex, coins, &fClean))
-                return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            pindexState = pindex->pprev;
-            if (!fClean) {
-                nGoodTransactions = 0;
-                pindexFailure = pindex;
-            } else
-                nGoodTransactions += block.vtx.size();
+        boost::shared_ptr<CBlock> pblock;
+        if (!queue.Wait(nPos, pblock))
+            break;
+        if (!pblock) {
+            pblock.reset(new CBlock());
+            if (!ReadBlockFromDisk(*pblock, pindex))
+                return error("VerifyDB() : *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
         }
+        bool fClean = true;
+        if (!DisconnectBlock(*pblock, state, pindex, coins, &fClean))
+            return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+        pindexState = pindex->pprev;
+        if (!fClean) {
+            nGoodTransactions = 0;
+            pindexFailure = pindex;
+        } else
+            nGoodTransactions += pblock->vtx.size();
+        queue.ReportProgress();
+    }
+    queue.StopKeeping();
+
+    std::string strError;
+    bool fInterrupted = false;
+    if (!queue.WaitAll(strError, fInterrupted))
+        return error("VerifyDB() : *** %s", strError);
+    if (fInterrupted) {
+        LogPrintf("VerifyDB() : interrupted by shutdown\n");
+        return true;
     }
     if (pindexFailure)
         return error("VerifyDB() : *** coin database inconsistencies found (last %i blocks, %i good transactions before that)\n", chainActive.Height() - pindexFailure->nHeight + 1, nGoodTransactions);
@@ -3714,7 +4074,7 @@ void PrintBlockTree()
     AssertLockHeld(cs_main);
     // pre-compute tree structure
     map<CBlockIndex*, vector<CBlockIndex*> > mapNext;
-    for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+    for (BlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
     {
         CBlockIndex* pindex = (*mi).second;
         mapNext[pindex->pprev].push_back(pindex);
@@ -3949,11 +4309,17 @@ bool static AlreadyHave(const CInv& inv)
     case MSG_TXLOCK_VOTE:
         return mapTxLockVote.count(inv.hash);
     case MSG_SPORK:
-        return mapSporks.count(inv.hash);
+    {
+        CSporkMessage spork;
+        return GetSporkByHash(inv.hash, spork);
+    }
     case MSG_MASTERNODE_WINNER:
         return mapSeenMasternodeVotes.count(inv.hash);
     case MSG_MASTERNODE_SCANNING_ERROR:
-        return mapMasternodeScanningErrors.count(inv.hash);
+        {
+            LOCK(cs_mapMasternodeScanningErrors);
+            return mapMasternodeScanningErrors.count(inv.hash);
+        }
     }
     // Don't know what it is, just say we already got one
     return true;
@@ -3978,16 +4344,16 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 bool send = false;
-                map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
+                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end())
                 {
                     // If the requested block is at a height below our last
                     // checkpoint, only serve it if it's in the checkpointed chain
                     int nHeight = mi->second->nHeight;
-                    CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint(mapBlockIndex);
+                    CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint();
                     if (pcheckpoint && nHeight < pcheckpoint->nHeight) {
                         if (!chainActive.Contains(mi->second))
                         {
@@ -4006,6 +4372,14 @@ void static ProcessGetData(CNode* pfrom)
                     ReadBlockFromDisk(block, (*mi).second);
                     if (inv.type == MSG_BLOCK)
                         pfrom->PushMessage("block", block);
+                    else if (inv.type == MSG_CMPCT_BLOCK)
+                    {
+                        // the peer's mempool won't have the transactions of an old block
+                        if ((*mi).second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH)
+                            pfrom->PushMessage("cmpctblock", CBlockHeaderAndShortTxIDs(block));
+                        else
+                            pfrom->PushMessage("block", block);
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
                         LOCK(pfrom->cs_filter);
@@ -4100,10 +4474,11 @@ void static ProcessGetData(CNode* pfrom)
                     }
                 }
                 if (!pushed && inv.type == MSG_SPORK) {
-                    if(mapSporks.count(inv.hash)){
+                    CSporkMessage spork;
+                    if(GetSporkByHash(inv.hash, spork)){
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mapSporks[inv.hash];
+                        ss << spork;
                         pfrom->PushMessage("spork", ss);
                         pushed = true;
                     }
@@ -4118,6 +4493,7 @@ void static ProcessGetData(CNode* pfrom)
                     }
                 }
                 if (!pushed && inv.type == MSG_MASTERNODE_SCANNING_ERROR) {
+                    LOCK(cs_mapMasternodeScanningErrors);
                     if(mapMasternodeScanningErrors.count(inv.hash)){
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
@@ -4156,6 +4532,7 @@ void static ProcessGetData(CNode* pfrom)
 
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 {
+    CTraceSpan span("ProcessMessage", strCommand);
     RandAddSeedPerfmon();
     LogPrint("net", "received: %s (%u bytes)\n", SanitizeString(strCommand), vRecv.size());
     if (mapArgs.count("-dropmessagestest") && GetRand(atoi(mapArgs["-dropmessagestest"])) == 0)
@@ -4287,6 +4664,16 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
     else if (strCommand == "verack")
     {
         pfrom->SetRecvVersion(min(pfrom->nVersion, PROTOCOL_VERSION));
+
+        // ask to be sent new blocks as compact blocks
+        if (pfrom->nVersion >= COMPACT_BLOCKS_VERSION && GetBoolArg("-compactblocks", true))
+            pfrom->PushMessage("sendcmpct");
+    }
+
+
+    else if (strCommand == "sendcmpct")
+    {
+        pfrom->fCompactBlocks = true;
     }
 
 
@@ -4470,7 +4857,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         if (locator.IsNull())
         {
             // If locator is null, return the hashStop block
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashStop);
+            BlockMap::iterator mi = mapBlockIndex.find(hashStop);
             if (mi == mapBlockIndex.end())
                 return true;
             pindex = (*mi).second;
@@ -4668,6 +5055,141 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
     }
 
 
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex)
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        uint256 hash = cmpctblock.header.GetHash();
+        LogPrint("net", "received compact block %s\n", hash.ToString());
+
+        CInv inv(MSG_BLOCK, hash);
+        pfrom->AddInventoryKnown(inv);
+
+        LOCK(cs_main);
+        // Compact blocks are only sent in answer to getdata. Anything we
+        // didn't ask this peer for is dropped before the mempool is scanned.
+        map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+        if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != pfrom->GetId())
+        {
+            LogPrint("net", "ignoring unrequested compact block %s\n", hash.ToString());
+            return true;
+        }
+
+        CPartiallyDownloadedBlock partialBlock;
+        ReadStatus status = partialBlock.InitData(cmpctblock, mempool);
+        if (status == READ_STATUS_INVALID)
+        {
+            Misbehaving(pfrom->GetId(), 100);
+            return error("message cmpctblock: invalid compact block %s", hash.ToString());
+        }
+
+        vector<unsigned int> vIndexes;
+        if (status == READ_STATUS_OK)
+            partialBlock.GetMissing(vIndexes);
+
+        CBlock block;
+        if (status == READ_STATUS_OK && vIndexes.empty())
+            status = partialBlock.FillBlock(block, vector<CTransaction>());
+
+        if (status != READ_STATUS_OK)
+        {
+            // the block stays in flight, now as a full block
+            LogPrint("net", "compact block %s could not be rebuilt, requesting it in full\n", hash.ToString());
+            vector<CInv> vGetData(1, CInv(MSG_BLOCK, hash));
+            pfrom->PushMessage("getdata", vGetData);
+        }
+        else if (!vIndexes.empty())
+        {
+            State(pfrom->GetId())->mapPartialBlocks[hash] = partialBlock;
+
+            CBlockTransactionsRequest req;
+            req.blockhash = hash;
+            req.vIndexes = vIndexes;
+            pfrom->PushMessage("getblocktxn", req);
+        }
+        else
+        {
+            mapBlockSource[hash] = pfrom->GetId();
+            MarkBlockAsReceived(hash, pfrom->GetId());
+
+            CValidationState state;
+            ProcessBlock(state, pfrom, &block);
+        }
+    }
+
+
+    else if (strCommand == "getblocktxn")
+    {
+        CBlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA))
+        {
+            LogPrint("net", "%s asked for transactions of unknown block %s\n", pfrom->addr.ToString(), req.blockhash.ToString());
+            return true;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, mi->second))
+            return error("message getblocktxn: can't read block %s", req.blockhash.ToString());
+
+        // a repeated index would let a small request ask for the block many times over
+        if (!req.CheckIndexes(block.vtx.size()))
+        {
+            Misbehaving(pfrom->GetId(), 100);
+            return error("message getblocktxn: bad indexes for block %s", req.blockhash.ToString());
+        }
+
+        CBlockTransactions resp;
+        resp.blockhash = req.blockhash;
+        resp.vtx.reserve(req.vIndexes.size());
+        BOOST_FOREACH(unsigned int nIndex, req.vIndexes)
+            resp.vtx.push_back(block.vtx[nIndex]);
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex)
+    {
+        CBlockTransactions resp;
+        vRecv >> resp;
+
+        LOCK(cs_main);
+        CNodeState *nodestate = State(pfrom->GetId());
+        map<uint256, CPartiallyDownloadedBlock>::iterator it = nodestate->mapPartialBlocks.find(resp.blockhash);
+        if (it == nodestate->mapPartialBlocks.end())
+        {
+            LogPrint("net", "%s sent transactions for block %s we didn't ask for\n", pfrom->addr.ToString(), resp.blockhash.ToString());
+            return true;
+        }
+
+        CBlock block;
+        ReadStatus status = it->second.FillBlock(block, resp.vtx);
+        nodestate->mapPartialBlocks.erase(it);
+        if (status == READ_STATUS_INVALID)
+        {
+            Misbehaving(pfrom->GetId(), 100);
+            return error("message blocktxn: wrong transactions for block %s", resp.blockhash.ToString());
+        }
+        if (status == READ_STATUS_FAILED)
+        {
+            LogPrint("net", "compact block %s could not be rebuilt, requesting it in full\n", resp.blockhash.ToString());
+            vector<CInv> vGetData(1, CInv(MSG_BLOCK, resp.blockhash));
+            pfrom->PushMessage("getdata", vGetData);
+            return true;
+        }
+
+        mapBlockSource[resp.blockhash] = pfrom->GetId();
+        MarkBlockAsReceived(resp.blockhash, pfrom->GetId());
+
+        CValidationState state;
+        ProcessBlock(state, pfrom, &block);
+    }
+
+
     else if (strCommand == "getaddr")
     {
         pfrom->vAddrToSend.clear();
@@ -4976,6 +5498,7 @@ bool ProcessMessages(CNode* pfrom)
 
         // Process message
         bool fRet = false;
+        int64_t nProcessStart = GetTimeMicros();
         try
         {
             fRet = ProcessMessage(pfrom, strCommand, vRecv);
@@ -5007,6 +5530,7 @@ bool ProcessMessages(CNode* pfrom)
         } catch (...) {
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
+        pfrom->RecordMessageRecv(strCommand, CMessageHeader::HEADER_SIZE + nMessageSize, GetTimeMicros() - nProcessStart);
 
         if (!fRet)
             LogPrintf("ProcessMessage(%s, %u bytes) FAILED\n", SanitizeString(strCommand), nMessageSize);
@@ -5207,9 +5731,13 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
+        // Once synced, new blocks are mostly made of transactions we already
+        // have: ask peers that support it to send them as compact blocks.
+        bool fCompact = pto->fCompactBlocks && GetBoolArg("-compactblocks", true) && !IsInitialBlockDownload();
+        int nBlockType = fCompact ? MSG_CMPCT_BLOCK : MSG_BLOCK;
         while (!pto->fDisconnect && state.nBlocksToDownload && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
             uint256 hash = state.vBlocksToDownload.front();
-            vGetData.push_back(CInv(MSG_BLOCK, hash));
+            vGetData.push_back(CInv(nBlockType, hash));
             MarkBlockAsInFlight(pto->GetId(), hash);
             LogPrint("net", "Requesting block %s from %s\n", hash.ToString().c_str(), state.name.c_str());
             if (vGetData.size() >= 1000)
@@ -5256,10 +5784,8 @@ public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        std::map<uint256, CBlockIndex*>::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
 
         // orphan blocks
         std::map<uint256, COrphanBlock*>::iterator it2 = mapOrphanBlocks.begin();
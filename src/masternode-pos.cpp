@@ -12,13 +12,16 @@
 #include "activemasternode.h"
 #include "masternodeman.h"
 #include "spork.h"
+#include "netbase.h"
 #include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
 #include "masternodeman.h"
 
 using namespace std;
 using namespace boost;
 
 std::map<uint256, CMasternodeScanningError> mapMasternodeScanningErrors;
+CCriticalSection cs_mapMasternodeScanningErrors;
 CMasternodeScanning mnscan;
 
 /* 
@@ -35,8 +38,9 @@ CMasternodeScanning mnscan;
     masternode. Using the deterministic ranking algorithm up to 1% of the masternode 
     network is checked each block. 
 
-    A port is opened from Masternode A to Masternode B, if successful then nothing happens. 
-    If there is an error, a CMasternodeScanningError object is propagated with an error code.
+    A port is opened from Masternode A to Masternode B by ThreadMasternodeScanning, away from
+    block processing, so an unreachable node doesn't hold up validation for the connect timeout.
+    Every check ends in a CMasternodeScanningError object, propagated with a success or an error code.
     Errors are applied to the Masternodes and a score is incremented within the masternode object,
     after a threshold is met, the masternode goes into an error state. Each cycle the score is 
     decreased, so if the masternode comes back online it will return to the list. 
@@ -66,10 +70,13 @@ void ProcessMessageMasternodePOS(CNode* pfrom, std::string& strCommand, CDataStr
         CInv inv(MSG_MASTERNODE_SCANNING_ERROR, mnse.GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        if(mapMasternodeScanningErrors.count(mnse.GetHash())){
-            return;
+        {
+            LOCK(cs_mapMasternodeScanningErrors);
+            if(mapMasternodeScanningErrors.count(mnse.GetHash())){
+                return;
+            }
+            mapMasternodeScanningErrors.insert(make_pair(mnse.GetHash(), mnse));
         }
-        mapMasternodeScanningErrors.insert(make_pair(mnse.GetHash(), mnse));
 
         if(!mnse.IsValid())
         {
@@ -128,6 +135,7 @@ void CMasternodeScanning::CleanMasternodeScanningErrors()
 {
     if(chainActive.Tip() == NULL) return;
 
+    LOCK(cs_mapMasternodeScanningErrors);
     std::map<uint256, CMasternodeScanningError>::iterator it = mapMasternodeScanningErrors.begin();
 
     while(it != mapMasternodeScanningErrors.end()) {
@@ -163,20 +171,214 @@ void CMasternodeScanning::DoMasternodePOSChecks()
     if(pmn == NULL) return;
 
     // -- first check : Port is open
+    QueueProbe(CMasternodeProbe(activeMasternode.vin, pmn->vin, pmn->addr, nBlockHeight));
+}
 
-    if(!ConnectNode((CAddress)pmn->addr, NULL, true)){
-        // we couldn't connect to the node, let's send a scanning error
-        CMasternodeScanningError mnse(activeMasternode.vin, pmn->vin, SCANNING_ERROR_NO_RESPONSE, nBlockHeight);
-        mnse.Sign();
-        mapMasternodeScanningErrors.insert(make_pair(mnse.GetHash(), mnse));
-        mnse.Relay();
+void CMasternodeScanning::QueueProbe(const CMasternodeProbe& probe)
+{
+    LOCK(cs);
+    if(vPendingProbes.size() >= MASTERNODE_SCANNING_MAX_QUEUED) vPendingProbes.pop_front();
+    vPendingProbes.push_back(probe);
+}
+
+void CMasternodeScanning::TakeProbes(std::vector<CMasternodeProbe>& vProbes, unsigned int nMax)
+{
+    LOCK(cs);
+    while(!vPendingProbes.empty() && vProbes.size() < nMax) {
+        vProbes.push_back(vPendingProbes.front());
+        vPendingProbes.pop_front();
+    }
+}
+
+enum ProbeState
+{
+    PROBE_PENDING,
+    PROBE_OPEN,
+    PROBE_CLOSED,
+    PROBE_FAILED // a local problem, says nothing about Masternode B
+};
+
+// Starts a non-blocking connect to the masternode; unless that is still
+// in progress, the check is over and its state says how it went
+static ProbeState StartProbe(CMasternodeProbe& probe)
+{
+    probe.nStart = GetTimeMillis();
+
+    // already connected to it, so the port is open
+    if(FindNode(probe.addr)) return PROBE_OPEN;
+
+    proxyType proxy;
+    if(GetProxy(probe.addr.GetNetwork(), proxy)) {
+        // there is no non-blocking connect through a proxy, connect from this thread instead
+        SOCKET hSocket;
+        if(!ConnectSocket(probe.addr, hSocket, MASTERNODE_SCANNING_PROBE_TIMEOUT)) return PROBE_CLOSED;
+        closesocket(hSocket);
+        return PROBE_OPEN;
+    }
+
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    if(!probe.addr.GetSockAddr((struct sockaddr*)&sockaddr, &len)) return PROBE_FAILED;
+
+    SOCKET hSocket = socket(((struct sockaddr*)&sockaddr)->sa_family, SOCK_STREAM, IPPROTO_TCP);
+    if(hSocket == INVALID_SOCKET) return PROBE_FAILED;
+
+#ifdef WIN32
+    u_long fNonblock = 1;
+    if(ioctlsocket(hSocket, FIONBIO, &fNonblock) == SOCKET_ERROR)
+#else
+    int fFlags = fcntl(hSocket, F_GETFL, 0);
+    if(fcntl(hSocket, F_SETFL, fFlags | O_NONBLOCK) == -1)
+#endif
+    {
+        closesocket(hSocket);
+        return PROBE_FAILED;
+    }
+
+    if(connect(hSocket, (struct sockaddr*)&sockaddr, len) != SOCKET_ERROR) {
+        closesocket(hSocket);
+        return PROBE_OPEN;
+    }
+
+    // WSAEINVAL is here because some legacy version of winsock uses it
+    int nErr = WSAGetLastError();
+    if(nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK || nErr == WSAEINVAL) {
+        probe.hSocket = hSocket;
+        return PROBE_PENDING;
     }
 
-    // success
-    CMasternodeScanningError mnse(activeMasternode.vin, pmn->vin, SCANNING_SUCCESS, nBlockHeight);
-    mnse.Sign();
-    mapMasternodeScanningErrors.insert(make_pair(mnse.GetHash(), mnse));
-    mnse.Relay();
+    closesocket(hSocket);
+    return PROBE_CLOSED;
+}
+
+// Outcome of a connect that select() reported as done
+static ProbeState FinishProbe(const CMasternodeProbe& probe)
+{
+    int nRet = 0;
+    socklen_t nRetSize = sizeof(nRet);
+#ifdef WIN32
+    if(getsockopt(probe.hSocket, SOL_SOCKET, SO_ERROR, (char*)(&nRet), &nRetSize) == SOCKET_ERROR)
+#else
+    if(getsockopt(probe.hSocket, SOL_SOCKET, SO_ERROR, &nRet, &nRetSize) == SOCKET_ERROR)
+#endif
+        return PROBE_FAILED;
+
+    return nRet == 0 ? PROBE_OPEN : PROBE_CLOSED;
+}
+
+static void AddProbeResult(const CMasternodeProbe& probe, ProbeState state, std::vector<CMasternodeScanningError>& vResults)
+{
+    if(state == PROBE_FAILED) {
+        LogPrintf("ThreadMasternodeScanning - Couldn't check %s\n", probe.addr.ToString().c_str());
+        return;
+    }
+
+    CTxIn vinMasternodeA = probe.vinMasternodeA;
+    CTxIn vinMasternodeB = probe.vinMasternodeB;
+    int nErrorType = (state == PROBE_OPEN) ? SCANNING_SUCCESS : SCANNING_ERROR_NO_RESPONSE;
+
+    if(fDebug) LogPrintf("ThreadMasternodeScanning - nHeight %d Masternode %s result %d\n", probe.nBlockHeight, probe.addr.ToString().c_str(), nErrorType);
+    vResults.push_back(CMasternodeScanningError(vinMasternodeA, vinMasternodeB, nErrorType, probe.nBlockHeight));
+}
+
+// Signs the results and announces all of them to each peer in one inv
+static void RelayScanningResults(std::vector<CMasternodeScanningError>& vResults)
+{
+    vector<CInv> vInv;
+    BOOST_FOREACH(CMasternodeScanningError& mnse, vResults) {
+        if(!mnse.Sign()) continue;
+        {
+            LOCK(cs_mapMasternodeScanningErrors);
+            mapMasternodeScanningErrors.insert(make_pair(mnse.GetHash(), mnse));
+        }
+        vInv.push_back(CInv(MSG_MASTERNODE_SCANNING_ERROR, mnse.GetHash()));
+    }
+    vResults.clear();
+
+    if(vInv.empty()) return;
+
+    LOCK(cs_vNodes);
+    BOOST_FOREACH(CNode* pnode, vNodes){
+        pnode->PushMessage("inv", vInv);
+    }
+}
+
+void ThreadMasternodeScanning()
+{
+    if(fLiteMode) return; //disable all darksend/masternode related functionality
+
+    RenameThread("testinterzone-mnscan");
+
+    std::vector<CMasternodeProbe> vInFlight;
+    std::vector<CMasternodeScanningError> vResults;
+
+    try {
+        while(true)
+        {
+            // start queued checks up to the limit of checks running at once
+            std::vector<CMasternodeProbe> vStarting;
+            mnscan.TakeProbes(vStarting, MASTERNODE_SCANNING_MAX_PROBES - vInFlight.size());
+            BOOST_FOREACH(CMasternodeProbe& probe, vStarting) {
+                ProbeState state = StartProbe(probe);
+                if(state == PROBE_PENDING)
+                    vInFlight.push_back(probe);
+                else
+                    AddProbeResult(probe, state, vResults);
+            }
+
+            if(vInFlight.empty()) {
+                // everything started so far is done, relay the results together
+                RelayScanningResults(vResults);
+                MilliSleep(250);
+                continue;
+            }
+
+            struct timeval timeout;
+            timeout.tv_sec = 0;
+            timeout.tv_usec = 250 * 1000;
+
+            fd_set fdsetSend;
+            fd_set fdsetError;
+            FD_ZERO(&fdsetSend);
+            FD_ZERO(&fdsetError);
+            SOCKET hSocketMax = 0;
+            BOOST_FOREACH(const CMasternodeProbe& probe, vInFlight) {
+                FD_SET(probe.hSocket, &fdsetSend);
+                FD_SET(probe.hSocket, &fdsetError);
+                hSocketMax = max(hSocketMax, probe.hSocket);
+            }
+
+            if(select(hSocketMax + 1, NULL, &fdsetSend, &fdsetError, &timeout) == SOCKET_ERROR) {
+                LogPrintf("ThreadMasternodeScanning - select() failed: %s\n", NetworkErrorString(WSAGetLastError()));
+                FD_ZERO(&fdsetSend);
+                FD_ZERO(&fdsetError);
+                MilliSleep(250);
+            }
+            boost::this_thread::interruption_point();
+
+            int64_t nNow = GetTimeMillis();
+            std::vector<CMasternodeProbe>::iterator it = vInFlight.begin();
+            while(it != vInFlight.end()) {
+                ProbeState state = PROBE_PENDING;
+                if(FD_ISSET(it->hSocket, &fdsetSend) || FD_ISSET(it->hSocket, &fdsetError))
+                    state = FinishProbe(*it);
+                else if(nNow - it->nStart > MASTERNODE_SCANNING_PROBE_TIMEOUT)
+                    state = PROBE_CLOSED;
+
+                if(state == PROBE_PENDING) {
+                    ++it;
+                    continue;
+                }
+                closesocket(it->hSocket);
+                AddProbeResult(*it, state, vResults);
+                it = vInFlight.erase(it);
+            }
+        }
+    } catch (boost::thread_interrupted) {
+        BOOST_FOREACH(CMasternodeProbe& probe, vInFlight)
+            closesocket(probe.hSocket);
+        throw;
+    }
 }
 
 bool CMasternodeScanningError::SignatureValid()
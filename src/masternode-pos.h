@@ -16,6 +16,8 @@
 #include "base58.h"
 #include "main.h"
 
+#include <deque>
+
 using namespace std;
 using namespace boost;
 
@@ -23,6 +25,7 @@ class CMasternodeScanning;
 class CMasternodeScanningError;
 
 extern map<uint256, CMasternodeScanningError> mapMasternodeScanningErrors;
+extern CCriticalSection cs_mapMasternodeScanningErrors;
 extern CMasternodeScanning mnscan;
 
 static const int MIN_MASTERNODE_POS_PROTO_VERSION = 70002;
@@ -40,13 +43,57 @@ static const int MASTERNODE_SCANNING_ERROR_THESHOLD = 6;
 #define SCANNING_ERROR_IX_NO_RESPONSE          3
 #define SCANNING_ERROR_MAX                     3
 
+// Port checks running at the same time
+static const unsigned int MASTERNODE_SCANNING_MAX_PROBES = 8;
+// Milliseconds a port check waits for the masternode to accept
+static const int MASTERNODE_SCANNING_PROBE_TIMEOUT = 5000;
+
 void ProcessMessageMasternodePOS(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
 
+// Runs the queued port checks and relays their results
+void ThreadMasternodeScanning();
+
+// Queued port checks beyond this drop the oldest; their results would be too old to relay
+static const unsigned int MASTERNODE_SCANNING_MAX_QUEUED = 100;
+
+// A port check of Masternode B by Masternode A for the block at nBlockHeight
+class CMasternodeProbe
+{
+public:
+    CTxIn vinMasternodeA;
+    CTxIn vinMasternodeB;
+    CService addr;
+    int nBlockHeight;
+    SOCKET hSocket;
+    int64_t nStart;
+
+    CMasternodeProbe(const CTxIn& vinMasternodeAIn, const CTxIn& vinMasternodeBIn, const CService& addrIn, int nBlockHeightIn)
+    {
+        vinMasternodeA = vinMasternodeAIn;
+        vinMasternodeB = vinMasternodeBIn;
+        addr = addrIn;
+        nBlockHeight = nBlockHeightIn;
+        hSocket = INVALID_SOCKET;
+        nStart = 0;
+    }
+};
+
 class CMasternodeScanning
 {
+private:
+    // critical section to protect the queue of port checks
+    mutable CCriticalSection cs;
+    // port checks waiting for ThreadMasternodeScanning
+    std::deque<CMasternodeProbe> vPendingProbes;
+
 public:
+    // Picks the masternodes to check this block and queues their port checks
     void DoMasternodePOSChecks();
     void CleanMasternodeScanningErrors();
+
+    void QueueProbe(const CMasternodeProbe& probe);
+    // Moves up to nMax queued port checks into vProbes
+    void TakeProbes(std::vector<CMasternodeProbe>& vProbes, unsigned int nMax);
 };
 
 // Returns how many masternodes are allowed to scan each block
@@ -19,8 +19,6 @@ CMasternodePayments masternodePayments;
 map<uint256, CMasternodePaymentWinner> mapSeenMasternodeVotes;
 // keep track of the scanning errors I've seen
 map<uint256, int> mapSeenMasternodeScanningErrors;
-// cache block hashes as we calculate them
-std::map<int64_t, uint256> mapCacheBlockHashes;
 
 void ProcessMessageMasternodePayments(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
 {
@@ -98,39 +96,19 @@ struct CompareValueOnly
 //Get the last hash that matches the modulus given. Processed in reverse order
 bool GetBlockHash(uint256& hash, int nBlockHeight)
 {
-    if (chainActive.Tip() == NULL) return false;
+    // Work from one tip so a concurrent reorg can't mix two branches
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    if (pindexTip == NULL || pindexTip->nHeight == 0) return false;
 
     if(nBlockHeight == 0)
-        nBlockHeight = chainActive.Tip()->nHeight;
+        nBlockHeight = pindexTip->nHeight;
 
-    if(mapCacheBlockHashes.count(nBlockHeight)){
-        hash = mapCacheBlockHashes[nBlockHeight];
-        return true;
-    }
-
-    const CBlockIndex *BlockLastSolved = chainActive.Tip();
-    const CBlockIndex *BlockReading = chainActive.Tip();
-
-    if (BlockLastSolved == NULL || BlockLastSolved->nHeight == 0 || chainActive.Tip()->nHeight+1 < nBlockHeight) return false;
-
-    int nBlocksAgo = 0;
-    if(nBlockHeight > 0) nBlocksAgo = (chainActive.Tip()->nHeight+1)-nBlockHeight;
-    assert(nBlocksAgo >= 0);
-
-    int n = 0;
-    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
-        if(n >= nBlocksAgo){
-            hash = BlockReading->GetBlockHash();
-            mapCacheBlockHashes[nBlockHeight] = hash;
-            return true;
-        }
-        n++;
+    // The block before nBlockHeight (the tip for negative heights), never the genesis block
+    int nHeight = nBlockHeight > 0 ? nBlockHeight - 1 : pindexTip->nHeight;
+    if (nHeight < 1 || nHeight > pindexTip->nHeight) return false;
 
-        if (BlockReading->pprev == NULL) { assert(BlockReading); break; }
-        BlockReading = BlockReading->pprev;
-    }
-
-    return false;
+    hash = pindexTip->GetAncestor(nHeight)->GetBlockHash();
+    return true;
 }
 
 CMasternode::CMasternode()
@@ -211,6 +189,35 @@ CMasternode::CMasternode(CService newAddr, CTxIn newVin, CPubKey newPubkey, std:
     nLastScanningErrorBlockHeight = 0;
 }
 
+CMasternodeListEntry::CMasternodeListEntry()
+{
+    sigTime = 0;
+    lastTimeSeen = 0;
+    protocolVersion = 0;
+    donationPercentage = 0;
+}
+
+CMasternodeListEntry::CMasternodeListEntry(const CMasternode& mn)
+{
+    vin = mn.vin;
+    addr = mn.addr;
+    sig = mn.sig;
+    sigTime = mn.sigTime;
+    pubkey = mn.pubkey;
+    pubkey2 = mn.pubkey2;
+    lastTimeSeen = mn.lastTimeSeen;
+    protocolVersion = mn.protocolVersion;
+    donationAddress = mn.donationAddress;
+    donationPercentage = mn.donationPercentage;
+}
+
+uint256 CMasternodeListEntry::GetHash() const
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << vin << addr << sig << sigTime << pubkey << pubkey2 << protocolVersion << donationAddress << donationPercentage;
+    return ss.GetHash();
+}
+
 //
 // Deterministically calculate a given "score" for a Masternode depending on how close it's hash is to
 // the proof of work for that block. The further away they are the better, the furthest will win the election
@@ -333,26 +340,48 @@ uint64_t CMasternodePayments::CalculateScore(uint256 blockHash, CTxIn& vin)
 
 bool CMasternodePayments::GetBlockPayee(int nBlockHeight, CScript& payee)
 {
-    BOOST_FOREACH(CMasternodePaymentWinner& winner, vWinning){
-        if(winner.nBlockHeight == nBlockHeight) {
-            payee = winner.payee;
-            return true;
-        }
-    }
+    LOCK(cs_masternodepayments);
 
-    return false;
+    std::map<int, CMasternodePaymentWinner>::iterator it = mapWinning.find(nBlockHeight);
+    if(it == mapWinning.end()) return false;
+
+    payee = it->second.payee;
+    return true;
 }
 
 bool CMasternodePayments::GetWinningMasternode(int nBlockHeight, CTxIn& vinOut)
 {
-    BOOST_FOREACH(CMasternodePaymentWinner& winner, vWinning){
-        if(winner.nBlockHeight == nBlockHeight) {
-            vinOut = winner.vin;
-            return true;
-        }
-    }
+    LOCK(cs_masternodepayments);
 
-    return false;
+    std::map<int, CMasternodePaymentWinner>::iterator it = mapWinning.find(nBlockHeight);
+    if(it == mapWinning.end()) return false;
+
+    vinOut = it->second.vin;
+    return true;
+}
+
+bool CMasternodePayments::PaidSince(const COutPoint& outpoint, int nBlockHeight)
+{
+    LOCK(cs_masternodepayments);
+
+    std::map<COutPoint, std::set<int> >::iterator it = mapWinningHeights.find(outpoint);
+    if(it == mapWinningHeights.end()) return false;
+
+    return it->second.lower_bound(nBlockHeight) != it->second.end();
+}
+
+void CMasternodePayments::AddWinningHeight(const CMasternodePaymentWinner& winner)
+{
+    mapWinningHeights[winner.vin.prevout].insert(winner.nBlockHeight);
+}
+
+void CMasternodePayments::RemoveWinningHeight(const CMasternodePaymentWinner& winner)
+{
+    std::map<COutPoint, std::set<int> >::iterator it = mapWinningHeights.find(winner.vin.prevout);
+    if(it == mapWinningHeights.end()) return;
+
+    it->second.erase(winner.nBlockHeight);
+    if(it->second.empty()) mapWinningHeights.erase(it);
 }
 
 bool CMasternodePayments::AddWinningMasternode(CMasternodePaymentWinner& winnerIn)
@@ -364,32 +393,33 @@ bool CMasternodePayments::AddWinningMasternode(CMasternodePaymentWinner& winnerI
 
     winnerIn.score = CalculateScore(blockHash, winnerIn.vin);
 
-    bool foundBlock = false;
-    BOOST_FOREACH(CMasternodePaymentWinner& winner, vWinning){
-        if(winner.nBlockHeight == winnerIn.nBlockHeight) {
-            foundBlock = true;
-            if(winner.score < winnerIn.score){
-                winner.score = winnerIn.score;
-                winner.vin = winnerIn.vin;
-                winner.payee = winnerIn.payee;
-                winner.vchSig = winnerIn.vchSig;
+    LOCK(cs_masternodepayments);
 
-                mapSeenMasternodeVotes.insert(make_pair(winnerIn.GetHash(), winnerIn));
+    std::map<int, CMasternodePaymentWinner>::iterator it = mapWinning.find(winnerIn.nBlockHeight);
+    if(it != mapWinning.end()) {
+        CMasternodePaymentWinner& winner = it->second;
+        if(winner.score < winnerIn.score){
+            RemoveWinningHeight(winner);
+            winner.score = winnerIn.score;
+            winner.vin = winnerIn.vin;
+            winner.payee = winnerIn.payee;
+            winner.vchSig = winnerIn.vchSig;
+            AddWinningHeight(winner);
 
-                return true;
-            }
-        }
-    }
+            mapSeenMasternodeVotes.insert(make_pair(winnerIn.GetHash(), winnerIn));
 
-    // if it's not in the vector
-    if(!foundBlock){
-        vWinning.push_back(winnerIn);
-        mapSeenMasternodeVotes.insert(make_pair(winnerIn.GetHash(), winnerIn));
+            return true;
+        }
 
-        return true;
+        return false;
     }
 
-    return false;
+    // if it's not in the map
+    mapWinning.insert(make_pair(winnerIn.nBlockHeight, winnerIn));
+    AddWinningHeight(winnerIn);
+    mapSeenMasternodeVotes.insert(make_pair(winnerIn.GetHash(), winnerIn));
+
+    return true;
 }
 
 void CMasternodePayments::CleanPaymentList()
@@ -400,13 +430,12 @@ void CMasternodePayments::CleanPaymentList()
 
     int nLimit = std::max(((int)mnodeman.size())*2, 1000);
 
-    vector<CMasternodePaymentWinner>::iterator it;
-    for(it=vWinning.begin();it<vWinning.end();it++){
-        if(chainActive.Tip()->nHeight - (*it).nBlockHeight > nLimit){
-            if(fDebug) LogPrintf("CMasternodePayments::CleanPaymentList - Removing old Masternode payment - block %d\n", (*it).nBlockHeight);
-            vWinning.erase(it);
-            break;
-        }
+    // winners are ordered by height, the old ones are all at the front
+    std::map<int, CMasternodePaymentWinner>::iterator it = mapWinning.begin();
+    while(it != mapWinning.end() && chainActive.Tip()->nHeight - it->first > nLimit){
+        if(fDebug) LogPrintf("CMasternodePayments::CleanPaymentList - Removing old Masternode payment - block %d\n", it->first);
+        RemoveWinningHeight(it->second);
+        mapWinning.erase(it++);
     }
 }
 
@@ -427,19 +456,14 @@ bool CMasternodePayments::ProcessBlock(int nBlockHeight)
 
     LogPrintf(" ProcessBlock Start nHeight %d. \n", nBlockHeight);
 
-    std::vector<CTxIn> vecLastPayments;
-    BOOST_REVERSE_FOREACH(CMasternodePaymentWinner& winner, vWinning)
-    {
-        //if we already have the same vin - we have one full payment cycle, break
-        if(vecLastPayments.size() > nMinimumAge) break;
-        vecLastPayments.push_back(winner.vin);
-    }
+    // the Masternodes paid in the last full payment cycle
+    int nPaidSinceHeight = nBlockHeight - (int)nMinimumAge - 1;
 
     // pay to the oldest MN that still had no payment but its input is old enough and it was active long enough
-    CMasternode *pmn = mnodeman.FindOldestNotInVec(vecLastPayments, nMinimumAge, 0);
+    CMasternode *pmn = mnodeman.FindOldestNotPaid(nPaidSinceHeight, nMinimumAge, 0);
     if(pmn != NULL)
     {
-        LogPrintf(" Found by FindOldestNotInVec \n");
+        LogPrintf(" Found by FindOldestNotPaid \n");
 
         newWinner.score = 0;
         newWinner.nBlockHeight = nBlockHeight;
@@ -454,14 +478,15 @@ bool CMasternodePayments::ProcessBlock(int nBlockHeight)
         payeeSource.SetDestination(pmn->pubkey.GetID());
     }
 
-    //if we can't find new MN to get paid, pick first active MN counting back from the end of vecLastPayments list
+    //if we can't find new MN to get paid, pick the first active MN paid in the last cycle, longest ago first
     if(newWinner.nBlockHeight == 0 && nMinimumAge > 0)
     {
         LogPrintf(" Find by reverse \n");
 
-        BOOST_REVERSE_FOREACH(CTxIn& vinLP, vecLastPayments)
+        std::map<int, CMasternodePaymentWinner>::iterator it = mapWinning.lower_bound(nPaidSinceHeight);
+        for(; it != mapWinning.end(); ++it)
         {
-            CMasternode* pmn = mnodeman.Find(vinLP);
+            CMasternode* pmn = mnodeman.Find(it->second.vin);
             if(pmn != NULL)
             {
                 pmn->Check();
@@ -526,9 +551,10 @@ void CMasternodePayments::Sync(CNode* node)
 {
     LOCK(cs_masternodepayments);
 
-    BOOST_FOREACH(CMasternodePaymentWinner& winner, vWinning)
-        if(winner.nBlockHeight >= chainActive.Tip()->nHeight-10 && winner.nBlockHeight <= chainActive.Tip()->nHeight + 20)
-            node->PushMessage("mnw", winner);
+    std::map<int, CMasternodePaymentWinner>::iterator it = mapWinning.lower_bound(chainActive.Tip()->nHeight-10);
+    std::map<int, CMasternodePaymentWinner>::iterator itEnd = mapWinning.upper_bound(chainActive.Tip()->nHeight+20);
+    for(; it != itEnd; ++it)
+        node->PushMessage("mnw", it->second);
 }
 
 
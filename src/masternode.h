@@ -41,7 +41,6 @@ class CMasternodePaymentWinner;
 
 extern CMasternodePayments masternodePayments;
 extern map<uint256, CMasternodePaymentWinner> mapSeenMasternodeVotes;
-extern map<int64_t, uint256> mapCacheBlockHashes;
 
 void ProcessMessageMasternodePayments(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
 bool GetBlockHash(uint256& hash, int nBlockHeight);
@@ -247,6 +246,45 @@ public:
 
 };
 
+//
+// A signed Masternode announcement, as carried by dsee and batched in mnlist
+//
+class CMasternodeListEntry
+{
+public:
+    CTxIn vin;
+    CService addr;
+    std::vector<unsigned char> sig;
+    int64_t sigTime;
+    CPubKey pubkey;
+    CPubKey pubkey2;
+    int64_t lastTimeSeen;
+    int protocolVersion;
+    CScript donationAddress;
+    int donationPercentage;
+
+    CMasternodeListEntry();
+    CMasternodeListEntry(const CMasternode& mn);
+
+    // same field order as dsee, without count and current
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(vin);
+        READWRITE(addr);
+        READWRITE(sig);
+        READWRITE(sigTime);
+        READWRITE(pubkey);
+        READWRITE(pubkey2);
+        READWRITE(lastTimeSeen);
+        READWRITE(protocolVersion);
+        READWRITE(donationAddress);
+        READWRITE(donationPercentage);
+    )
+
+    /// Identifies the signed announcement, lastTimeSeen is not part of it
+    uint256 GetHash() const;
+};
+
 // for storing the winning payments
 class CMasternodePaymentWinner
 {
@@ -288,7 +326,10 @@ public:
 class CMasternodePayments
 {
 private:
-    std::vector<CMasternodePaymentWinner> vWinning;
+    // winners by block height
+    std::map<int, CMasternodePaymentWinner> mapWinning;
+    // the heights each Masternode input is the winner of
+    std::map<COutPoint, std::set<int> > mapWinningHeights;
     int nSyncedFromPeer;
     std::string strMasterPrivKey;
     std::string strTestPubKey;
@@ -296,6 +337,9 @@ private:
     bool enabled;
     int nLastBlockHeight;
 
+    void AddWinningHeight(const CMasternodePaymentWinner& winner);
+    void RemoveWinningHeight(const CMasternodePaymentWinner& winner);
+
 public:
 
     CMasternodePayments() {
@@ -321,8 +365,9 @@ public:
     void Sync(CNode* node);
     void CleanPaymentList();
     int LastPayment(CMasternode& mn);
+    // Is the input the winner of a block at nBlockHeight or later
+    bool PaidSince(const COutPoint& outpoint, int nBlockHeight);
 
-    //slow
     bool GetBlockPayee(int nBlockHeight, CScript& payee);
 };
 
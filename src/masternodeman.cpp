@@ -9,8 +9,11 @@
 #include "core.h"
 #include "util.h"
 #include "addrman.h"
+#include "trace.h"
 #include <boost/lexical_cast.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 
 CCriticalSection cs_process_message;
 
@@ -44,40 +47,66 @@ CMasternodeDB::CMasternodeDB()
     strMagicMessage = "MasternodeCache";
 }
 
-bool CMasternodeDB::Write(const CMasternodeMan& mnodemanToSave)
+void CMasternodeDB::Snapshot(const CMasternodeMan& mnodemanToSave, CDataStream& ssMasternodes)
 {
-    int64_t nStart = GetTimeMillis();
-
     // serialize, checksum data up to that point, then append checksum
-    CDataStream ssMasternodes(SER_DISK, CLIENT_VERSION);
     ssMasternodes << strMagicMessage; // masternode cache file specific magic message
     ssMasternodes << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssMasternodes << mnodemanToSave;
+    ssMasternodes << (int)MASTERNODES_CACHE_VERSION;
+    ssMasternodes << mnodemanToSave; // holds the manager lock only while copying out
     uint256 hash = Hash(ssMasternodes.begin(), ssMasternodes.end());
     ssMasternodes << hash;
+}
+
+bool CMasternodeDB::Write(const CDataStream& ssMasternodes)
+{
+    int64_t nStart = GetTimeMillis();
+
+    // write to a temporary file and rename it over the old one, so a crash
+    // halfway through leaves the previous cache intact
+    unsigned short randv = 0;
+    RAND_bytes((unsigned char *)&randv, sizeof(randv));
+    boost::filesystem::path pathTmp = GetDataDir() / strprintf("mncache.dat.%04x", randv);
 
     // open output file, and associate with CAutoFile
-    FILE *file = fopen(pathMN.string().c_str(), "wb");
+    FILE *file = fopen(pathTmp.string().c_str(), "wb");
     CAutoFile fileout = CAutoFile(file, SER_DISK, CLIENT_VERSION);
     if (!fileout)
-        return error("%s : Failed to open file %s", __func__, pathMN.string());
+        return error("%s : Failed to open file %s", __func__, pathTmp.string());
 
     // Write and commit header, data
     try {
         fileout << ssMasternodes;
     }
     catch (std::exception &e) {
+        fileout.fclose();
+        boost::filesystem::remove(pathTmp);
         return error("%s : Serialize or I/O error - %s", __func__, e.what());
     }
     FileCommit(fileout);
     fileout.fclose();
 
+    if (!RenameOver(pathTmp, pathMN))
+    {
+        boost::filesystem::remove(pathTmp);
+        return error("%s : Rename-into-place failed", __func__);
+    }
+
     LogPrintf("Written info to mncache.dat  %dms\n", GetTimeMillis() - nStart);
-    LogPrintf("  %s\n", mnodemanToSave.ToString());
 
     return true;
 }
 
+bool CMasternodeDB::Write(const CMasternodeMan& mnodemanToSave)
+{
+    CDataStream ssMasternodes(SER_DISK, CLIENT_VERSION);
+    Snapshot(mnodemanToSave, ssMasternodes);
+    if (!Write(ssMasternodes))
+        return false;
+    LogPrintf("  %s\n", mnodemanToSave.ToString());
+    return true;
+}
+
 CMasternodeDB::ReadResult CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad)
 {
     int64_t nStart = GetTimeMillis();
@@ -144,6 +173,16 @@ CMasternodeDB::ReadResult CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad)
             error("%s : Invalid network magic number", __func__);
             return IncorrectMagicNumber;
         }
+
+        // older caches have no version, they are dropped and rebuilt from the network
+        int nCacheVersion = 0;
+        ssMasternodes >> nCacheVersion;
+        if (nCacheVersion != MASTERNODES_CACHE_VERSION)
+        {
+            error("%s : Unsupported masternode cache version %d", __func__, nCacheVersion);
+            return IncorrectVersion;
+        }
+
         // de-serialize data into CMasternodeMan object
         ssMasternodes >> mnodemanToLoad;
     }
@@ -153,7 +192,10 @@ CMasternodeDB::ReadResult CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad)
         return IncorrectFormat;
     }
 
-    mnodemanToLoad.CheckAndRemove(); // clean out expired
+    // Only drop what is long gone. Checking every input against the UTXO set
+    // is left to the regular CheckAndRemove in ThreadCheckDarkSendPool, so
+    // startup does not pay for it.
+    mnodemanToLoad.RemoveStale();
     LogPrintf("Loaded info from mncache.dat  %dms\n", GetTimeMillis() - nStart);
     LogPrintf("  %s\n", mnodemanToLoad.ToString());
 
@@ -165,32 +207,49 @@ void DumpMasternodes()
     int64_t nStart = GetTimeMillis();
 
     CMasternodeDB mndb;
-    CMasternodeMan tempMnodeman;
-
-    LogPrintf("Verifying mncache.dat format...\n");
-    CMasternodeDB::ReadResult readResult = mndb.Read(tempMnodeman);
-    // there was an error and it was not an error on file openning => do not proceed
-    if (readResult == CMasternodeDB::FileError)
-        LogPrintf("Missing masternode cache file - mncache.dat, will try to recreate\n");
-    else if (readResult != CMasternodeDB::Ok)
-    {
-        LogPrintf("Error reading mncache.dat: ");
-        if(readResult == CMasternodeDB::IncorrectFormat)
-            LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
-        else
-        {
-            LogPrintf("file format is unknown or invalid, please fix it manually\n");
-            return;
-        }
-    }
     LogPrintf("Writting info to mncache.dat...\n");
     mndb.Write(mnodeman);
 
     LogPrintf("Masternode dump finished  %dms\n", GetTimeMillis() - nStart);
 }
 
+// The newest snapshot waiting for ThreadMasternodeCacheWriter, if any
+static boost::mutex mutexCacheSnapshot;
+static boost::condition_variable condCacheSnapshot;
+static boost::shared_ptr<CDataStream> pCacheSnapshot;
+
+void DumpMasternodesAsync()
+{
+    boost::shared_ptr<CDataStream> pSnapshot(new CDataStream(SER_DISK, CLIENT_VERSION));
+    CMasternodeDB().Snapshot(mnodeman, *pSnapshot);
+
+    boost::mutex::scoped_lock lock(mutexCacheSnapshot);
+    pCacheSnapshot = pSnapshot; // a snapshot not written yet is superseded
+    condCacheSnapshot.notify_one();
+}
+
+void ThreadMasternodeCacheWriter()
+{
+    RenameThread("testinterzone-mncache");
+
+    // Shutdown writes the final cache itself, a snapshot still pending at
+    // interruption is dropped
+    while (true)
+    {
+        boost::shared_ptr<CDataStream> pSnapshot;
+        {
+            boost::mutex::scoped_lock lock(mutexCacheSnapshot);
+            while (!pCacheSnapshot)
+                condCacheSnapshot.wait(lock);
+            pSnapshot.swap(pCacheSnapshot);
+        }
+        CMasternodeDB().Write(*pSnapshot);
+    }
+}
+
 CMasternodeMan::CMasternodeMan() {
     nDsqCount = 0;
+    fByInputAgeDirty = true;
 }
 
 bool CMasternodeMan::Add(CMasternode &mn)
@@ -206,6 +265,7 @@ bool CMasternodeMan::Add(CMasternode &mn)
     {
         if(fDebug) LogPrintf("CMasternodeMan: Adding new Masternode %s - %i now\n", mn.addr.ToString().c_str(), size() + 1);
         vMasternodes.push_back(mn);
+        fByInputAgeDirty = true;
         return true;
     }
 
@@ -232,6 +292,7 @@ void CMasternodeMan::CheckAndRemove()
         if((*it).activeState == CMasternode::MASTERNODE_REMOVE || (*it).activeState == CMasternode::MASTERNODE_VIN_SPENT){
             if(fDebug) LogPrintf("CMasternodeMan: Removing inactive Masternode %s - %i now\n", (*it).addr.ToString().c_str(), size() - 1);
             it = vMasternodes.erase(it);
+            fByInputAgeDirty = true;
         } else {
             ++it;
         }
@@ -269,10 +330,27 @@ void CMasternodeMan::CheckAndRemove()
 
 }
 
+void CMasternodeMan::RemoveStale()
+{
+    LOCK(cs);
+
+    vector<CMasternode>::iterator it = vMasternodes.begin();
+    while(it != vMasternodes.end()){
+        if(!(*it).UpdatedWithin(MASTERNODE_REMOVAL_SECONDS)){
+            if(fDebug) LogPrintf("CMasternodeMan: Removing stale Masternode %s - %i now\n", (*it).addr.ToString().c_str(), size() - 1);
+            it = vMasternodes.erase(it);
+            fByInputAgeDirty = true;
+        } else {
+            ++it;
+        }
+    }
+}
+
 void CMasternodeMan::Clear()
 {
     LOCK(cs);
     vMasternodes.clear();
+    fByInputAgeDirty = true;
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
@@ -316,11 +394,64 @@ void CMasternodeMan::DsegUpdate(CNode* pnode)
             return;
         }
     }
-    pnode->PushMessage("dseg", CTxIn());
+    if(pnode->nVersion >= MNLIST_SYNC_VERSION)
+    {
+        // send what we have, the peer answers with the entries we lack
+        std::vector<CMasternodeListEntry> vEntries;
+        std::vector<uint256> vHashes;
+        GetListEntries(vEntries, vHashes);
+
+        uint64_t k0 = GetRand(std::numeric_limits<uint64_t>::max());
+        uint64_t k1 = GetRand(std::numeric_limits<uint64_t>::max());
+        std::vector<uint64_t> vShortIds;
+        vShortIds.reserve(vHashes.size());
+        BOOST_FOREACH(const uint256& hash, vHashes)
+            vShortIds.push_back(SipHashUint256(k0, k1, hash));
+
+        pnode->PushMessage("mnlistreq", GetListHash(vHashes), k0, k1, vShortIds);
+    }
+    else
+        pnode->PushMessage("dseg", CTxIn());
     int64_t askAgain = GetTime() + MASTERNODES_DSEG_SECONDS;
     mWeAskedForMasternodeList[pnode->addr] = askAgain;
 }
 
+struct CompareListEntry
+{
+    bool operator()(const CMasternodeListEntry& a, const CMasternodeListEntry& b) const
+    {
+        return a.vin.prevout < b.vin.prevout;
+    }
+};
+
+void CMasternodeMan::GetListEntries(std::vector<CMasternodeListEntry>& vEntries, std::vector<uint256>& vHashes)
+{
+    vEntries.clear();
+    vHashes.clear();
+    {
+        LOCK(cs);
+        BOOST_FOREACH(CMasternode& mn, vMasternodes)
+        {
+            if(mn.addr.IsRFC1918() || mn.addr.IsLocal()) continue;
+            if(mn.IsEnabled()) vEntries.push_back(CMasternodeListEntry(mn));
+        }
+    }
+
+    // the same list on two nodes must give the same snapshot hash
+    std::sort(vEntries.begin(), vEntries.end(), CompareListEntry());
+    vHashes.reserve(vEntries.size());
+    BOOST_FOREACH(const CMasternodeListEntry& entry, vEntries)
+        vHashes.push_back(entry.GetHash());
+}
+
+uint256 CMasternodeMan::GetListHash(const std::vector<uint256>& vHashes)
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    BOOST_FOREACH(const uint256& hash, vHashes)
+        ss << hash;
+    return ss.GetHash();
+}
+
 CMasternode *CMasternodeMan::Find(const CTxIn &vin)
 {
     LOCK(cs);
@@ -347,37 +478,58 @@ CMasternode *CMasternodeMan::Find(const CPubKey &pubKeyMasternode)
 }
 
 
-CMasternode* CMasternodeMan::FindOldestNotInVec(const std::vector<CTxIn> &vVins, int nMinimumAge, int nMinimumActiveSeconds)
+struct CompareInputAge
+{
+    bool operator()(const pair<int, CMasternode*>& t1,
+                    const pair<int, CMasternode*>& t2) const
+    {
+        return t1.first > t2.first;
+    }
+};
+
+void CMasternodeMan::UpdateInputAgeIndex()
+{
+    if(!fByInputAgeDirty) return;
+    fByInputAgeDirty = false;
+
+    // every input ages by one each block, so the order only changes with the list
+    std::vector<pair<int, CMasternode*> > vecInputAges;
+    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+        vecInputAges.push_back(make_pair(mn.GetMasternodeInputAge(), &mn));
+        // no age cached yet, it goes to the end for now and gets sorted in later
+        if(mn.cacheInputAge == 0) fByInputAgeDirty = true;
+    }
+
+    // ties keep list order
+    stable_sort(vecInputAges.begin(), vecInputAges.end(), CompareInputAge());
+
+    vecByInputAge.clear();
+    vecByInputAge.reserve(vecInputAges.size());
+    for(unsigned int i = 0; i < vecInputAges.size(); i++)
+        vecByInputAge.push_back(vecInputAges[i].second);
+}
+
+CMasternode* CMasternodeMan::FindOldestNotPaid(int nPaidSinceHeight, int nMinimumAge, int nMinimumActiveSeconds)
 {
     LOCK(cs);
 
-    CMasternode *pOldestMasternode = NULL;
+    UpdateInputAgeIndex();
 
-    BOOST_FOREACH(CMasternode &mn, vMasternodes)
+    BOOST_FOREACH(CMasternode* pmn, vecByInputAge)
     {
-        mn.Check();
-        if(!mn.IsEnabled()) continue;
-
         if(!RegTest()){
-            if(mn.GetMasternodeInputAge() < nMinimumAge || mn.lastTimeSeen - mn.sigTime < nMinimumActiveSeconds) continue;
+            if(pmn->GetMasternodeInputAge() < nMinimumAge || pmn->lastTimeSeen - pmn->sigTime < nMinimumActiveSeconds) continue;
         }
 
-        bool found = false;
-        BOOST_FOREACH(const CTxIn& vin, vVins)
-            if(mn.vin.prevout == vin.prevout)
-            {
-                found = true;
-                break;
-            }
+        if(masternodePayments.PaidSince(pmn->vin.prevout, nPaidSinceHeight)) continue;
 
-        if(found) continue;
+        pmn->Check();
+        if(!pmn->IsEnabled()) continue;
 
-        if(pOldestMasternode == NULL || pOldestMasternode->GetMasternodeInputAge() < mn.GetMasternodeInputAge()){
-            pOldestMasternode = &mn;
-        }
+        return pmn;
     }
 
-    return pOldestMasternode;
+    return NULL;
 }
 
 CMasternode *CMasternodeMan::FindRandom()
@@ -538,202 +690,223 @@ void CMasternodeMan::ProcessMasternodeConnections()
     }
 }
 
-void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
+void CMasternodeMan::ProcessEntry(CNode* pfrom, CMasternodeListEntry& entry, int count, int current)
 {
+    CTxIn& vin = entry.vin;
+    CService& addr = entry.addr;
+    CPubKey& pubkey = entry.pubkey;
+    CPubKey& pubkey2 = entry.pubkey2;
+    vector<unsigned char>& vchSig = entry.sig;
+    int64_t sigTime = entry.sigTime;
+    int64_t lastUpdated = entry.lastTimeSeen;
+    int protocolVersion = entry.protocolVersion;
+    CScript& donationAddress = entry.donationAddress;
+    int& donationPercentage = entry.donationPercentage;
+    std::string strMessage;
+
+    // make sure signature isn't in the future (past is OK)
+    if (sigTime > GetAdjustedTime() + 60 * 60) {
+        LogPrintf("dsee - Signature rejected, too far into the future %s\n", vin.ToString().c_str());
+        return;
+    }
 
-    if(fLiteMode) return; //disable all Darksend/Masternode related functionality
-    if(IsInitialBlockDownload()) return;
+    bool isLocal = addr.IsRFC1918() || addr.IsLocal();
+    if(RegTest()) isLocal = false;
 
-    LOCK(cs_process_message);
+    std::string vchPubKey(pubkey.begin(), pubkey.end());
+    std::string vchPubKey2(pubkey2.begin(), pubkey2.end());
 
-    if (strCommand == "dsee") { //DarkSend Election Entry
+    strMessage = addr.ToString() + boost::lexical_cast<std::string>(sigTime) + vchPubKey + vchPubKey2 + boost::lexical_cast<std::string>(protocolVersion)  + donationAddress.ToString() + boost::lexical_cast<std::string>(donationPercentage);
 
-        CTxIn vin;
-        CService addr;
-        CPubKey pubkey;
-        CPubKey pubkey2;
-        vector<unsigned char> vchSig;
-        int64_t sigTime;
-        int count;
-        int current;
-        int64_t lastUpdated;
-        int protocolVersion;
-        CScript donationAddress;
-        int donationPercentage;
-        std::string strMessage;
+    if(donationPercentage < 0 || donationPercentage > 100){
+        LogPrintf("dsee - donation percentage out of range %d\n", donationPercentage);
+        return;
+    }
 
-        // 70047 and greater
-        vRecv >> vin >> addr >> vchSig >> sigTime >> pubkey >> pubkey2 >> count >> current >> lastUpdated >> protocolVersion >> donationAddress >> donationPercentage;
+    if(protocolVersion < nMasternodeMinProtocol) {
+        LogPrintf("dsee - ignoring outdated Masternode %s protocol version %d\n", vin.ToString().c_str(), protocolVersion);
+        return;
+    }
 
-        // make sure signature isn't in the future (past is OK)
-        if (sigTime > GetAdjustedTime() + 60 * 60) {
-            LogPrintf("dsee - Signature rejected, too far into the future %s\n", vin.ToString().c_str());
-            return;
-        }
+    CScript pubkeyScript;
+    pubkeyScript.SetDestination(pubkey.GetID());
 
-        bool isLocal = addr.IsRFC1918() || addr.IsLocal();
-        if(RegTest()) isLocal = false;
+    if(pubkeyScript.size() != 25) {
+        LogPrintf("dsee - pubkey the wrong size\n");
+        Misbehaving(pfrom->GetId(), 100);
+        return;
+    }
 
-        std::string vchPubKey(pubkey.begin(), pubkey.end());
-        std::string vchPubKey2(pubkey2.begin(), pubkey2.end());
+    CScript pubkeyScript2;
+    pubkeyScript2.SetDestination(pubkey2.GetID());
 
-        strMessage = addr.ToString() + boost::lexical_cast<std::string>(sigTime) + vchPubKey + vchPubKey2 + boost::lexical_cast<std::string>(protocolVersion)  + donationAddress.ToString() + boost::lexical_cast<std::string>(donationPercentage);
+    if(pubkeyScript2.size() != 25) {
+        LogPrintf("dsee - pubkey2 the wrong size\n");
+        Misbehaving(pfrom->GetId(), 100);
+        return;
+    }
 
-        if(donationPercentage < 0 || donationPercentage > 100){
-            LogPrintf("dsee - donation percentage out of range %d\n", donationPercentage);
-            return;
-        }
+    if(!vin.scriptSig.empty()) {
+        LogPrintf("dsee - Ignore Not Empty ScriptSig %s\n",vin.ToString().c_str());
+        return;
+    }
 
-        if(protocolVersion < nMasternodeMinProtocol) {
-            LogPrintf("dsee - ignoring outdated Masternode %s protocol version %d\n", vin.ToString().c_str(), protocolVersion);
-            return;
-        }
+    std::string errorMessage = "";
+    if(!darkSendSigner.VerifyMessage(pubkey, vchSig, strMessage, errorMessage)){
+        LogPrintf("dsee - Got bad Masternode address signature\n");
+        Misbehaving(pfrom->GetId(), 100);
+        return;
+    }
 
-        CScript pubkeyScript;
-        pubkeyScript.SetDestination(pubkey.GetID());
+    /*
+    if(Params().NetworkID() == CChainParams::MAIN){
+        if(addr.GetPort() != 9999) return;
+    } else if(addr.GetPort() == 9999) return;
+    */
 
-        if(pubkeyScript.size() != 25) {
-            LogPrintf("dsee - pubkey the wrong size\n");
-            Misbehaving(pfrom->GetId(), 100);
-            return;
+    //search existing Masternode list, this is where we update existing Masternodes with new dsee broadcasts
+    CMasternode* pmn = this->Find(vin);
+    // if we are masternode but with undefined vin and this dsee is ours (matches our Masternode privkey) then just skip this part
+    if(pmn != NULL && !(fMasterNode && activeMasternode.vin == CTxIn() && pubkey2 == activeMasternode.pubKeyMasternode))
+    {
+        // count == -1 when it's a new entry
+        //   e.g. We don't want the entry relayed/time updated when we're syncing the list
+        // mn.pubkey = pubkey, IsVinAssociatedWithPubkey is validated once below,
+        //   after that they just need to match
+        if(count == -1 && pmn->pubkey == pubkey && !pmn->UpdatedWithin(MASTERNODE_MIN_DSEE_SECONDS)){
+            pmn->UpdateLastSeen();
+
+            if(pmn->sigTime < sigTime){ //take the newest entry
+                LogPrintf("dsee - Got updated entry for %s\n", addr.ToString().c_str());
+                pmn->pubkey2 = pubkey2;
+                pmn->sigTime = sigTime;
+                pmn->sig = vchSig;
+                pmn->protocolVersion = protocolVersion;
+                pmn->addr = addr;
+                pmn->donationAddress = donationAddress;
+                pmn->donationPercentage = donationPercentage;
+                pmn->Check();
+                if(pmn->IsEnabled())
+                    mnodeman.RelayMasternodeEntry(vin, addr, vchSig, sigTime, pubkey, pubkey2, count, current, lastUpdated, protocolVersion, donationAddress, donationPercentage);
+            }
         }
-
-        CScript pubkeyScript2;
-        pubkeyScript2.SetDestination(pubkey2.GetID());
-
-        if(pubkeyScript2.size() != 25) {
-            LogPrintf("dsee - pubkey2 the wrong size\n");
-            Misbehaving(pfrom->GetId(), 100);
-            return;
+        else if(count != -1 && pmn->pubkey == pubkey && pmn->sigTime < sigTime){
+            // a newer announcement we missed, from list sync: take it, but
+            // leave the last seen time alone and don't relay it
+            LogPrintf("dsee - Got updated entry for %s from list\n", addr.ToString().c_str());
+            pmn->pubkey2 = pubkey2;
+            pmn->sigTime = sigTime;
+            pmn->sig = vchSig;
+            pmn->protocolVersion = protocolVersion;
+            pmn->addr = addr;
+            pmn->donationAddress = donationAddress;
+            pmn->donationPercentage = donationPercentage;
+            pmn->Check();
         }
 
-        if(!vin.scriptSig.empty()) {
-            LogPrintf("dsee - Ignore Not Empty ScriptSig %s\n",vin.ToString().c_str());
-            return;
-        }
+        return;
+    }
 
-        std::string errorMessage = "";
-        if(!darkSendSigner.VerifyMessage(pubkey, vchSig, strMessage, errorMessage)){
-            LogPrintf("dsee - Got bad Masternode address signature\n");
-            Misbehaving(pfrom->GetId(), 100);
+    // make sure the vout that was signed is related to the transaction that spawned the Masternode
+    //  - this is expensive, so it's only done once per Masternode
+    //if(!darkSendSigner.IsVinAssociatedWithPubkey(vin, pubkey)) {
+    //    LogPrintf("dsee - Got mismatched pubkey and vin\n");
+    //    Misbehaving(pfrom->GetId(), 100);
+    //    return;
+    //}
+
+    if(fDebug) LogPrintf("dsee - Got NEW Masternode entry %s\n", addr.ToString().c_str());
+
+    // make sure it's still unspent
+    //  - this is checked later by .check() in many places and by ThreadCheckDarkSendPool()
+
+    CValidationState state;
+    CTransaction tx = CTransaction();
+    CTxOut vout = CTxOut(999.99*COIN, darkSendPool.collateralPubKey);
+    tx.vin.push_back(vin);
+    tx.vout.push_back(vout);
+    if(AcceptableInputs(mempool, state, tx)){
+        if(fDebug) LogPrintf("dsee - Accepted Masternode entry %i %i\n", count, current);
+
+        if(GetInputAge(vin) < MASTERNODE_MIN_CONFIRMATIONS){
+            LogPrintf("dsee - Input must have least %d confirmations\n", MASTERNODE_MIN_CONFIRMATIONS);
+            Misbehaving(pfrom->GetId(), 20);
             return;
         }
 
-        /*
-        if(Params().NetworkID() == CChainParams::MAIN){
-            if(addr.GetPort() != 9999) return;
-        } else if(addr.GetPort() == 9999) return;
-        */
-
-        //search existing Masternode list, this is where we update existing Masternodes with new dsee broadcasts
-        CMasternode* pmn = this->Find(vin);
-        // if we are masternode but with undefined vin and this dsee is ours (matches our Masternode privkey) then just skip this part
-        if(pmn != NULL && !(fMasterNode && activeMasternode.vin == CTxIn() && pubkey2 == activeMasternode.pubKeyMasternode))
+        // verify that sig time is legit in past
+        // should be at least not earlier than block when 1000 DASH tx got MASTERNODE_MIN_CONFIRMATIONS
+        uint256 hashBlock = 0;
+        GetTransaction(vin.prevout.hash, tx, hashBlock, true);
+        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+        if (mi != mapBlockIndex.end() && (*mi).second)
         {
-            // count == -1 when it's a new entry
-            //   e.g. We don't want the entry relayed/time updated when we're syncing the list
-            // mn.pubkey = pubkey, IsVinAssociatedWithPubkey is validated once below,
-            //   after that they just need to match
-            if(count == -1 && pmn->pubkey == pubkey && !pmn->UpdatedWithin(MASTERNODE_MIN_DSEE_SECONDS)){
-                pmn->UpdateLastSeen();
-
-                if(pmn->sigTime < sigTime){ //take the newest entry
-                    LogPrintf("dsee - Got updated entry for %s\n", addr.ToString().c_str());
-                    pmn->pubkey2 = pubkey2;
-                    pmn->sigTime = sigTime;
-                    pmn->sig = vchSig;
-                    pmn->protocolVersion = protocolVersion;
-                    pmn->addr = addr;
-                    pmn->donationAddress = donationAddress;
-                    pmn->donationPercentage = donationPercentage;
-                    pmn->Check();
-                    if(pmn->IsEnabled())
-                        mnodeman.RelayMasternodeEntry(vin, addr, vchSig, sigTime, pubkey, pubkey2, count, current, lastUpdated, protocolVersion, donationAddress, donationPercentage);
-                }
+            CBlockIndex* pMNIndex = (*mi).second; // block for 1000 DASH tx -> 1 confirmation
+            CBlockIndex* pConfIndex = chainActive[pMNIndex->nHeight + MASTERNODE_MIN_CONFIRMATIONS - 1]; // block where tx got MASTERNODE_MIN_CONFIRMATIONS
+            if(pConfIndex->GetBlockTime() > sigTime)
+            {
+                LogPrintf("dsee - Bad sigTime %d for Masternode %20s %105s (%i conf block is at %d)\n",
+                          sigTime, addr.ToString(), vin.ToString(), MASTERNODE_MIN_CONFIRMATIONS, pConfIndex->GetBlockTime());
+                return;
             }
-
-            return;
         }
 
-        // make sure the vout that was signed is related to the transaction that spawned the Masternode
-        //  - this is expensive, so it's only done once per Masternode
-        //if(!darkSendSigner.IsVinAssociatedWithPubkey(vin, pubkey)) {
-        //    LogPrintf("dsee - Got mismatched pubkey and vin\n");
-        //    Misbehaving(pfrom->GetId(), 100);
-        //    return;
-        //}
 
-        if(fDebug) LogPrintf("dsee - Got NEW Masternode entry %s\n", addr.ToString().c_str());
+        // use this as a peer
+        addrman.Add(CAddress(addr), pfrom->addr, 2*60*60);
 
-        // make sure it's still unspent
-        //  - this is checked later by .check() in many places and by ThreadCheckDarkSendPool()
+        //doesn't support multisig addresses
+        if(donationAddress.IsPayToScriptHash()){
+            donationAddress = CScript();
+            donationPercentage = 0;
+        }
 
-        CValidationState state;
-        CTransaction tx = CTransaction();
-        CTxOut vout = CTxOut(999.99*COIN, darkSendPool.collateralPubKey);
-        tx.vin.push_back(vin);
-        tx.vout.push_back(vout);
-        if(AcceptableInputs(mempool, state, tx)){
-            if(fDebug) LogPrintf("dsee - Accepted Masternode entry %i %i\n", count, current);
+        // add our Masternode
+        CMasternode mn(addr, vin, pubkey, vchSig, sigTime, pubkey2, protocolVersion, donationAddress, donationPercentage);
+        mn.UpdateLastSeen(lastUpdated);
+        this->Add(mn);
 
-            if(GetInputAge(vin) < MASTERNODE_MIN_CONFIRMATIONS){
-                LogPrintf("dsee - Input must have least %d confirmations\n", MASTERNODE_MIN_CONFIRMATIONS);
-                Misbehaving(pfrom->GetId(), 20);
-                return;
-            }
+        // if it matches our Masternode privkey, then we've been remotely activated
+        if(pubkey2 == activeMasternode.pubKeyMasternode && protocolVersion == PROTOCOL_VERSION){
+            activeMasternode.EnableHotColdMasterNode(vin, addr);
+        }
 
-            // verify that sig time is legit in past
-            // should be at least not earlier than block when 1000 DASH tx got MASTERNODE_MIN_CONFIRMATIONS
-            uint256 hashBlock = 0;
-            GetTransaction(vin.prevout.hash, tx, hashBlock, true);
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
-            if (mi != mapBlockIndex.end() && (*mi).second)
-            {
-                CBlockIndex* pMNIndex = (*mi).second; // block for 1000 DASH tx -> 1 confirmation
-                CBlockIndex* pConfIndex = chainActive[pMNIndex->nHeight + MASTERNODE_MIN_CONFIRMATIONS - 1]; // block where tx got MASTERNODE_MIN_CONFIRMATIONS
-                if(pConfIndex->GetBlockTime() > sigTime)
-                {
-                    LogPrintf("dsee - Bad sigTime %d for Masternode %20s %105s (%i conf block is at %d)\n",
-                              sigTime, addr.ToString(), vin.ToString(), MASTERNODE_MIN_CONFIRMATIONS, pConfIndex->GetBlockTime());
-                    return;
-                }
-            }
+        if(count == -1 && !isLocal)
+            mnodeman.RelayMasternodeEntry(vin, addr, vchSig, sigTime, pubkey, pubkey2, count, current, lastUpdated, protocolVersion, donationAddress, donationPercentage);
 
+    } else {
+        LogPrintf("dsee - Rejected Masternode entry %s\n", addr.ToString().c_str());
 
-            // use this as a peer
-            addrman.Add(CAddress(addr), pfrom->addr, 2*60*60);
+        int nDoS = 0;
+        if (state.IsInvalid(nDoS))
+        {
+            LogPrintf("dsee - %s from %s %s was not accepted into the memory pool\n", tx.GetHash().ToString().c_str(),
+                pfrom->addr.ToString().c_str(), pfrom->cleanSubVer.c_str());
+            if (nDoS > 0)
+                Misbehaving(pfrom->GetId(), nDoS);
+        }
+    }
+}
 
-            //doesn't support multisig addresses
-            if(donationAddress.IsPayToScriptHash()){
-                donationAddress = CScript();
-                donationPercentage = 0;
-            }
+void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
+{
+    CTraceSpan span("CMasternodeMan::ProcessMessage", strCommand);
 
-            // add our Masternode
-            CMasternode mn(addr, vin, pubkey, vchSig, sigTime, pubkey2, protocolVersion, donationAddress, donationPercentage);
-            mn.UpdateLastSeen(lastUpdated);
-            this->Add(mn);
+    if(fLiteMode) return; //disable all Darksend/Masternode related functionality
+    if(IsInitialBlockDownload()) return;
 
-            // if it matches our Masternode privkey, then we've been remotely activated
-            if(pubkey2 == activeMasternode.pubKeyMasternode && protocolVersion == PROTOCOL_VERSION){
-                activeMasternode.EnableHotColdMasterNode(vin, addr);
-            }
+    LOCK(cs_process_message);
 
-            if(count == -1 && !isLocal)
-                mnodeman.RelayMasternodeEntry(vin, addr, vchSig, sigTime, pubkey, pubkey2, count, current, lastUpdated, protocolVersion, donationAddress, donationPercentage);
+    if (strCommand == "dsee") { //DarkSend Election Entry
 
-        } else {
-            LogPrintf("dsee - Rejected Masternode entry %s\n", addr.ToString().c_str());
+        CMasternodeListEntry entry;
+        int count;
+        int current;
 
-            int nDoS = 0;
-            if (state.IsInvalid(nDoS))
-            {
-                LogPrintf("dsee - %s from %s %s was not accepted into the memory pool\n", tx.GetHash().ToString().c_str(),
-                    pfrom->addr.ToString().c_str(), pfrom->cleanSubVer.c_str());
-                if (nDoS > 0)
-                    Misbehaving(pfrom->GetId(), nDoS);
-            }
-        }
+        // 70047 and greater
+        vRecv >> entry.vin >> entry.addr >> entry.sig >> entry.sigTime >> entry.pubkey >> entry.pubkey2 >> count >> current >> entry.lastTimeSeen >> entry.protocolVersion >> entry.donationAddress >> entry.donationPercentage;
+
+        ProcessEntry(pfrom, entry, count, current);
     }
 
     else if (strCommand == "dseep") { //DarkSend Election Entry Ping
@@ -887,6 +1060,92 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         }
 
         LogPrintf("dseg - Sent %d Masternode entries to %s\n", i, pfrom->addr.ToString().c_str());
+
+    } else if (strCommand == "mnlistreq") { //Get the Masternode entries we have and the peer lacks
+
+        uint256 hashList;
+        uint64_t k0, k1;
+        std::vector<uint64_t> vShortIds;
+        vRecv >> hashList >> k0 >> k1 >> vShortIds;
+
+        // the peer's list can be ahead of ours, but not by this much
+        if(vShortIds.size() > (unsigned int)size() + MASTERNODES_SYNC_MARGIN)
+        {
+            Misbehaving(pfrom->GetId(), 20);
+            LogPrintf("mnlistreq - peer sent %u short ids, we know %d masternodes\n", vShortIds.size(), size());
+            return;
+        }
+
+        // same throttle as a full dseg
+        if(!pfrom->addr.IsRFC1918() && Params().NetworkID() == CChainParams::MAIN)
+        {
+            std::map<CNetAddr, int64_t>::iterator it = mAskedUsForMasternodeList.find(pfrom->addr);
+            if (it != mAskedUsForMasternodeList.end() && GetTime() < (*it).second)
+            {
+                Misbehaving(pfrom->GetId(), 34);
+                LogPrintf("mnlistreq - peer already asked me for the list\n");
+                return;
+            }
+            mAskedUsForMasternodeList[pfrom->addr] = GetTime() + MASTERNODES_DSEG_SECONDS;
+        }
+
+        std::vector<CMasternodeListEntry> vEntries;
+        std::vector<uint256> vHashes;
+        GetListEntries(vEntries, vHashes);
+        uint256 hashOurs = GetListHash(vHashes);
+
+        std::vector<CMasternodeListEntry> vMissing;
+        if(hashOurs != hashList)
+        {
+            std::set<uint64_t> setHave(vShortIds.begin(), vShortIds.end());
+            for(unsigned int i = 0; i < vEntries.size(); i++)
+                if(!setHave.count(SipHashUint256(k0, k1, vHashes[i])))
+                    vMissing.push_back(vEntries[i]);
+        }
+
+        // always answer, an empty list tells the peer it is in sync
+        int nMissing = vMissing.size();
+        unsigned int nPos = 0;
+        do {
+            unsigned int nEnd = std::min(nPos + MASTERNODES_LIST_BATCH_SIZE, (unsigned int)vMissing.size());
+            std::vector<CMasternodeListEntry> vBatch(vMissing.begin() + nPos, vMissing.begin() + nEnd);
+            pfrom->PushMessage("mnlist", hashOurs, nMissing, vBatch);
+            nPos = nEnd;
+        } while(nPos < vMissing.size());
+
+        LogPrintf("mnlistreq - Sent %d of %d Masternode entries to %s\n", nMissing, (int)vEntries.size(), pfrom->addr.ToString().c_str());
+
+    } else if (strCommand == "mnlist") { //Masternode entries, answering our mnlistreq
+
+        uint256 hashList;
+        int nMissing;
+        std::vector<CMasternodeListEntry> vBatch;
+        vRecv >> hashList >> nMissing >> vBatch;
+
+        std::map<CNetAddr, int64_t>::iterator it = mWeAskedForMasternodeList.find(pfrom->addr);
+        if (it == mWeAskedForMasternodeList.end() || GetTime() >= (*it).second)
+        {
+            LogPrint("masternode", "mnlist - ignoring unrequested list from %s\n", pfrom->addr.ToString());
+            return;
+        }
+
+        if(vBatch.size() > MASTERNODES_LIST_BATCH_SIZE)
+        {
+            LogPrintf("mnlist - batch of %u entries is too large\n", vBatch.size());
+            Misbehaving(pfrom->GetId(), 20);
+            return;
+        }
+
+        if(nMissing == 0)
+        {
+            LogPrintf("mnlist - Masternode list in sync with %s\n", pfrom->addr.ToString().c_str());
+            return;
+        }
+
+        for(unsigned int i = 0; i < vBatch.size(); i++)
+            ProcessEntry(pfrom, vBatch[i], nMissing, i);
+
+        if(fDebug) LogPrintf("mnlist - Got %u of %d Masternode entries from %s\n", vBatch.size(), nMissing, pfrom->addr.ToString().c_str());
     }
 
 }
@@ -914,8 +1173,10 @@ void CMasternodeMan::Remove(CTxIn vin)
         if((*it).vin == vin){
             if(fDebug) LogPrintf("CMasternodeMan: Removing Masternode %s - %i now\n", (*it).addr.ToString().c_str(), size() - 1);
             vMasternodes.erase(it);
+            fByInputAgeDirty = true;
             break;
         }
+        ++it;
     }
 }
 
@@ -18,6 +18,9 @@
 
 #define MASTERNODES_DUMP_SECONDS               (15*60)
 #define MASTERNODES_DSEG_SECONDS               (3*60*60)
+#define MASTERNODES_LIST_BATCH_SIZE            250 // entries per mnlist message
+#define MASTERNODES_SYNC_MARGIN                1000 // short ids a mnlistreq may hold beyond our list size
+#define MASTERNODES_CACHE_VERSION              1   // mncache.dat format, stored after the magic numbers
 
 using namespace std;
 
@@ -41,14 +44,23 @@ public:
         IncorrectHash,
         IncorrectMagicMessage,
         IncorrectMagicNumber,
-        IncorrectFormat
+        IncorrectFormat,
+        IncorrectVersion
     };
 
     CMasternodeDB();
+    /// Serialize the manager into the contents of mncache.dat: header, data and checksum
+    void Snapshot(const CMasternodeMan &mnodemanToSave, CDataStream &ssMasternodes);
+    /// Write a snapshot, replacing the file only once it is complete
+    bool Write(const CDataStream &ssMasternodes);
     bool Write(const CMasternodeMan &mnodemanToSave);
     ReadResult Read(CMasternodeMan& mnodemanToLoad);
 };
 
+/** Snapshot the manager and leave writing it to ThreadMasternodeCacheWriter */
+void DumpMasternodesAsync();
+void ThreadMasternodeCacheWriter();
+
 class CMasternodeMan
 {
 private:
@@ -63,6 +75,15 @@ private:
     std::map<CNetAddr, int64_t> mWeAskedForMasternodeList;
     // which Masternodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForMasternodeListEntry;
+    // Masternodes by input age, oldest first. Points into vMasternodes, so
+    // every change to the vector has to mark it for a rebuild
+    std::vector<CMasternode*> vecByInputAge;
+    bool fByInputAgeDirty;
+
+    void UpdateInputAgeIndex();
+
+    /// Validate a dsee or mnlist entry and add it or update the existing one
+    void ProcessEntry(CNode* pfrom, CMasternodeListEntry& entry, int count, int current);
 
 public:
     // keep track of dsq count to prevent masternodes from gaming darksend queue
@@ -82,6 +103,7 @@ public:
                 READWRITE(mWeAskedForMasternodeList);
                 READWRITE(mWeAskedForMasternodeListEntry);
                 READWRITE(nDsqCount);
+                if(fRead) const_cast<CMasternodeMan*>(this)->fByInputAgeDirty = true;
         }
     )
 
@@ -97,6 +119,9 @@ public:
     /// Check all Masternodes and remove inactive
     void CheckAndRemove();
 
+    /// Remove Masternodes not seen for too long, without checking their inputs
+    void RemoveStale();
+
     /// Clear Masternode vector
     void Clear();
 
@@ -106,12 +131,18 @@ public:
 
     void DsegUpdate(CNode* pnode);
 
+    /// The entries we serve to peers (enabled, routable), sorted by outpoint, and their hashes
+    void GetListEntries(std::vector<CMasternodeListEntry>& vEntries, std::vector<uint256>& vHashes);
+
+    /// Identifies a list snapshot by the hashes of its entries
+    static uint256 GetListHash(const std::vector<uint256>& vHashes);
+
     /// Find an entry
     CMasternode* Find(const CTxIn& vin);
     CMasternode* Find(const CPubKey& pubKeyMasternode);
 
-    /// Find an entry thta do not match every entry provided vector
-    CMasternode* FindOldestNotInVec(const std::vector<CTxIn> &vVins, int nMinimumAge, int nMinimumActiveSeconds);
+    /// Find the enabled entry with the oldest input that hasn't won a block at nPaidSinceHeight or later
+    CMasternode* FindOldestNotPaid(int nPaidSinceHeight, int nMinimumAge, int nMinimumActiveSeconds);
 
     /// Find a random entry
     CMasternode* FindRandom();
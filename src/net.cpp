@@ -412,6 +412,8 @@ uint64_t CNode::nTotalBytesRecv = 0;
 uint64_t CNode::nTotalBytesSent = 0;
 CCriticalSection CNode::cs_totalBytesRecv;
 CCriticalSection CNode::cs_totalBytesSent;
+CCriticalSection CNode::cs_totalMsgStats;
+MessageStatsMap CNode::mapTotalMsgStats;
 
 CNode* FindNode(const CNetAddr& ip)
 {
@@ -621,6 +623,11 @@ void CNode::copyStats(CNodeStats &stats)
 
     // Leave string empty if addrLocal invalid (not filled in yet)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
+
+    {
+        LOCK(cs_msgStats);
+        stats.mapMsgStats = mapMsgStats;
+    }
 }
 #undef X
 
@@ -1908,6 +1915,69 @@ uint64_t CNode::GetTotalBytesSent()
     return nTotalBytesSent;
 }
 
+static const char* ppszMessageStatsCommands[] = {
+    // Bitcoin protocol
+    "version", "verack", "addr", "getaddr", "inv", "getdata", "notfound",
+    "getblocks", "getheaders", "headers", "block", "merkleblock", "tx",
+    "mempool", "ping", "pong", "alert", "reject",
+    "filterload", "filteradd", "filterclear",
+    "sendcmpct", "cmpctblock", "getblocktxn", "blocktxn",
+    // Masternodes, payments and sporks
+    "dsee", "dseep", "dseg", "mnlistreq", "mnlist", "mnget", "mnw", "mnse", "mvote",
+    "spork", "getsporks",
+    // Darksend
+    "dsa", "dsc", "dsf", "dsi", "dsq", "dsr", "dss", "dssu", "dstx",
+    // InstantX
+    "txlreq", "txlvote",
+};
+static const std::set<std::string> setMessageStatsCommands(ppszMessageStatsCommands,
+    ppszMessageStatsCommands + ARRAYLEN(ppszMessageStatsCommands));
+
+std::string MessageStatsBucket(const std::string& strCommand)
+{
+    if (setMessageStatsCommands.count(strCommand))
+        return strCommand;
+    return "other";
+}
+
+void CNode::RecordMessageSent(const std::string& strCommand, uint64_t nBytes)
+{
+    std::string strBucket = MessageStatsBucket(strCommand);
+    {
+        LOCK(cs_msgStats);
+        CMessageStats& stats = mapMsgStats[strBucket];
+        stats.nMsgsSent++;
+        stats.nBytesSent += nBytes;
+    }
+    LOCK(cs_totalMsgStats);
+    CMessageStats& stats = mapTotalMsgStats[strBucket];
+    stats.nMsgsSent++;
+    stats.nBytesSent += nBytes;
+}
+
+void CNode::RecordMessageRecv(const std::string& strCommand, uint64_t nBytes, int64_t nProcessMicros)
+{
+    std::string strBucket = MessageStatsBucket(strCommand);
+    {
+        LOCK(cs_msgStats);
+        CMessageStats& stats = mapMsgStats[strBucket];
+        stats.nMsgsRecv++;
+        stats.nBytesRecv += nBytes;
+        stats.nProcessMicros += nProcessMicros;
+    }
+    LOCK(cs_totalMsgStats);
+    CMessageStats& stats = mapTotalMsgStats[strBucket];
+    stats.nMsgsRecv++;
+    stats.nBytesRecv += nBytes;
+    stats.nProcessMicros += nProcessMicros;
+}
+
+void CNode::GetTotalMessageStats(MessageStatsMap& mapStats)
+{
+    LOCK(cs_totalMsgStats);
+    mapStats = mapTotalMsgStats;
+}
+
 void CNode::Fuzz(int nChance)
 {
     if (!fSuccessfullyConnected) return; // Don't fuzz initial handshake
@@ -19,6 +19,7 @@
 #include "util.h"
 #include "core.h"
 
+#include <algorithm>
 #include <deque>
 #include <stdint.h>
 
@@ -130,6 +131,26 @@ struct LocalServiceInfo {
 extern CCriticalSection cs_mapLocalHost;
 extern map<CNetAddr, LocalServiceInfo> mapLocalHost;
 
+/** Traffic and handler time for one message command */
+class CMessageStats
+{
+public:
+    uint64_t nMsgsSent;
+    uint64_t nBytesSent;
+    uint64_t nMsgsRecv;
+    uint64_t nBytesRecv;
+    int64_t nProcessMicros; // time spent in ProcessMessage
+
+    CMessageStats() : nMsgsSent(0), nBytesSent(0), nMsgsRecv(0), nBytesRecv(0), nProcessMicros(0) {}
+};
+
+/** Per command statistics, keyed by MessageStatsBucket() */
+typedef std::map<std::string, CMessageStats> MessageStatsMap;
+
+/** Commands we know share buckets named after them, anything else that a
+ *  peer makes up is counted under "other" so it cannot grow the map */
+std::string MessageStatsBucket(const std::string& strCommand);
+
 class CNodeStats
 {
 public:
@@ -149,6 +170,7 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    MessageStatsMap mapMsgStats;
 };
 
 
@@ -237,6 +259,8 @@ public:
     // b) the peer may tell us in their version message that we should not relay tx invs
     //    until they have initialized their bloom filter.
     bool fRelayTxes;
+    // the peer sent sendcmpct: request new blocks from it as cmpctblock
+    bool fCompactBlocks;
     bool fDarkSendMaster;
     CSemaphoreGrant grantOutbound;
     CCriticalSection cs_filter;
@@ -255,6 +279,10 @@ protected:
     // Basic fuzz-testing
     void Fuzz(int nChance); // modifies ssSend
 
+    // Per command traffic, see RecordMessageSent/RecordMessageRecv
+    MessageStatsMap mapMsgStats;
+    CCriticalSection cs_msgStats;
+
 public:
     uint256 hashContinue;
     CBlockIndex* pindexLastGetBlocksBegin;
@@ -311,6 +339,7 @@ public:
         fStartSync = false;
         fGetAddr = false;
         fRelayTxes = false;
+        fCompactBlocks = false;
         setInventoryKnown.max_size(SendBufferSize() / 1000);
         pfilter = new CBloomFilter();
         nPingNonceSent = 0;
@@ -348,6 +377,8 @@ private:
     static CCriticalSection cs_totalBytesSent;
     static uint64_t nTotalBytesRecv;
     static uint64_t nTotalBytesSent;
+    static CCriticalSection cs_totalMsgStats;
+    static MessageStatsMap mapTotalMsgStats;
 
     CCriticalSection cs_nRefCount;
 
@@ -522,6 +553,9 @@ public:
 
         LogPrint("net", "(%d bytes)\n", nSize);
 
+        const char* pchCommand = (const char*)&ssSend[MESSAGE_START_SIZE];
+        RecordMessageSent(std::string(pchCommand, std::find(pchCommand, pchCommand + CMessageHeader::COMMAND_SIZE, '\0')), ssSend.size());
+
         std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
         ssSend.GetAndClear(*it);
         nSendSize += (*it).size();
@@ -789,6 +823,11 @@ public:
 
     static uint64_t GetTotalBytesRecv();
     static uint64_t GetTotalBytesSent();
+
+    // Per command stats, recorded for this node and for the totals
+    void RecordMessageSent(const std::string& strCommand, uint64_t nBytes);
+    void RecordMessageRecv(const std::string& strCommand, uint64_t nBytes, int64_t nProcessMicros);
+    static void GetTotalMessageStats(MessageStatsMap& mapStats);
 };
 
 
@@ -22,7 +22,7 @@ static const char* ppszTypeName[] =
     "spork",
     "masternode winner",
     "unknown",
-    "unknown",
+    "compact block",
     "unknown",
     "unknown",
     "unknown",
@@ -139,7 +139,9 @@ enum
     MSG_TXLOCK_VOTE,
     MSG_SPORK,
     MSG_MASTERNODE_WINNER,
-    MSG_MASTERNODE_SCANNING_ERROR
+    MSG_MASTERNODE_SCANNING_ERROR,
+    // Like MSG_FILTERED_BLOCK, only for getdata, answered with a cmpctblock.
+    MSG_CMPCT_BLOCK
 };
 
 #endif // __INCLUDED_PROTOCOL_H__
@@ -139,6 +139,7 @@ public:
 Value spork(const Array& params, bool fHelp)
 {
     if(params.size() == 1 && params[0].get_str() == "show"){
+        std::map<int, CSporkMessage> mapSporksActive = GetActiveSporks();
         std::map<int, CSporkMessage>::iterator it = mapSporksActive.begin();
 
         Object ret;
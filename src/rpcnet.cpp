@@ -70,6 +70,23 @@ static void CopyNodeStats(std::vector<CNodeStats>& vstats)
     }
 }
 
+static Object MessageStatsToJSON(const MessageStatsMap& mapStats)
+{
+    Object obj;
+    for (MessageStatsMap::const_iterator it = mapStats.begin(); it != mapStats.end(); ++it)
+    {
+        const CMessageStats& stats = it->second;
+        Object entry;
+        entry.push_back(Pair("msgssent", stats.nMsgsSent));
+        entry.push_back(Pair("bytessent", stats.nBytesSent));
+        entry.push_back(Pair("msgsrecv", stats.nMsgsRecv));
+        entry.push_back(Pair("bytesrecv", stats.nBytesRecv));
+        entry.push_back(Pair("processtime", ((double)stats.nProcessMicros) / 1e6));
+        obj.push_back(Pair(it->first, entry));
+    }
+    return obj;
+}
+
 Value getpeerinfo(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -95,6 +112,10 @@ Value getpeerinfo(const Array& params, bool fHelp)
             "    \"startingheight\": n,       (numeric) The starting height (block) of the peer\n"
             "    \"banscore\": n,              (numeric) The ban score (stats.nMisbehavior)\n"
             "    \"syncnode\" : true|false     (booleamn) if sync node\n"
+            "    \"msgstats\": {             (object) Traffic per message command, see getnetmsgstats\n"
+            "      \"command\": { ... },\n"
+            "      ...\n"
+            "    }\n"
             "  }\n"
             "  ,...\n"
             "}\n"
@@ -136,6 +157,7 @@ Value getpeerinfo(const Array& params, bool fHelp)
             obj.push_back(Pair("banscore", statestats.nMisbehavior));
         }
         obj.push_back(Pair("syncnode", stats.fSyncNode));
+        obj.push_back(Pair("msgstats", MessageStatsToJSON(stats.mapMsgStats)));
 
         ret.push_back(obj);
     }
@@ -335,6 +357,34 @@ Value getnettotals(const Array& params, bool fHelp)
     return obj;
 }
 
+Value getnetmsgstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 0)
+        throw runtime_error(
+            "getnetmsgstats\n"
+            "\nReturns network traffic and processing time per message command, summed over\n"
+            "all peers since startup. Unknown commands are counted under \"other\".\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"command\": {           (object) The message command, such as \"dsee\"\n"
+            "    \"msgssent\": n,       (numeric) Messages sent\n"
+            "    \"bytessent\": n,      (numeric) Bytes sent, including headers\n"
+            "    \"msgsrecv\": n,       (numeric) Messages received and processed\n"
+            "    \"bytesrecv\": n,      (numeric) Bytes received, including headers\n"
+            "    \"processtime\": n     (numeric) Seconds spent processing received messages\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getnetmsgstats", "")
+            + HelpExampleRpc("getnetmsgstats", "")
+       );
+
+    MessageStatsMap mapStats;
+    CNode::GetTotalMessageStats(mapStats);
+    return MessageStatsToJSON(mapStats);
+}
+
 Value getnetworkinfo(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -80,6 +80,7 @@ string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
     else if (nStatus == HTTP_FORBIDDEN) cStatus = "Forbidden";
     else if (nStatus == HTTP_NOT_FOUND) cStatus = "Not Found";
     else if (nStatus == HTTP_INTERNAL_SERVER_ERROR) cStatus = "Internal Server Error";
+    else if (nStatus == HTTP_SERVICE_UNAVAILABLE) cStatus = "Service Unavailable";
     else cStatus = "";
     return strprintf(
             "HTTP/1.1 %d %s\r\n"
@@ -99,6 +100,24 @@ string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
         strMsg);
 }
 
+string HTTPReplyStreamHeader(int nStatus, bool keepalive, bool fChunked)
+{
+    return strprintf(
+            "HTTP/1.1 %d %s\r\n"
+            "Date: %s\r\n"
+            "Connection: %s\r\n"
+            "%s"
+            "Content-Type: application/json\r\n"
+            "Server: testinterzone-json-rpc/%s\r\n"
+            "\r\n",
+        nStatus,
+        nStatus == HTTP_OK ? "OK" : "",
+        rfc1123Time(),
+        (keepalive && fChunked) ? "keep-alive" : "close",
+        fChunked ? "Transfer-Encoding: chunked\r\n" : "",
+        FormatFullVersion());
+}
+
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
                          string& http_method, string& http_uri)
 {
@@ -195,6 +214,32 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
         stream.read(&vch[0], nLen);
         strMessageRet = string(vch.begin(), vch.end());
     }
+    else if (mapHeadersRet.count("transfer-encoding") && mapHeadersRet["transfer-encoding"] == "chunked")
+    {
+        // Streamed reply: "<hex size>\r\n<data>\r\n" chunks up to a zero-size chunk
+        while (true)
+        {
+            string strSize;
+            std::getline(stream, strSize);
+            long nChunk = strtol(strSize.c_str(), NULL, 16);
+            if (!stream.good() || nChunk <= 0)
+                break;
+            if (strMessageRet.size() + nChunk > MAX_SIZE)
+                return HTTP_INTERNAL_SERVER_ERROR;
+            vector<char> vch(nChunk);
+            stream.read(&vch[0], nChunk);
+            strMessageRet.append(vch.begin(), vch.end());
+            std::getline(stream, strSize);
+        }
+        // Skip the (empty) trailer
+        while (stream.good())
+        {
+            string str;
+            std::getline(stream, str);
+            if (str.empty() || str == "\r")
+                break;
+        }
+    }
 
     string sConHdr = mapHeadersRet["connection"];
 
@@ -209,6 +254,175 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
     return HTTP_OK;
 }
 
+// Upper bound on the request line plus headers, so a client cannot grow the
+// receive buffer without ever finishing its header block
+static const size_t MAX_HTTP_HEADERS_SIZE = 64 * 1024;
+
+HTTPParseResult ParseHTTPRequest(const char* pbegin, const char* pend, HTTPRequest& req, size_t& nConsumedRet)
+{
+    nConsumedRet = 0;
+
+    // Collect lines up to the empty line that terminates the header block
+    vector<string> vLines;
+    const char* p = pbegin;
+    while (true)
+    {
+        const char* pnl = (p < pend) ? (const char*)memchr(p, '\n', pend - p) : NULL;
+        if (pnl == NULL)
+            return (size_t)(pend - pbegin) > MAX_HTTP_HEADERS_SIZE ? HTTP_PARSE_INVALID : HTTP_PARSE_INCOMPLETE;
+        const char* peol = (pnl > p && *(pnl - 1) == '\r') ? pnl - 1 : pnl;
+        string strLine(p, peol);
+        p = pnl + 1;
+        if (strLine.empty())
+            break;
+        vLines.push_back(strLine);
+    }
+    if (vLines.empty())
+        return HTTP_PARSE_INVALID;
+
+    // Request line: same rules as ReadHTTPRequestLine
+    vector<string> vWords;
+    boost::split(vWords, vLines[0], boost::is_any_of(" "));
+    if (vWords.size() < 2)
+        return HTTP_PARSE_INVALID;
+    req.strMethod = vWords[0];
+    if (req.strMethod != "GET" && req.strMethod != "POST")
+        return HTTP_PARSE_INVALID;
+    req.strURI = vWords[1];
+    if (req.strURI.size() == 0 || req.strURI[0] != '/')
+        return HTTP_PARSE_INVALID;
+    req.nProto = 0;
+    if (vWords.size() > 2)
+    {
+        const char *ver = strstr(vWords[2].c_str(), "HTTP/1.");
+        if (ver != NULL)
+            req.nProto = atoi(ver+7);
+    }
+
+    // Headers: same rules as ReadHTTPHeaders
+    int nLen = 0;
+    req.mapHeaders.clear();
+    for (unsigned int i = 1; i < vLines.size(); i++)
+    {
+        const string& str = vLines[i];
+        string::size_type nColon = str.find(":");
+        if (nColon == string::npos)
+            continue;
+        string strHeader = str.substr(0, nColon);
+        boost::trim(strHeader);
+        boost::to_lower(strHeader);
+        string strValue = str.substr(nColon+1);
+        boost::trim(strValue);
+        req.mapHeaders[strHeader] = strValue;
+        if (strHeader == "content-length")
+            nLen = atoi(strValue.c_str());
+    }
+    if (nLen < 0 || nLen > (int)MAX_SIZE)
+        return HTTP_PARSE_INVALID;
+
+    // Body
+    if ((size_t)(pend - p) < (size_t)nLen)
+        return HTTP_PARSE_INCOMPLETE;
+    req.strBody.assign(p, p + nLen);
+    p += nLen;
+
+    string sConHdr = req.mapHeaders["connection"];
+    if ((sConHdr != "close") && (sConHdr != "keep-alive"))
+        req.mapHeaders["connection"] = (req.nProto >= 1) ? "keep-alive" : "close";
+
+    nConsumedRet = p - pbegin;
+    return HTTP_PARSE_COMPLETE;
+}
+
+CJSONStreamWriter::CJSONStreamWriter(const Sink& sinkIn, size_t nFlushSizeIn) :
+    sink(sinkIn), nFlushSize(nFlushSizeIn), fAfterKey(false), fFlushed(false)
+{
+    strBuf.reserve(nFlushSize + 4096);
+}
+
+void CJSONStreamWriter::Separator()
+{
+    if (fAfterKey)
+    {
+        fAfterKey = false;
+        return;
+    }
+    if (!vFirst.empty())
+    {
+        if (!vFirst.back())
+            strBuf += ',';
+        vFirst.back() = false;
+    }
+}
+
+void CJSONStreamWriter::MaybeFlush()
+{
+    if (strBuf.size() >= nFlushSize)
+        Flush();
+}
+
+void CJSONStreamWriter::BeginObject()
+{
+    Separator();
+    strBuf += '{';
+    vFirst.push_back(true);
+}
+
+void CJSONStreamWriter::EndObject()
+{
+    assert(!vFirst.empty() && !fAfterKey);
+    vFirst.pop_back();
+    strBuf += '}';
+    MaybeFlush();
+}
+
+void CJSONStreamWriter::BeginArray()
+{
+    Separator();
+    strBuf += '[';
+    vFirst.push_back(true);
+}
+
+void CJSONStreamWriter::EndArray()
+{
+    assert(!vFirst.empty() && !fAfterKey);
+    vFirst.pop_back();
+    strBuf += ']';
+    MaybeFlush();
+}
+
+void CJSONStreamWriter::Key(const string& strKey)
+{
+    Separator();
+    // Same escaping as json_spirit's Generator
+    strBuf += '"';
+    strBuf += add_esc_chars(strKey);
+    strBuf += "\":";
+    fAfterKey = true;
+}
+
+void CJSONStreamWriter::Write(const Value& value)
+{
+    Separator();
+    strBuf += write_string(value, false);
+    MaybeFlush();
+}
+
+void CJSONStreamWriter::WritePair(const Pair& pair)
+{
+    Key(pair.name_);
+    Write(pair.value_);
+}
+
+void CJSONStreamWriter::Flush()
+{
+    if (strBuf.empty())
+        return;
+    sink(strBuf);
+    fFlushed = true;
+    strBuf.clear();
+}
+
 //
 // JSON-RPC protocol.  testInterzone speaks version 1.0 for maximum compatibility,
 // but uses JSON-RPC 1.1/2.0 standards for parts of the 1.0 standard that were
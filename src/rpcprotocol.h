@@ -10,6 +10,8 @@
 #include <map>
 #include <stdint.h>
 #include <string>
+#include <vector>
+#include <boost/function.hpp>
 #include <boost/iostreams/concepts.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/asio.hpp>
@@ -28,6 +30,7 @@ enum HTTPStatusCode
     HTTP_FORBIDDEN             = 403,
     HTTP_NOT_FOUND             = 404,
     HTTP_INTERNAL_SERVER_ERROR = 500,
+    HTTP_SERVICE_UNAVAILABLE   = 503,
 };
 
 // testInterzone RPC error codes
@@ -124,14 +127,85 @@ private:
     boost::asio::ssl::stream<typename Protocol::socket>& stream;
 };
 
+/**
+ * Incremental JSON writer for replies too large to build as one Value tree.
+ * Produces exactly the compact output of json_spirit::write_string(value, false),
+ * handing it to the sink in pieces of roughly nFlushSize bytes.
+ */
+class CJSONStreamWriter
+{
+public:
+    typedef boost::function<void(const std::string&)> Sink;
+
+    CJSONStreamWriter(const Sink& sinkIn, size_t nFlushSizeIn = 64 * 1024);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    /** Start an object member; the next Write/Begin* call is its value */
+    void Key(const std::string& strKey);
+    /** Write a complete value as an array element or as the value of the last Key */
+    void Write(const json_spirit::Value& value);
+    void WritePair(const json_spirit::Pair& pair);
+    /** Hand everything buffered so far to the sink */
+    void Flush();
+    /** True once any output has reached the sink */
+    bool HasFlushed() const { return fFlushed; }
+
+private:
+    Sink sink;
+    size_t nFlushSize;
+    std::string strBuf;
+    // One entry per open object/array: true until its first element is written
+    std::vector<bool> vFirst;
+    bool fAfterKey;
+    bool fFlushed;
+
+    void Separator();
+    void MaybeFlush();
+};
+
 std::string HTTPPost(const std::string& strMsg, const std::map<std::string,std::string>& mapRequestHeaders);
 std::string HTTPReply(int nStatus, const std::string& strMsg, bool keepalive);
+/**
+ * Headers for a reply whose body is streamed. With fChunked the body must be sent
+ * with chunked transfer encoding, otherwise it is delimited by closing the connection.
+ */
+std::string HTTPReplyStreamHeader(int nStatus, bool keepalive, bool fChunked);
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
                          std::string& http_method, std::string& http_uri);
 int ReadHTTPStatus(std::basic_istream<char>& stream, int &proto);
 int ReadHTTPHeaders(std::basic_istream<char>& stream, std::map<std::string, std::string>& mapHeadersRet);
 int ReadHTTPMessage(std::basic_istream<char>& stream, std::map<std::string, std::string>& mapHeadersRet,
                     std::string& strMessageRet, int nProto);
+
+// Result of parsing one HTTP request out of a receive buffer
+enum HTTPParseResult
+{
+    HTTP_PARSE_INCOMPLETE,
+    HTTP_PARSE_COMPLETE,
+    HTTP_PARSE_INVALID,
+};
+
+/** A single HTTP request, as parsed from a raw receive buffer */
+struct HTTPRequest
+{
+    int nProto;
+    std::string strMethod;
+    std::string strURI;
+    std::map<std::string, std::string> mapHeaders;
+    std::string strBody;
+
+    HTTPRequest() : nProto(0) {}
+};
+
+/**
+ * Parse one HTTP request from [pbegin, pend) without going through an iostream.
+ * On HTTP_PARSE_COMPLETE nConsumedRet is set to the number of bytes the request
+ * occupied, so any pipelined requests behind it stay in the buffer.
+ */
+HTTPParseResult ParseHTTPRequest(const char* pbegin, const char* pend, HTTPRequest& req, size_t& nConsumedRet);
 std::string JSONRPCRequest(const std::string& strMethod, const json_spirit::Array& params, const json_spirit::Value& id);
 json_spirit::Object JSONRPCReplyObj(const json_spirit::Value& result, const json_spirit::Value& error, const json_spirit::Value& id);
 std::string JSONRPCReply(const json_spirit::Value& result, const json_spirit::Value& error, const json_spirit::Value& id);
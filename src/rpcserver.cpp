@@ -8,22 +8,30 @@
 
 #include "base58.h"
 #include "init.h"
+#include "jsonreader.h"
 #include "main.h"
+#include "trace.h"
 #include "ui_interface.h"
 #include "util.h"
 #ifdef ENABLE_WALLET
 #include "wallet.h"
 #endif
 
+#include <deque>
+
 #include <boost/algorithm/string.hpp>
+#include <boost/array.hpp>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
 #include <boost/iostreams/concepts.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
 #include "json/json_spirit_writer_template.h"
 
 using namespace std;
@@ -41,6 +49,68 @@ static boost::thread_group* rpc_worker_group = NULL;
 static boost::asio::io_service::work *rpc_dummy_work = NULL;
 static std::vector< boost::shared_ptr<ip::tcp::acceptor> > rpc_acceptors;
 
+// Request handlers run on their own pool so that a slow call never stalls
+// reading, parsing or answering other connections
+static asio::io_service* rpc_handler_service = NULL;
+static boost::asio::io_service::work *rpc_handler_work = NULL;
+static boost::thread_group* rpc_handler_group = NULL;
+static CCriticalSection cs_rpcWorkQueue;
+static int nRPCWorkQueueDepth = 0;
+static int nRPCWorkQueueMax = 0;
+static int nRPCHandlerThreads = 0;
+
+/** Per-method call statistics, reported by getrpcstats */
+class CRPCMethodStats
+{
+public:
+    // Latency percentiles are computed over the most recent calls only
+    static const unsigned int SAMPLE_WINDOW = 1024;
+
+    uint64_t nCalls;
+    uint64_t nErrors;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+    int64_t nLockWaitMicros;
+    std::vector<int64_t> vSamples;
+    unsigned int nNextSample;
+
+    CRPCMethodStats() : nCalls(0), nErrors(0), nTotalMicros(0), nMaxMicros(0), nLockWaitMicros(0), nNextSample(0) {}
+
+    void Record(int64_t nMicros, int64_t nLockWait, bool fError)
+    {
+        nCalls++;
+        if (fError)
+            nErrors++;
+        nTotalMicros += nMicros;
+        nLockWaitMicros += nLockWait;
+        nMaxMicros = std::max(nMaxMicros, nMicros);
+        if (vSamples.size() < SAMPLE_WINDOW)
+            vSamples.push_back(nMicros);
+        else
+            vSamples[nNextSample] = nMicros;
+        nNextSample = (nNextSample + 1) % SAMPLE_WINDOW;
+    }
+
+    int64_t Percentile(int nPercent) const
+    {
+        if (vSamples.empty())
+            return 0;
+        std::vector<int64_t> vSorted(vSamples);
+        unsigned int n = (vSorted.size() - 1) * nPercent / 100;
+        std::nth_element(vSorted.begin(), vSorted.begin() + n, vSorted.end());
+        return vSorted[n];
+    }
+};
+
+static CCriticalSection cs_rpcStats;
+static std::map<std::string, CRPCMethodStats> mapRPCStats;
+
+static void RecordRPCCall(const std::string& strMethod, int64_t nMicros, int64_t nLockWait, bool fError)
+{
+    LOCK(cs_rpcStats);
+    mapRPCStats[strMethod].Record(nMicros, nLockWait, fError);
+}
+
 void RPCTypeCheck(const Array& params,
                   const list<Value_type>& typesExpected,
                   bool fAllowNull)
@@ -214,6 +284,217 @@ Value stop(const Array& params, bool fHelp)
     return "testInterzone server stopping";
 }
 
+Value getrpcstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getrpcstats ( reset )\n"
+            "\nReturns RPC server work queue state and per-method call statistics.\n"
+            "\nArguments:\n"
+            "1. reset     (boolean, optional, default=false) Clear the method statistics after reporting them\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"workqueue\": {\n"
+            "    \"depth\": n,          (numeric) Requests queued or executing\n"
+            "    \"maxdepth\": n,       (numeric) Queue depth above which requests are refused\n"
+            "    \"threads\": n         (numeric) Number of handler threads\n"
+            "  },\n"
+            "  \"methods\": {\n"
+            "    \"method\": {\n"
+            "      \"calls\": n,               (numeric) Number of calls\n"
+            "      \"errors\": n,              (numeric) Number of calls that returned an error\n"
+            "      \"totalmicros\": n,         (numeric) Total execution time in microseconds\n"
+            "      \"p50micros\": n,           (numeric) Median latency over the last 1024 calls\n"
+            "      \"p99micros\": n,           (numeric) 99th percentile latency over the last 1024 calls\n"
+            "      \"maxmicros\": n,           (numeric) Slowest call\n"
+            "      \"lockwaitmicros\": n       (numeric) Total time spent waiting for cs_main/cs_wallet\n"
+            "    }, ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpcstats", "")
+            + HelpExampleRpc("getrpcstats", "")
+        );
+
+    bool fReset = false;
+    if (params.size() > 0)
+        fReset = params[0].get_bool();
+
+    Object queue;
+    {
+        LOCK(cs_rpcWorkQueue);
+        queue.push_back(Pair("depth", nRPCWorkQueueDepth));
+        queue.push_back(Pair("maxdepth", nRPCWorkQueueMax));
+        queue.push_back(Pair("threads", nRPCHandlerThreads));
+    }
+
+    Object methods;
+    {
+        LOCK(cs_rpcStats);
+        BOOST_FOREACH(const PAIRTYPE(string, CRPCMethodStats)& item, mapRPCStats)
+        {
+            const CRPCMethodStats& stats = item.second;
+            Object entry;
+            entry.push_back(Pair("calls", (uint64_t)stats.nCalls));
+            entry.push_back(Pair("errors", (uint64_t)stats.nErrors));
+            entry.push_back(Pair("totalmicros", stats.nTotalMicros));
+            entry.push_back(Pair("p50micros", stats.Percentile(50)));
+            entry.push_back(Pair("p99micros", stats.Percentile(99)));
+            entry.push_back(Pair("maxmicros", stats.nMaxMicros));
+            entry.push_back(Pair("lockwaitmicros", stats.nLockWaitMicros));
+            methods.push_back(Pair(item.first, entry));
+        }
+        if (fReset)
+            mapRPCStats.clear();
+    }
+
+    Object ret;
+    ret.push_back(Pair("workqueue", queue));
+    ret.push_back(Pair("methods", methods));
+    return ret;
+}
+
+static bool CompareLockWait(const CLockSiteStats& a, const CLockSiteStats& b)
+{
+    return a.nWaitMicros > b.nWaitMicros;
+}
+
+static Object LockStatsToJSON(const CLockSiteStats& stats)
+{
+    Object entry;
+    entry.push_back(Pair("contended", (uint64_t)stats.nContended));
+    entry.push_back(Pair("waitmicros", stats.nWaitMicros));
+    entry.push_back(Pair("maxwaitmicros", stats.nMaxWaitMicros));
+    entry.push_back(Pair("sampled", (uint64_t)stats.nSampled));
+    entry.push_back(Pair("acquisitions", (uint64_t)(stats.nSampled * nLockStatsSampleRate)));
+    entry.push_back(Pair("avgholdmicros", stats.nSampled ? stats.nHoldMicros / (int64_t)stats.nSampled : 0));
+    entry.push_back(Pair("maxholdmicros", stats.nMaxHoldMicros));
+    return entry;
+}
+
+Value getlockstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getlockstats ( reset )\n"
+            "\nReturns lock contention statistics collected with -lockstats=<n>, per lock and per\n"
+            "acquisition site. Every wait for a lock is counted; hold times come from one in n acquisitions.\n"
+            "\nArguments:\n"
+            "1. reset     (boolean, optional, default=false) Clear the statistics after reporting them\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"enabled\": true|false,  (boolean) Whether the profiler is running\n"
+            "  \"samplerate\": n,        (numeric) One in this many acquisitions is timed for hold time\n"
+            "  \"locks\": {\n"
+            "    \"name\": {             (string) The locked expression, e.g. cs_main\n"
+            "      \"contended\": n,          (numeric) Acquisitions that had to wait\n"
+            "      \"waitmicros\": n,         (numeric) Total time spent waiting\n"
+            "      \"maxwaitmicros\": n,      (numeric) Longest wait\n"
+            "      \"sampled\": n,            (numeric) Acquisitions timed for hold time\n"
+            "      \"acquisitions\": n,       (numeric) Estimated acquisitions, sampled times samplerate\n"
+            "      \"avgholdmicros\": n,      (numeric) Average hold time of the sampled acquisitions\n"
+            "      \"maxholdmicros\": n       (numeric) Longest sampled hold\n"
+            "    }, ...\n"
+            "  },\n"
+            "  \"sites\": [             (array) Per acquisition site, most waited on first\n"
+            "    {\n"
+            "      \"lock\": \"name\",         (string) The locked expression\n"
+            "      \"site\": \"file:line\",    (string) Where it is locked\n"
+            "      ...                     Same fields as above\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getlockstats", "")
+            + HelpExampleRpc("getlockstats", "")
+        );
+
+    bool fReset = false;
+    if (params.size() > 0)
+        fReset = params[0].get_bool();
+
+    std::vector<CLockSiteStats> vStats;
+    GetLockStats(vStats, fReset);
+    std::sort(vStats.begin(), vStats.end(), CompareLockWait);
+
+    std::map<std::string, CLockSiteStats> mapLocks;
+    Array sites;
+    BOOST_FOREACH(const CLockSiteStats& stats, vStats)
+    {
+        CLockSiteStats& total = mapLocks[stats.strName];
+        total.nContended += stats.nContended;
+        total.nWaitMicros += stats.nWaitMicros;
+        total.nMaxWaitMicros = std::max(total.nMaxWaitMicros, stats.nMaxWaitMicros);
+        total.nSampled += stats.nSampled;
+        total.nHoldMicros += stats.nHoldMicros;
+        total.nMaxHoldMicros = std::max(total.nMaxHoldMicros, stats.nMaxHoldMicros);
+
+        Object entry;
+        entry.push_back(Pair("lock", stats.strName));
+        entry.push_back(Pair("site", strprintf("%s:%d", stats.strFile, stats.nLine)));
+        Object fields = LockStatsToJSON(stats);
+        entry.insert(entry.end(), fields.begin(), fields.end());
+        sites.push_back(entry);
+    }
+
+    Object locks;
+    BOOST_FOREACH(const PAIRTYPE(string, CLockSiteStats)& item, mapLocks)
+        locks.push_back(Pair(item.first, LockStatsToJSON(item.second)));
+
+    Object ret;
+    ret.push_back(Pair("enabled", (bool)fLockStats));
+    ret.push_back(Pair("samplerate", (uint64_t)nLockStatsSampleRate));
+    ret.push_back(Pair("locks", locks));
+    ret.push_back(Pair("sites", sites));
+    return ret;
+}
+
+Value tracecapture(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2 ||
+        (params[0].get_str() != "start" && params[0].get_str() != "stop"))
+        throw runtime_error(
+            "tracecapture \"start|stop\" ( \"filename\" )\n"
+            "\nStarts recording timing spans of message processing, block connection, mining,\n"
+            "mempool acceptance, Darksend and masternode messages and wallet sync, or stops\n"
+            "recording and writes them as a Chrome trace event file (chrome://tracing, Perfetto).\n"
+            "Each thread keeps its most recent 16384 spans.\n"
+            "\nArguments:\n"
+            "1. \"start|stop\"  (string, required) Start a new capture, or stop and write the current one\n"
+            "2. \"filename\"    (string, optional, default=\"trace.json\") Output file for stop, relative to the data directory\n"
+            "\nResult (stop):\n"
+            "{\n"
+            "  \"file\": \"path\",   (string) The file written\n"
+            "  \"events\": n,      (numeric) Spans written\n"
+            "  \"dropped\": n      (numeric) Spans overwritten because a thread's buffer wrapped\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("tracecapture", "start")
+            + HelpExampleCli("tracecapture", "stop \"slowblock.json\"")
+            + HelpExampleRpc("tracecapture", "\"stop\"")
+        );
+
+    if (params[0].get_str() == "start")
+    {
+        StartTraceCapture();
+        return Value::null;
+    }
+
+    boost::filesystem::path path(params.size() > 1 ? params[1].get_str() : "trace.json");
+    if (!path.is_complete())
+        path = GetDataDir() / path;
+
+    uint64_t nEvents, nDropped;
+    if (!StopTraceCapture(path.string(), nEvents, nDropped))
+        throw JSONRPCError(RPC_MISC_ERROR, strprintf("Could not write %s", path.string()));
+
+    Object ret;
+    ret.push_back(Pair("file", path.string()));
+    ret.push_back(Pair("events", nEvents));
+    ret.push_back(Pair("dropped", nDropped));
+    return ret;
+}
+
 
 
 //
@@ -229,6 +510,9 @@ static const CRPCCommand vRPCCommands[] =
     { "getinfo",                &getinfo,                true,      false,      false }, /* uses wallet if enabled */
     { "help",                   &help,                   true,      true,       false },
     { "stop",                   &stop,                   true,      true,       false },
+    { "getrpcstats",            &getrpcstats,            true,      true,       false },
+    { "getlockstats",           &getlockstats,           true,      true,       false },
+    { "tracecapture",           &tracecapture,           true,      true,       false },
 
     /* P2P networking */
     { "getnetworkinfo",         &getnetworkinfo,         true,      false,      false },
@@ -236,6 +520,7 @@ static const CRPCCommand vRPCCommands[] =
     { "getaddednodeinfo",       &getaddednodeinfo,       true,      true,       false },
     { "getconnectioncount",     &getconnectioncount,     true,      false,      false },
     { "getnettotals",           &getnettotals,           true,      true,       false },
+    { "getnetmsgstats",         &getnetmsgstats,         true,      true,       false },
     { "getpeerinfo",            &getpeerinfo,            true,      false,      false },
     { "ping",                   &ping,                   true,      false,      false },
 
@@ -327,6 +612,19 @@ static const CRPCCommand vRPCCommands[] =
 #endif // ENABLE_WALLET
 };
 
+// Commands whose replies can get large enough to be worth streaming to
+// the client instead of building the whole reply in memory first
+static const CRPCStreamCommand vRPCStreamCommands[] =
+{ //  name                      actor (function)
+  //  ------------------------  -----------------------
+    { "getblock",               &getblock_stream         },
+    { "getrawmempool",          &getrawmempool_stream    },
+    { "masternodelist",         &masternodelist_stream   },
+#ifdef ENABLE_WALLET
+    { "listunspent",            &listunspent_stream      },
+#endif // ENABLE_WALLET
+};
+
 CRPCTable::CRPCTable()
 {
     unsigned int vcidx;
@@ -337,6 +635,13 @@ CRPCTable::CRPCTable()
         pcmd = &vRPCCommands[vcidx];
         mapCommands[pcmd->name] = pcmd;
     }
+    for (vcidx = 0; vcidx < (sizeof(vRPCStreamCommands) / sizeof(vRPCStreamCommands[0])); vcidx++)
+    {
+        const CRPCStreamCommand *pcmd;
+
+        pcmd = &vRPCStreamCommands[vcidx];
+        mapStreamCommands[pcmd->name] = pcmd;
+    }
 }
 
 const CRPCCommand *CRPCTable::operator[](string name) const
@@ -358,15 +663,15 @@ bool HTTPAuthorized(map<string, string>& mapHeaders)
     return TimingResistantEqual(strUserPass, strRPCUserColonPass);
 }
 
-void ErrorReply(std::ostream& stream, const Object& objError, const Value& id)
+string ErrorReply(const Object& objError, const Value& id)
 {
-    // Send error reply from json-rpc error object
+    // Build error reply from json-rpc error object
     int nStatus = HTTP_INTERNAL_SERVER_ERROR;
     int code = find_value(objError, "code").get_int();
     if (code == RPC_INVALID_REQUEST) nStatus = HTTP_BAD_REQUEST;
     else if (code == RPC_METHOD_NOT_FOUND) nStatus = HTTP_NOT_FOUND;
     string strReply = JSONRPCReply(Value::null, objError, id);
-    stream << HTTPReply(nStatus, strReply, false) << std::flush;
+    return HTTPReply(nStatus, strReply, false);
 }
 
 bool ClientAllowed(const boost::asio::ip::address& address)
@@ -392,61 +697,268 @@ bool ClientAllowed(const boost::asio::ip::address& address)
     return false;
 }
 
-class AcceptedConnection
+/**
+ * An RPC client connection. Requests are read and parsed asynchronously on the
+ * network thread; handlers run on the worker pool and hand their reply back
+ * through SendReply.
+ */
+class RPCConnection
 {
 public:
-    virtual ~AcceptedConnection() {}
+    virtual ~RPCConnection() {}
 
-    virtual std::iostream& stream() = 0;
     virtual std::string peer_address_to_string() const = 0;
-    virtual void close() = 0;
+    /** Queue raw reply bytes. Safe to call from any thread; data goes out in call order. */
+    virtual void SendData(const std::string& strData) = 0;
+    /** Mark the current reply complete, then read the next request or close */
+    virtual void EndReply(bool fKeepAlive) = 0;
+    /** Drop the connection, e.g. when a streamed reply fails half way */
+    virtual void Abort() = 0;
+    /**
+     * Block a worker thread until at most nMaxBytes of queued reply data are
+     * unwritten. Returns false if the connection closed or the client read
+     * nothing for nTimeoutMillis. Must not be called on the network thread.
+     */
+    virtual bool WaitForSendSpace(size_t nMaxBytes, int64_t nTimeoutMillis) = 0;
+
+    /** Send a complete HTTP reply */
+    void SendReply(const std::string& strReply, bool fKeepAlive)
+    {
+        SendData(strReply);
+        EndReply(fKeepAlive);
+    }
 };
 
+static void RPCDispatchRequest(boost::shared_ptr<RPCConnection> conn, HTTPRequest& req);
+
 template <typename Protocol>
-class AcceptedConnectionImpl : public AcceptedConnection
+class RPCConnectionImpl : public RPCConnection, public boost::enable_shared_from_this< RPCConnectionImpl<Protocol> >
 {
 public:
-    AcceptedConnectionImpl(
+    RPCConnectionImpl(
             asio::io_service& io_service,
             ssl::context &context,
-            bool fUseSSL) :
+            bool fUseSSLIn) :
         sslStream(io_service, context),
-        _d(sslStream, fUseSSL),
-        _stream(_d)
+        fUseSSL(fUseSSLIn),
+        fWriting(false),
+        fReplyDone(false),
+        fReplyKeepAlive(false),
+        nUnsentBytes(0),
+        fClosed(false)
     {
     }
 
-    virtual std::iostream& stream()
+    virtual std::string peer_address_to_string() const
     {
-        return _stream;
+        return peer.address().to_string();
     }
 
-    virtual std::string peer_address_to_string() const
+    void Start()
     {
-        return peer.address().to_string();
+        if (fUseSSL)
+            sslStream.async_handshake(ssl::stream_base::server,
+                boost::bind(&RPCConnectionImpl::HandleHandshake, this->shared_from_this(), _1));
+        else
+            TryDispatch();
+    }
+
+    // Handlers finish on worker threads; all socket I/O stays on the network thread
+    virtual void SendData(const std::string& strData)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutexUnsent);
+            nUnsentBytes += strData.size();
+        }
+        sslStream.get_io_service().post(
+            boost::bind(&RPCConnectionImpl::QueueWrite, this->shared_from_this(), strData));
+    }
+
+    virtual void EndReply(bool fKeepAlive)
+    {
+        sslStream.get_io_service().post(
+            boost::bind(&RPCConnectionImpl::QueueEndReply, this->shared_from_this(), fKeepAlive));
+    }
+
+    virtual void Abort()
+    {
+        sslStream.get_io_service().post(
+            boost::bind(&RPCConnectionImpl::Close, this->shared_from_this()));
     }
 
-    virtual void close()
+    virtual bool WaitForSendSpace(size_t nMaxBytes, int64_t nTimeoutMillis)
     {
-        _stream.close();
+        boost::unique_lock<boost::mutex> lock(mutexUnsent);
+        int64_t nDeadline = GetTimeMillis() + nTimeoutMillis;
+        while (!fClosed && nUnsentBytes > nMaxBytes)
+        {
+            int64_t nWait = nDeadline - GetTimeMillis();
+            if (nWait <= 0)
+                return false;
+            size_t nBefore = nUnsentBytes;
+            condUnsent.timed_wait(lock, boost::posix_time::milliseconds(nWait));
+            // any progress restarts the timeout
+            if (nUnsentBytes < nBefore)
+                nDeadline = GetTimeMillis() + nTimeoutMillis;
+        }
+        return !fClosed;
+    }
+
+    void Close()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutexUnsent);
+            fClosed = true;
+        }
+        condUnsent.notify_all();
+        boost::system::error_code ec;
+        sslStream.lowest_layer().shutdown(ip::tcp::socket::shutdown_both, ec);
+        sslStream.lowest_layer().close(ec);
     }
 
     typename Protocol::endpoint peer;
     asio::ssl::stream<typename Protocol::socket> sslStream;
 
 private:
-    SSLIOStreamDevice<Protocol> _d;
-    iostreams::stream< SSLIOStreamDevice<Protocol> > _stream;
-};
+    bool fUseSSL;
+    boost::array<char, 8192> vchRead;
+    std::string strRecv;
+    std::deque<std::string> vSendQueue;
+    std::string strSend;
+    bool fWriting;
+    bool fReplyDone;
+    bool fReplyKeepAlive;
+    // Reply bytes handed to SendData and not yet written, for WaitForSendSpace
+    boost::mutex mutexUnsent;
+    boost::condition_variable condUnsent;
+    size_t nUnsentBytes;
+    bool fClosed;
+
+    void HandleHandshake(const boost::system::error_code& error)
+    {
+        if (error)
+            Close();
+        else
+            TryDispatch();
+    }
+
+    void ReadMore()
+    {
+        if (fUseSSL)
+            sslStream.async_read_some(asio::buffer(vchRead),
+                boost::bind(&RPCConnectionImpl::HandleRead, this->shared_from_this(), _1, _2));
+        else
+            sslStream.next_layer().async_read_some(asio::buffer(vchRead),
+                boost::bind(&RPCConnectionImpl::HandleRead, this->shared_from_this(), _1, _2));
+    }
+
+    void HandleRead(const boost::system::error_code& error, size_t nBytes)
+    {
+        if (error)
+        {
+            Close();
+            return;
+        }
+        strRecv.append(vchRead.data(), nBytes);
+        TryDispatch();
+    }
+
+    /** Handle the next complete request in the receive buffer, or read more. */
+    void TryDispatch()
+    {
+        if (ShutdownRequested())
+        {
+            Close();
+            return;
+        }
+
+        HTTPRequest req;
+        size_t nConsumed = 0;
+        HTTPParseResult ret = ParseHTTPRequest(strRecv.data(), strRecv.data() + strRecv.size(), req, nConsumed);
+        if (ret == HTTP_PARSE_INCOMPLETE)
+        {
+            ReadMore();
+            return;
+        }
+        if (ret == HTTP_PARSE_INVALID)
+        {
+            Close();
+            return;
+        }
+
+        // Pipelined requests stay buffered and are handled once this one is answered
+        strRecv.erase(0, nConsumed);
+        RPCDispatchRequest(this->shared_from_this(), req);
+    }
 
-void ServiceConnection(AcceptedConnection *conn);
+    void QueueWrite(const std::string& strData)
+    {
+        vSendQueue.push_back(strData);
+        if (!fWriting)
+            WriteNext();
+    }
+
+    void QueueEndReply(bool fKeepAlive)
+    {
+        fReplyDone = true;
+        fReplyKeepAlive = fKeepAlive;
+        if (!fWriting)
+            WriteNext();
+    }
+
+    void WriteNext()
+    {
+        if (vSendQueue.empty())
+        {
+            fWriting = false;
+            if (fReplyDone)
+            {
+                fReplyDone = false;
+                if (fReplyKeepAlive)
+                    TryDispatch();
+                else
+                    Close();
+            }
+            return;
+        }
+
+        fWriting = true;
+        strSend.swap(vSendQueue.front());
+        vSendQueue.pop_front();
+        if (fUseSSL)
+            asio::async_write(sslStream, asio::buffer(strSend),
+                boost::bind(&RPCConnectionImpl::HandleWrite, this->shared_from_this(), _1));
+        else
+            asio::async_write(sslStream.next_layer(), asio::buffer(strSend),
+                boost::bind(&RPCConnectionImpl::HandleWrite, this->shared_from_this(), _1));
+    }
+
+    void HandleWrite(const boost::system::error_code& error)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutexUnsent);
+            nUnsentBytes -= strSend.size();
+        }
+        condUnsent.notify_all();
+        strSend.clear();
+        if (error)
+        {
+            vSendQueue.clear();
+            fWriting = false;
+            fReplyDone = false;
+            Close();
+            return;
+        }
+        WriteNext();
+    }
+};
 
 // Forward declaration required for RPCListen
 template <typename Protocol, typename SocketAcceptorService>
 static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
                              ssl::context& context,
                              bool fUseSSL,
-                             boost::shared_ptr< AcceptedConnection > conn,
+                             boost::shared_ptr< RPCConnectionImpl<Protocol> > conn,
                              const boost::system::error_code& error);
 
 /**
@@ -458,7 +970,7 @@ static void RPCListen(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketA
                    const bool fUseSSL)
 {
     // Accept connection
-    boost::shared_ptr< AcceptedConnectionImpl<Protocol> > conn(new AcceptedConnectionImpl<Protocol>(acceptor->get_io_service(), context, fUseSSL));
+    boost::shared_ptr< RPCConnectionImpl<Protocol> > conn(new RPCConnectionImpl<Protocol>(acceptor->get_io_service(), context, fUseSSL));
 
     acceptor->async_accept(
             conn->sslStream.lowest_layer(),
@@ -479,33 +991,31 @@ template <typename Protocol, typename SocketAcceptorService>
 static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
                              ssl::context& context,
                              const bool fUseSSL,
-                             boost::shared_ptr< AcceptedConnection > conn,
+                             boost::shared_ptr< RPCConnectionImpl<Protocol> > conn,
                              const boost::system::error_code& error)
 {
     // Immediately start accepting new connections, except when we're cancelled or our socket is closed.
     if (error != asio::error::operation_aborted && acceptor->is_open())
         RPCListen(acceptor, context, fUseSSL);
 
-    AcceptedConnectionImpl<ip::tcp>* tcp_conn = dynamic_cast< AcceptedConnectionImpl<ip::tcp>* >(conn.get());
-
     if (error)
     {
         // TODO: Actually handle errors
         LogPrintf("%s: Error: %s\n", __func__, error.message());
     }
     // Restrict callers by IP.  It is important to
-    // do this before starting client thread, to filter out
+    // do this before reading anything, to filter out
     // certain DoS and misbehaving clients.
-    else if (tcp_conn && !ClientAllowed(tcp_conn->peer.address()))
+    else if (!ClientAllowed(conn->peer.address()))
     {
         // Only send a 403 if we're not using SSL to prevent a DoS during the SSL handshake.
         if (!fUseSSL)
-            conn->stream() << HTTPReply(HTTP_FORBIDDEN, "", false) << std::flush;
-        conn->close();
+            conn->SendReply(HTTPReply(HTTP_FORBIDDEN, "", false), false);
+        else
+            conn->Close();
     }
     else {
-        ServiceConnection(conn.get());
-        conn->close();
+        conn->Start();
     }
 }
 
@@ -624,9 +1134,21 @@ void StartRPCThreads()
         return;
     }
 
+    // A single network thread does all socket I/O and HTTP parsing; the
+    // -rpcthreads handler threads only execute calls
     rpc_worker_group = new boost::thread_group();
-    for (int i = 0; i < GetArg("-rpcthreads", 4); i++)
-        rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+    rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+
+    rpc_handler_service = new asio::io_service();
+    rpc_handler_work = new asio::io_service::work(*rpc_handler_service);
+    {
+        LOCK(cs_rpcWorkQueue);
+        nRPCHandlerThreads = std::max((int)GetArg("-rpcthreads", 4), 1);
+        nRPCWorkQueueMax = std::max((int)GetArg("-rpcworkqueue", 16), 1);
+    }
+    rpc_handler_group = new boost::thread_group();
+    for (int i = 0; i < nRPCHandlerThreads; i++)
+        rpc_handler_group->create_thread(boost::bind(&asio::io_service::run, rpc_handler_service));
 }
 
 void StartDummyRPCThread()
@@ -668,6 +1190,16 @@ void StopRPCThreads()
     rpc_io_service->stop();
     if (rpc_worker_group != NULL)
         rpc_worker_group->join_all();
+    if (rpc_handler_service != NULL)
+    {
+        rpc_handler_service->stop();
+        rpc_handler_group->join_all();
+    }
+    // Pending handlers hold connections whose sockets belong to rpc_io_service,
+    // so the handler service has to go first
+    delete rpc_handler_work; rpc_handler_work = NULL;
+    delete rpc_handler_group; rpc_handler_group = NULL;
+    delete rpc_handler_service; rpc_handler_service = NULL;
     delete rpc_dummy_work; rpc_dummy_work = NULL;
     delete rpc_worker_group; rpc_worker_group = NULL;
     delete rpc_ssl_context; rpc_ssl_context = NULL;
@@ -676,7 +1208,12 @@ void StopRPCThreads()
 
 void RPCRunHandler(const boost::system::error_code& err, boost::function<void(void)> func)
 {
-    if (!err)
+    if (err)
+        return;
+    // Timer callbacks may take wallet locks; keep them off the network thread
+    if (rpc_handler_service != NULL)
+        rpc_handler_service->post(func);
+    else
         func();
 }
 
@@ -759,98 +1296,261 @@ static Object JSONRPCExecOne(const Value& req)
     return rpc_result;
 }
 
-static string JSONRPCExecBatch(const Array& vReq)
+/** Admit one more job to the handler pool unless it is already full */
+static bool RPCWorkQueueAdmit()
 {
-    Array ret;
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
-
-    return write_string(Value(ret), false) + "\n";
+    LOCK(cs_rpcWorkQueue);
+    if (nRPCWorkQueueDepth >= nRPCWorkQueueMax)
+        return false;
+    nRPCWorkQueueDepth++;
+    return true;
 }
 
-void ServiceConnection(AcceptedConnection *conn)
+static void RPCWorkQueueRelease()
 {
-    bool fRun = true;
-    while (fRun && !ShutdownRequested())
-    {
-        int nProto = 0;
-        map<string, string> mapHeaders;
-        string strRequest, strMethod, strURI;
+    LOCK(cs_rpcWorkQueue);
+    nRPCWorkQueueDepth--;
+}
 
-        // Read HTTP request line
-        if (!ReadHTTPRequestLine(conn->stream(), nProto, strMethod, strURI))
-            break;
+// Entries of one batch that may be on the handler pool at the same time
+static const unsigned int RPC_BATCH_WINDOW = 4;
 
-        // Read HTTP message headers and body
-        ReadHTTPMessage(conn->stream(), mapHeaders, strRequest, nProto);
+/** State shared by the entries of one batch request while they execute concurrently */
+class CRPCBatch
+{
+public:
+    boost::shared_ptr<RPCConnection> conn;
+    bool fKeepAlive;
+    Array vRequests;
+    std::vector<Object> vResults;
+    CCriticalSection cs;
+    unsigned int nRemaining;
+    // the first entry not yet posted to the pool
+    unsigned int nNext;
+};
 
-        if (strURI != "/") {
-            conn->stream() << HTTPReply(HTTP_NOT_FOUND, "", false) << std::flush;
-            break;
-        }
+static void RPCExecBatchEntry(boost::shared_ptr<CRPCBatch> batch, unsigned int nIdx)
+{
+    Object result = JSONRPCExecOne(batch->vRequests[nIdx]);
 
-        // Check authorization
-        if (mapHeaders.count("authorization") == 0)
+    bool fDone;
+    bool fPostNext = false;
+    unsigned int nNext = 0;
+    {
+        LOCK(batch->cs);
+        batch->vResults[nIdx] = result;
+        fDone = (--batch->nRemaining == 0);
+        if (batch->nNext < batch->vRequests.size())
         {
-            conn->stream() << HTTPReply(HTTP_UNAUTHORIZED, "", false) << std::flush;
-            break;
+            nNext = batch->nNext++;
+            fPostNext = true;
         }
-        if (!HTTPAuthorized(mapHeaders))
+    }
+    // each finished entry makes room for the next one in the window
+    if (fPostNext)
+        rpc_handler_service->post(boost::bind(&RPCExecBatchEntry, batch, nNext));
+    if (fDone)
+    {
+        // Replies are written in request order regardless of completion order
+        Array ret(batch->vResults.begin(), batch->vResults.end());
+        string strReply = write_string(Value(ret), false) + "\n";
+        batch->conn->SendReply(HTTPReply(HTTP_OK, strReply, batch->fKeepAlive), batch->fKeepAlive);
+        // the batch kept its request's place in the queue until now
+        RPCWorkQueueRelease();
+    }
+}
+
+// A streaming handler stops producing while this much of its reply is unsent,
+// and gives up on a client that reads none of it for the timeout.
+static const size_t RPC_STREAM_MAX_UNSENT = 1024 * 1024;
+static const int64_t RPC_STREAM_SEND_TIMEOUT = 30 * 1000;
+
+/** Frames the output of a CJSONStreamWriter as the body of an HTTP reply */
+class CRPCStreamSink
+{
+public:
+    CRPCStreamSink(boost::shared_ptr<RPCConnection> connIn, bool fKeepAliveIn, bool fChunkedIn) :
+        conn(connIn), fKeepAlive(fKeepAliveIn && fChunkedIn), fChunked(fChunkedIn), fStarted(false) {}
+
+    void Send(const string& strData)
+    {
+        // Stream actors hold no lock while writing (see executeStream), so
+        // waiting for a slow client only holds up this handler thread
+        if (!conn->WaitForSendSpace(RPC_STREAM_MAX_UNSENT, RPC_STREAM_SEND_TIMEOUT))
+            throw runtime_error("client is not reading the reply");
+        if (!fStarted)
         {
-            LogPrintf("ThreadRPCServer incorrect password attempt from %s\n", conn->peer_address_to_string());
-            /* Deter brute-forcing short passwords.
-               If this results in a DoS the user really
-               shouldn't have their RPC port exposed. */
-            if (mapArgs["-rpcpassword"].size() < 20)
-                MilliSleep(250);
-
-            conn->stream() << HTTPReply(HTTP_UNAUTHORIZED, "", false) << std::flush;
-            break;
+            conn->SendData(HTTPReplyStreamHeader(HTTP_OK, fKeepAlive, fChunked));
+            fStarted = true;
         }
-        if (mapHeaders["connection"] == "close")
-            fRun = false;
+        if (fChunked)
+            conn->SendData(strprintf("%x\r\n", strData.size()) + strData + "\r\n");
+        else
+            conn->SendData(strData);
+    }
 
-        JSONRequest jreq;
-        try
-        {
-            // Parse request
-            Value valRequest;
-            if (!read_string(strRequest, valRequest))
-                throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
+    void Finish()
+    {
+        Send("\n");
+        if (fChunked)
+            conn->SendData("0\r\n\r\n");
+        conn->EndReply(fKeepAlive);
+    }
+
+private:
+    boost::shared_ptr<RPCConnection> conn;
+    bool fKeepAlive;
+    bool fChunked;
+    bool fStarted;
+};
+
+/**
+ * Run a streaming command, sending the reply while it is being generated.
+ * Errors raised before anything reached the client propagate to the caller for
+ * a regular error reply; once output has started the connection is dropped.
+ */
+static void RPCStreamRequest(boost::shared_ptr<RPCConnection> conn, const JSONRequest& jreq, bool fKeepAlive, bool fChunked)
+{
+    CRPCStreamSink sink(conn, fKeepAlive, fChunked);
+    CJSONStreamWriter writer(boost::bind(&CRPCStreamSink::Send, &sink, _1));
+    try
+    {
+        // Same envelope as JSONRPCReply
+        writer.BeginObject();
+        writer.Key("result");
+        tableRPC.executeStream(jreq.strMethod, jreq.params, writer);
+        writer.Key("error");
+        writer.Write(Value::null);
+        writer.Key("id");
+        writer.Write(jreq.id);
+        writer.EndObject();
+        writer.Flush();
+        sink.Finish();
+    }
+    catch (...)
+    {
+        if (!writer.HasFlushed())
+            throw;
+        LogPrintf("ThreadRPCServer %s failed after its reply was partially sent to %s\n",
+                  SanitizeString(jreq.strMethod), conn->peer_address_to_string());
+        conn->Abort();
+    }
+}
 
-            string strReply;
+static void RPCHandleRequest(boost::shared_ptr<RPCConnection> conn, const string& strRequest, bool fKeepAlive, bool fChunked)
+{
+    JSONRequest jreq;
+    bool fBatchRunning = false;
+    try
+    {
+        // Parse request
+        Value valRequest;
+        if (!ReadJSON(strRequest, valRequest))
+            throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
 
-            // singleton request
-            if (valRequest.type() == obj_type) {
-                jreq.parse(valRequest);
+        // singleton request
+        if (valRequest.type() == obj_type) {
+            jreq.parse(valRequest);
 
+            if (tableRPC.canStream(jreq.strMethod))
+                RPCStreamRequest(conn, jreq, fKeepAlive, fChunked);
+            else
+            {
                 Value result = tableRPC.execute(jreq.strMethod, jreq.params);
 
                 // Send reply
-                strReply = JSONRPCReply(result, Value::null, jreq.id);
+                string strReply = JSONRPCReply(result, Value::null, jreq.id);
+                conn->SendReply(HTTPReply(HTTP_OK, strReply, fKeepAlive), fKeepAlive);
+            }
 
-            // array of requests
-            } else if (valRequest.type() == array_type)
-                strReply = JSONRPCExecBatch(valRequest.get_array());
+        // array of requests: the entries run as separate jobs on the handler
+        // pool, at most RPC_BATCH_WINDOW at a time, and the batch keeps this
+        // request's one place in the queue until the last of them is done
+        } else if (valRequest.type() == array_type) {
+            const Array& vReq = valRequest.get_array();
+            if (vReq.empty())
+                conn->SendReply(HTTPReply(HTTP_OK, "[]\n", fKeepAlive), fKeepAlive);
             else
-                throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
-
-            conn->stream() << HTTPReply(HTTP_OK, strReply, fRun) << std::flush;
-        }
-        catch (Object& objError)
-        {
-            ErrorReply(conn->stream(), objError, jreq.id);
-            break;
+            {
+                boost::shared_ptr<CRPCBatch> batch(new CRPCBatch());
+                batch->conn = conn;
+                batch->fKeepAlive = fKeepAlive;
+                batch->vRequests = vReq;
+                batch->vResults.resize(vReq.size());
+                batch->nRemaining = vReq.size();
+                batch->nNext = std::min((unsigned int)vReq.size(), RPC_BATCH_WINDOW);
+                unsigned int nFirst = batch->nNext;
+                fBatchRunning = true;
+                for (unsigned int i = 0; i < nFirst; i++)
+                    rpc_handler_service->post(boost::bind(&RPCExecBatchEntry, batch, i));
+            }
         }
-        catch (std::exception& e)
+        else
+            throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
+    }
+    catch (Object& objError)
+    {
+        conn->SendReply(ErrorReply(objError, jreq.id), false);
+    }
+    catch (std::exception& e)
+    {
+        conn->SendReply(ErrorReply(JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id), false);
+    }
+    if (!fBatchRunning)
+        RPCWorkQueueRelease();
+}
+
+static void RPCDelayedReplyHandler(boost::shared_ptr<deadline_timer> timer, boost::shared_ptr<RPCConnection> conn,
+                                   const string& strReply, bool fKeepAlive)
+{
+    conn->SendReply(strReply, fKeepAlive);
+}
+
+/** Check URI and credentials on the network thread, then queue the call for a handler thread */
+static void RPCDispatchRequest(boost::shared_ptr<RPCConnection> conn, HTTPRequest& req)
+{
+    if (req.strURI != "/") {
+        conn->SendReply(HTTPReply(HTTP_NOT_FOUND, "", false), false);
+        return;
+    }
+
+    // Check authorization
+    if (req.mapHeaders.count("authorization") == 0)
+    {
+        conn->SendReply(HTTPReply(HTTP_UNAUTHORIZED, "", false), false);
+        return;
+    }
+    if (!HTTPAuthorized(req.mapHeaders))
+    {
+        LogPrintf("ThreadRPCServer incorrect password attempt from %s\n", conn->peer_address_to_string());
+        /* Deter brute-forcing short passwords.
+           If this results in a DoS the user really
+           shouldn't have their RPC port exposed.
+           The delay runs on a timer so the network thread keeps serving others. */
+        if (mapArgs["-rpcpassword"].size() < 20)
         {
-            ErrorReply(conn->stream(), JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
-            break;
+            boost::shared_ptr<deadline_timer> timer(new deadline_timer(*rpc_io_service));
+            timer->expires_from_now(posix_time::milliseconds(250));
+            timer->async_wait(boost::bind(&RPCDelayedReplyHandler, timer, conn, HTTPReply(HTTP_UNAUTHORIZED, "", false), false));
         }
+        else
+            conn->SendReply(HTTPReply(HTTP_UNAUTHORIZED, "", false), false);
+        return;
+    }
+    bool fKeepAlive = (req.mapHeaders["connection"] != "close");
+
+    if (!RPCWorkQueueAdmit())
+    {
+        LogPrintf("ThreadRPCServer work queue depth exceeded, refusing request from %s\n", conn->peer_address_to_string());
+        conn->SendReply(HTTPReply(HTTP_SERVICE_UNAVAILABLE, "", fKeepAlive), fKeepAlive);
+        return;
     }
+    // HTTP/1.1 clients get streamed replies chunked; 1.0 clients get them delimited by close
+    bool fChunked = (req.nProto >= 1);
+    rpc_handler_service->post(boost::bind(&RPCHandleRequest, conn, req.strBody, fKeepAlive, fChunked));
 }
 
-json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+const CRPCCommand* CRPCTable::prepare(const std::string &strMethod) const
 {
     // Find method
     const CRPCCommand *pcmd = tableRPC[strMethod];
@@ -866,37 +1566,83 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
     if (strWarning != "" && !GetBoolArg("-disablesafemode", false) &&
         !pcmd->okSafeMode)
         throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, string("Safe mode: ") + strWarning);
+    return pcmd;
+}
 
+void CRPCTable::invoke(const CRPCCommand *pcmd, const boost::function<void(void)>& func, bool fLock) const
+{
+    int64_t nStart = GetTimeMicros();
+    int64_t nLockWait = 0;
     try
     {
         // Execute
-        Value result;
         {
-            if (pcmd->threadSafe)
-                result = pcmd->actor(params, false);
+            if (!fLock)
+                func();
 #ifdef ENABLE_WALLET
             else if (!pwalletMain) {
+                int64_t nLockStart = GetTimeMicros();
                 LOCK(cs_main);
-                result = pcmd->actor(params, false);
+                nLockWait = GetTimeMicros() - nLockStart;
+                func();
             } else {
+                int64_t nLockStart = GetTimeMicros();
                 LOCK2(cs_main, pwalletMain->cs_wallet);
-                result = pcmd->actor(params, false);
+                nLockWait = GetTimeMicros() - nLockStart;
+                func();
             }
 #else // ENABLE_WALLET
             else {
+                int64_t nLockStart = GetTimeMicros();
                 LOCK(cs_main);
-                result = pcmd->actor(params, false);
+                nLockWait = GetTimeMicros() - nLockStart;
+                func();
             }
 #endif // !ENABLE_WALLET
         }
-        return result;
+        RecordRPCCall(pcmd->name, GetTimeMicros() - nStart, nLockWait, false);
+    }
+    catch (Object& objError)
+    {
+        RecordRPCCall(pcmd->name, GetTimeMicros() - nStart, nLockWait, true);
+        throw;
     }
     catch (std::exception& e)
     {
+        RecordRPCCall(pcmd->name, GetTimeMicros() - nStart, nLockWait, true);
         throw JSONRPCError(RPC_MISC_ERROR, e.what());
     }
 }
 
+static void CallActor(rpcfn_type actor, const Array& params, Value& result)
+{
+    result = actor(params, false);
+}
+
+json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+{
+    const CRPCCommand *pcmd = prepare(strMethod);
+
+    Value result;
+    invoke(pcmd, boost::bind(&CallActor, pcmd->actor, boost::cref(params), boost::ref(result)), !pcmd->threadSafe);
+    return result;
+}
+
+bool CRPCTable::canStream(const std::string &strMethod) const
+{
+    return mapStreamCommands.count(strMethod) > 0;
+}
+
+void CRPCTable::executeStream(const std::string &strMethod, const json_spirit::Array &params, CJSONStreamWriter& writer) const
+{
+    const CRPCCommand *pcmd = prepare(strMethod);
+    map<string, const CRPCStreamCommand*>::const_iterator it = mapStreamCommands.find(strMethod);
+    assert(it != mapStreamCommands.end());
+
+    // A write can wait on the client, so the actor takes its own locks
+    invoke(pcmd, boost::bind(it->second->actor, boost::cref(params), boost::ref(writer)), false);
+}
+
 std::string HelpExampleCli(string methodname, string args){
     return "> testinterzone-cli " + methodname + " " + args + "\n";
 }
@@ -0,0 +1,152 @@
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "scheduler.h"
+
+#include "util.h"
+
+#include <algorithm>
+
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+CScheduler::CScheduler(int64_t nTickMillisIn, unsigned int nSlotsIn) :
+    nTickMillis(nTickMillisIn), nSlots(nSlotsIn), vWheel(nSlotsIn)
+{
+    nTick = 0;
+    nTickZeroMillis = GetTimeMillis();
+    nLastMillis = nTickZeroMillis;
+    nTasks = 0;
+}
+
+// mutex must be held. GetTimeMillis follows the system clock; if that is set
+// back, tick zero moves back with it, or the wheel would stand still until
+// the clock caught up again. A step forward just runs the skipped ticks.
+int64_t CScheduler::Now()
+{
+    int64_t nNow = GetTimeMillis();
+    if (nNow < nLastMillis)
+        nTickZeroMillis -= nLastMillis - nNow;
+    nLastMillis = nNow;
+    return nNow;
+}
+
+// mutex must be held
+void CScheduler::Insert(const Task& task, int64_t nDelayMillis)
+{
+    // the first tick that ends at or after the deadline, and never one already processed
+    int64_t nNow = Now();
+    int64_t nDeadline = nNow + nDelayMillis - nTickZeroMillis;
+    int64_t nDue = (nDeadline + nTickMillis - 1) / nTickMillis - 1;
+    if(nDue < nTick) nDue = nTick;
+
+    Task t = task;
+    t.nLaps = (nDue - nTick) / nSlots;
+    vWheel[nDue % nSlots].push_back(t);
+    nTasks++;
+}
+
+// mutex must be held. Like MilliSleep, use the steady clock where boost has
+// it, a condition wait against the system clock would also outlast a step back.
+void CScheduler::WaitMillis(boost::unique_lock<boost::mutex>& lock, int64_t nMillis)
+{
+#if defined(HAVE_WORKING_BOOST_SLEEP_FOR)
+    cond.wait_for(lock, boost::chrono::milliseconds(nMillis));
+#else
+    cond.timed_wait(lock, boost::posix_time::milliseconds(nMillis));
+#endif
+}
+
+void CScheduler::Schedule(Function f, int64_t nDelayMillis)
+{
+    ScheduleEvery(f, 0, nDelayMillis);
+}
+
+void CScheduler::ScheduleEvery(Function f, int64_t nPeriodMillis, int64_t nDelayMillis)
+{
+    Task task;
+    task.f = f;
+    task.nPeriodMillis = nPeriodMillis;
+    task.nLaps = 0;
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    Insert(task, nDelayMillis);
+    // the thread may be sleeping until a later tick
+    cond.notify_one();
+}
+
+void CScheduler::ScheduleNow(Function f)
+{
+    Task task;
+    task.f = f;
+    task.nPeriodMillis = 0;
+    task.nLaps = 0;
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    queueNow.push_back(task);
+    nTasks++;
+    cond.notify_one();
+}
+
+void CScheduler::ServiceQueue()
+{
+    while(true)
+    {
+        vector<Task> vDue;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+
+            // sleep until the end of the next tick or until something has to run now
+            int64_t nNow = Now();
+            int64_t nWait = nTickZeroMillis + (nTick + 1) * nTickMillis - nNow;
+            while(queueNow.empty() && nWait > 0) {
+                // never longer than a tick, so Now() sees a clock change soon
+                WaitMillis(lock, std::min(nWait, nTickMillis));
+                nNow = Now();
+                nWait = nTickZeroMillis + (nTick + 1) * nTickMillis - nNow;
+            }
+
+            while(!queueNow.empty()) {
+                vDue.push_back(queueNow.front());
+                queueNow.pop_front();
+            }
+
+            // catch up on every tick that has passed
+            nNow = Now();
+            while(nTickZeroMillis + (nTick + 1) * nTickMillis <= nNow) {
+                list<Task>& slot = vWheel[nTick % nSlots];
+                list<Task>::iterator it = slot.begin();
+                while(it != slot.end()) {
+                    if(it->nLaps > 0) {
+                        it->nLaps--;
+                        ++it;
+                    } else {
+                        vDue.push_back(*it);
+                        it = slot.erase(it);
+                    }
+                }
+                nTick++;
+            }
+            nTasks -= vDue.size();
+        }
+
+        BOOST_FOREACH(Task& task, vDue) {
+            boost::this_thread::interruption_point();
+            task.f();
+            if(task.nPeriodMillis > 0) {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                Insert(task, task.nPeriodMillis);
+            }
+        }
+        boost::this_thread::interruption_point();
+    }
+}
+
+unsigned int CScheduler::size() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return nTasks;
+}
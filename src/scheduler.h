@@ -0,0 +1,74 @@
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SCHEDULER_H
+#define BITCOIN_SCHEDULER_H
+
+#include <deque>
+#include <list>
+#include <stdint.h>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/**
+ * Runs tasks on the thread that calls ServiceQueue, each with its own
+ * period or deadline. Timed tasks sit in a hashed timer wheel: a ring of
+ * nSlots buckets, one per tick, where a task due more than a lap ahead
+ * waits out its remaining laps in its bucket. Adding a task and advancing
+ * a tick cost O(1) whatever the number of tasks. Tasks scheduled to run
+ * now skip the wheel and wake the thread at once, so work triggered by a
+ * network message doesn't wait for the next tick.
+ *
+ * Tasks run one at a time in the order they came due; a task that runs
+ * long delays the ones after it but doesn't lose ticks.
+ */
+class CScheduler
+{
+public:
+    typedef boost::function<void(void)> Function;
+
+    CScheduler(int64_t nTickMillisIn = 100, unsigned int nSlotsIn = 512);
+
+    /** Run f once, nDelayMillis from now */
+    void Schedule(Function f, int64_t nDelayMillis);
+    /** Run f every nPeriodMillis, the first time nDelayMillis from now */
+    void ScheduleEvery(Function f, int64_t nPeriodMillis, int64_t nDelayMillis);
+    /** Run f as soon as the scheduler thread gets to it */
+    void ScheduleNow(Function f);
+
+    /** Run tasks as they come due until the thread is interrupted */
+    void ServiceQueue();
+
+    /** Tasks waiting to run */
+    unsigned int size() const;
+
+private:
+    struct Task
+    {
+        Function f;
+        int64_t nPeriodMillis; // 0 for a one-off
+        int64_t nLaps;         // full turns of the wheel left before it is due
+    };
+
+    const int64_t nTickMillis;
+    const unsigned int nSlots;
+
+    mutable boost::mutex mutex;
+    boost::condition_variable cond;
+    std::vector<std::list<Task> > vWheel;
+    std::deque<Task> queueNow;
+    int64_t nTick;          // the next tick to process
+    int64_t nTickZeroMillis;
+    int64_t nLastMillis;    // the clock at the last Now(), to notice it stepping back
+    unsigned int nTasks;
+
+    void Insert(const Task& task, int64_t nDelayMillis);
+    int64_t Now();
+    void WaitMillis(boost::unique_lock<boost::mutex>& lock, int64_t nMillis);
+};
+
+#endif
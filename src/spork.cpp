@@ -13,6 +13,8 @@
 #include "main.h"
 #include <boost/lexical_cast.hpp>
 
+#include <list>
+
 using namespace std;
 using namespace boost;
 
@@ -21,8 +23,73 @@ class CSporkManager;
 
 CSporkManager sporkManager;
 
-std::map<uint256, CSporkMessage> mapSporks;
-std::map<int, CSporkMessage> mapSporksActive;
+// protects the spork maps and the snapshot list; other files go through
+// GetSporkByHash and GetActiveSporks
+static CCriticalSection cs_sporks;
+static std::map<uint256, CSporkMessage> mapSporks;
+static std::map<int, CSporkMessage> mapSporksActive;
+// every snapshot published, kept so a reader never sees one freed
+static std::list<CSporkSnapshot> listSporkSnapshots;
+static const CSporkSnapshot* volatile pSporkSnapshot = NULL;
+
+static int64_t GetSporkDefault(int nSporkID)
+{
+    if(nSporkID == SPORK_1_MASTERNODE_PAYMENTS_ENFORCEMENT) return SPORK_1_MASTERNODE_PAYMENTS_ENFORCEMENT_DEFAULT;
+    if(nSporkID == SPORK_2_INSTANTX) return SPORK_2_INSTANTX_DEFAULT;
+    if(nSporkID == SPORK_3_INSTANTX_BLOCK_FILTERING) return SPORK_3_INSTANTX_BLOCK_FILTERING_DEFAULT;
+    if(nSporkID == SPORK_5_MAX_VALUE) return SPORK_5_MAX_VALUE_DEFAULT;
+    if(nSporkID == SPORK_7_MASTERNODE_SCANNING) return SPORK_7_MASTERNODE_SCANNING_DEFAULT;
+    return 0;
+}
+
+// cs_sporks must be held
+static void PublishSporkSnapshot()
+{
+    CSporkSnapshot snapshot;
+    for(int nSporkID = SPORK_START; nSporkID <= SPORK_END; nSporkID++) {
+        std::map<int, CSporkMessage>::const_iterator it = mapSporksActive.find(nSporkID);
+        snapshot.nValue[nSporkID - SPORK_START] = it != mapSporksActive.end() ? it->second.nValue : GetSporkDefault(nSporkID);
+    }
+    listSporkSnapshots.push_back(snapshot);
+
+    // the snapshot has to be complete before another thread can find it
+    __sync_synchronize();
+    pSporkSnapshot = &listSporkSnapshots.back();
+}
+
+static const CSporkSnapshot& GetSporkSnapshot()
+{
+    const CSporkSnapshot* pSnapshot = pSporkSnapshot;
+    if(pSnapshot == NULL) {
+        LOCK(cs_sporks);
+        if(pSporkSnapshot == NULL) PublishSporkSnapshot();
+        pSnapshot = pSporkSnapshot;
+    }
+    return *pSnapshot;
+}
+
+static void AddSpork(const uint256& hash, const CSporkMessage& spork)
+{
+    LOCK(cs_sporks);
+    mapSporks[hash] = spork;
+    mapSporksActive[spork.nSporkID] = spork;
+    PublishSporkSnapshot();
+}
+
+bool GetSporkByHash(const uint256& hash, CSporkMessage& sporkRet)
+{
+    LOCK(cs_sporks);
+    std::map<uint256, CSporkMessage>::const_iterator it = mapSporks.find(hash);
+    if(it == mapSporks.end()) return false;
+    sporkRet = it->second;
+    return true;
+}
+
+std::map<int, CSporkMessage> GetActiveSporks()
+{
+    LOCK(cs_sporks);
+    return mapSporksActive;
+}
 
 
 void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
@@ -38,16 +105,22 @@ void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
 
         if(chainActive.Tip() == NULL) return;
 
-        uint256 hash = spork.GetHash();
-        if(mapSporksActive.count(spork.nSporkID)) {
-            if(mapSporksActive[spork.nSporkID].nTimeSigned >= spork.nTimeSigned){
-                if(fDebug) LogPrintf("spork - seen %s block %d \n", hash.ToString().c_str(), chainActive.Tip()->nHeight);
-                return;
-            } else {
-                if(fDebug) LogPrintf("spork - got updated spork %s block %d \n", hash.ToString().c_str(), chainActive.Tip()->nHeight);
+        // every peer sends the sporks it has, so most are ones we already
+        // have; drop those before hashing or verifying anything
+        {
+            LOCK(cs_sporks);
+            std::map<int, CSporkMessage>::iterator it = mapSporksActive.find(spork.nSporkID);
+            if(it != mapSporksActive.end()) {
+                if(it->second.nTimeSigned >= spork.nTimeSigned){
+                    if(fDebug) LogPrintf("spork - seen ID %d block %d \n", spork.nSporkID, chainActive.Tip()->nHeight);
+                    return;
+                } else {
+                    if(fDebug) LogPrintf("spork - got updated spork ID %d block %d \n", spork.nSporkID, chainActive.Tip()->nHeight);
+                }
             }
         }
 
+        uint256 hash = spork.GetHash();
         LogPrintf("spork - new %s ID %d Time %d bestHeight %d\n", hash.ToString().c_str(), spork.nSporkID, spork.nValue, chainActive.Tip()->nHeight);
 
         if(!sporkManager.CheckSignature(spork)){
@@ -56,15 +129,15 @@ void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
             return;
         }
 
-        mapSporks[hash] = spork;
-        mapSporksActive[spork.nSporkID] = spork;
-        sporkManager.Relay(spork);
+        AddSpork(hash, spork);
+        sporkManager.Relay(hash);
 
         //does a task if needed
         ExecuteSpork(spork.nSporkID, spork.nValue);
     }
     if (strCommand == "getsporks")
     {
+        LOCK(cs_sporks);
         std::map<int, CSporkMessage>::iterator it = mapSporksActive.begin();
 
         while(it != mapSporksActive.end()) {
@@ -80,16 +153,10 @@ bool IsSporkActive(int nSporkID)
 {
     int64_t r = 0;
 
-    if(mapSporksActive.count(nSporkID)){
-        r = mapSporksActive[nSporkID].nValue;
+    if(nSporkID >= SPORK_START && nSporkID <= SPORK_END){
+        r = GetSporkSnapshot().nValue[nSporkID - SPORK_START];
     } else {
-        if(nSporkID == SPORK_1_MASTERNODE_PAYMENTS_ENFORCEMENT) r = SPORK_1_MASTERNODE_PAYMENTS_ENFORCEMENT_DEFAULT;
-        if(nSporkID == SPORK_2_INSTANTX) r = SPORK_2_INSTANTX_DEFAULT;
-        if(nSporkID == SPORK_3_INSTANTX_BLOCK_FILTERING) r = SPORK_3_INSTANTX_BLOCK_FILTERING_DEFAULT;
-        if(nSporkID == SPORK_5_MAX_VALUE) r = SPORK_5_MAX_VALUE_DEFAULT;
-        if(nSporkID == SPORK_7_MASTERNODE_SCANNING) r = SPORK_7_MASTERNODE_SCANNING;
-
-        if(r == 0) LogPrintf("GetSpork::Unknown Spork %d\n", nSporkID);
+        LogPrintf("GetSpork::Unknown Spork %d\n", nSporkID);
     }
     if(r == 0) r = 4070908800; //return 2099-1-1 by default
 
@@ -99,21 +166,12 @@ bool IsSporkActive(int nSporkID)
 // grab the value of the spork on the network, or the default
 int GetSporkValue(int nSporkID)
 {
-    int r = 0;
-
-    if(mapSporksActive.count(nSporkID)){
-        r = mapSporksActive[nSporkID].nValue;
-    } else {
-        if(nSporkID == SPORK_1_MASTERNODE_PAYMENTS_ENFORCEMENT) r = SPORK_1_MASTERNODE_PAYMENTS_ENFORCEMENT_DEFAULT;
-        if(nSporkID == SPORK_2_INSTANTX) r = SPORK_2_INSTANTX_DEFAULT;
-        if(nSporkID == SPORK_3_INSTANTX_BLOCK_FILTERING) r = SPORK_3_INSTANTX_BLOCK_FILTERING_DEFAULT;
-        if(nSporkID == SPORK_5_MAX_VALUE) r = SPORK_5_MAX_VALUE_DEFAULT;
-        if(nSporkID == SPORK_7_MASTERNODE_SCANNING) r = SPORK_7_MASTERNODE_SCANNING;
-
-        if(r == 0) LogPrintf("GetSpork::Unknown Spork %d\n", nSporkID);
+    if(nSporkID < SPORK_START || nSporkID > SPORK_END){
+        LogPrintf("GetSpork::Unknown Spork %d\n", nSporkID);
+        return 0;
     }
 
-    return r;
+    return GetSporkSnapshot().nValue[nSporkID - SPORK_START];
 }
 
 void ExecuteSpork(int nSporkID, int nValue)
@@ -172,18 +230,18 @@ bool CSporkManager::UpdateSpork(int nSporkID, int64_t nValue)
     msg.nTimeSigned = GetTime();
 
     if(Sign(msg)){
-        Relay(msg);
-        mapSporks[msg.GetHash()] = msg;
-        mapSporksActive[nSporkID] = msg;
+        uint256 hash = msg.GetHash();
+        AddSpork(hash, msg);
+        Relay(hash);
         return true;
     }
 
     return false;
 }
 
-void CSporkManager::Relay(CSporkMessage& msg)
+void CSporkManager::Relay(const uint256& hash)
 {
-    CInv inv(MSG_SPORK, msg.GetHash());
+    CInv inv(MSG_SPORK, hash);
 
     vector<CInv> vInv;
     vInv.push_back(inv);
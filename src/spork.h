@@ -27,6 +27,9 @@ using namespace boost;
 #define SPORK_6_NOTUSED                                       10005
 #define SPORK_7_MASTERNODE_SCANNING                           10006
 
+#define SPORK_START                                           SPORK_1_MASTERNODE_PAYMENTS_ENFORCEMENT
+#define SPORK_END                                             SPORK_7_MASTERNODE_SCANNING
+
 #define SPORK_1_MASTERNODE_PAYMENTS_ENFORCEMENT_DEFAULT       1424217600  //2015-2-18
 #define SPORK_2_INSTANTX_DEFAULT                              978307200   //2001-1-1
 #define SPORK_3_INSTANTX_BLOCK_FILTERING_DEFAULT              1424217600  //2015-2-18
@@ -47,11 +50,22 @@ class CSporkManager;
 using namespace std;
 using namespace boost;
 
-extern std::map<uint256, CSporkMessage> mapSporks;
-extern std::map<int, CSporkMessage> mapSporksActive;
 extern CSporkManager sporkManager;
 
+/** The value of every spork at one time, indexed by nSporkID - SPORK_START.
+ *  A new snapshot is published whenever a spork is accepted; published
+ *  snapshots never change and are never freed, so readers need no lock.
+ */
+struct CSporkSnapshot
+{
+    int64_t nValue[SPORK_END - SPORK_START + 1];
+};
+
 void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
+/** Copy out the spork with this hash, if we have it */
+bool GetSporkByHash(const uint256& hash, CSporkMessage& sporkRet);
+/** The latest spork message for each spork id */
+std::map<int, CSporkMessage> GetActiveSporks();
 int GetSporkValue(int nSporkID);
 bool IsSporkActive(int nSporkID);
 void ExecuteSpork(int nSporkID, int nValue);
@@ -105,7 +119,7 @@ public:
     bool SetPrivKey(std::string strPrivKey);
     bool CheckSignature(CSporkMessage& spork);
     bool Sign(CSporkMessage& spork);
-    void Relay(CSporkMessage& msg);
+    void Relay(const uint256& hash);
 
 };
 
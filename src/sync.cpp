@@ -6,7 +6,88 @@
 
 #include "util.h"
 
+#include <algorithm>
+#include <map>
+
 #include <boost/foreach.hpp>
+#include <boost/thread/once.hpp>
+
+volatile bool fLockStats = false;
+unsigned int nLockStatsSampleRate = 0;
+
+// Keyed by acquisition site: file, line and lock expression. All three are
+// string literals or constants, so pointers identify them.
+typedef std::pair<std::pair<const char*, int>, const char*> LockSite;
+
+// Heap allocated and never freed, because locks are taken in global
+// destructors (see the comment above mutexDebugLog in util.cpp)
+static boost::once_flag lockStatsInitFlag = BOOST_ONCE_INIT;
+static boost::mutex* mutexLockStats = NULL;
+static std::map<LockSite, CLockSiteStats>* mapLockStats = NULL;
+
+static void LockStatsInit()
+{
+    mutexLockStats = new boost::mutex();
+    mapLockStats = new std::map<LockSite, CLockSiteStats>();
+}
+
+// Caller holds mutexLockStats
+static CLockSiteStats& LockSiteStats(const char* pszName, const char* pszFile, int nLine)
+{
+    CLockSiteStats& stats = (*mapLockStats)[std::make_pair(std::make_pair(pszFile, nLine), pszName)];
+    if (stats.nLine == 0)
+    {
+        stats.strName = pszName;
+        stats.strFile = pszFile;
+        stats.nLine = nLine;
+    }
+    return stats;
+}
+
+bool LockStatsSample()
+{
+    // Racy on purpose: a lost increment only shifts which acquisition is sampled
+    static volatile unsigned int nCounter = 0;
+    unsigned int nRate = nLockStatsSampleRate;
+    return nRate > 0 && ++nCounter % nRate == 0;
+}
+
+int64_t LockStatsTime()
+{
+    return GetTimeMicros();
+}
+
+void LockStatsWait(const char* pszName, const char* pszFile, int nLine, int64_t nMicros)
+{
+    boost::call_once(&LockStatsInit, lockStatsInitFlag);
+    boost::mutex::scoped_lock lock(*mutexLockStats);
+    CLockSiteStats& stats = LockSiteStats(pszName, pszFile, nLine);
+    stats.nContended++;
+    stats.nWaitMicros += nMicros;
+    stats.nMaxWaitMicros = std::max(stats.nMaxWaitMicros, nMicros);
+}
+
+void LockStatsHold(const char* pszName, const char* pszFile, int nLine, int64_t nMicros)
+{
+    boost::call_once(&LockStatsInit, lockStatsInitFlag);
+    boost::mutex::scoped_lock lock(*mutexLockStats);
+    CLockSiteStats& stats = LockSiteStats(pszName, pszFile, nLine);
+    stats.nSampled++;
+    stats.nHoldMicros += nMicros;
+    stats.nMaxHoldMicros = std::max(stats.nMaxHoldMicros, nMicros);
+}
+
+void GetLockStats(std::vector<CLockSiteStats>& vStats, bool fReset)
+{
+    boost::call_once(&LockStatsInit, lockStatsInitFlag);
+    boost::mutex::scoped_lock lock(*mutexLockStats);
+    vStats.clear();
+    vStats.reserve(mapLockStats->size());
+    for (std::map<LockSite, CLockSiteStats>::const_iterator it = mapLockStats->begin(); it != mapLockStats->end(); ++it)
+        vStats.push_back(it->second);
+    if (fReset)
+        mapLockStats->clear();
+}
 
 #ifdef DEBUG_LOCKCONTENTION
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
@@ -8,6 +8,10 @@
 
 #include "threadsafety.h"
 
+#include <stdint.h>
+#include <string>
+#include <vector>
+
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -100,6 +104,36 @@ void static inline AssertLockHeldInternal(const char* pszName, const char* pszFi
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/**
+ * Lock contention profiler, enabled with -lockstats=<n>. Every LOCK that
+ * has to wait records the wait; one in n LOCK and TRY_LOCK acquisitions
+ * also records how long the lock was held. Statistics are kept per
+ * acquisition site and reported by getlockstats.
+ */
+extern volatile bool fLockStats;
+extern unsigned int nLockStatsSampleRate;
+bool LockStatsSample();
+int64_t LockStatsTime();
+void LockStatsWait(const char* pszName, const char* pszFile, int nLine, int64_t nMicros);
+void LockStatsHold(const char* pszName, const char* pszFile, int nLine, int64_t nMicros);
+
+struct CLockSiteStats
+{
+    std::string strName;
+    std::string strFile;
+    int nLine;
+    uint64_t nSampled;   // acquisitions sampled for hold time
+    uint64_t nContended; // acquisitions that had to wait
+    int64_t nWaitMicros;
+    int64_t nMaxWaitMicros;
+    int64_t nHoldMicros; // over the sampled acquisitions
+    int64_t nMaxHoldMicros;
+
+    CLockSiteStats() : nLine(0), nSampled(0), nContended(0), nWaitMicros(0), nMaxWaitMicros(0), nHoldMicros(0), nMaxHoldMicros(0) {}
+};
+
+void GetLockStats(std::vector<CLockSiteStats>& vStats, bool fReset);
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template<typename Mutex>
 class CMutexLock
@@ -107,18 +141,31 @@ class CMutexLock
 private:
     boost::unique_lock<Mutex> lock;
 
+    // Acquisition site and start of the hold, when sampled by the lock profiler
+    const char* pszLockName;
+    const char* pszLockFile;
+    int nLockLine;
+    int64_t nLockedSince;
+
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
-#ifdef DEBUG_LOCKCONTENTION
         if (!lock.try_lock())
         {
+#ifdef DEBUG_LOCKCONTENTION
             PrintLockContention(pszName, pszFile, nLine);
 #endif
-        lock.lock();
-#ifdef DEBUG_LOCKCONTENTION
+            if (fLockStats)
+            {
+                int64_t nStart = LockStatsTime();
+                lock.lock();
+                LockStatsWait(pszName, pszFile, nLine, LockStatsTime() - nStart);
+            }
+            else
+                lock.lock();
         }
-#endif
+        if (fLockStats && LockStatsSample())
+            nLockedSince = LockStatsTime();
     }
 
     bool TryEnter(const char* pszName, const char* pszFile, int nLine)
@@ -127,11 +174,14 @@ private:
         lock.try_lock();
         if (!lock.owns_lock())
             LeaveCritical();
+        else if (fLockStats && LockStatsSample())
+            nLockedSince = LockStatsTime();
         return lock.owns_lock();
     }
 
 public:
-    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) : lock(mutexIn, boost::defer_lock)
+    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) :
+        lock(mutexIn, boost::defer_lock), pszLockName(pszName), pszLockFile(pszFile), nLockLine(nLine), nLockedSince(0)
     {
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
@@ -142,7 +192,11 @@ public:
     ~CMutexLock()
     {
         if (lock.owns_lock())
+        {
+            if (nLockedSince)
+                LockStatsHold(pszLockName, pszLockFile, nLockLine, LockStatsTime() - nLockedSince);
             LeaveCritical();
+        }
     }
 
     operator bool()
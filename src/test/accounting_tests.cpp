@@ -128,4 +128,45 @@ BOOST_AUTO_TEST_CASE(acc_orderupgrade)
     BOOST_CHECK(6 == vpwtx[1]->nOrderPos);
 }
 
+BOOST_AUTO_TEST_CASE(acc_writebehind)
+{
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+    const std::string& strFile = pwalletMain->strWalletFile;
+    CBlockLocator locator, locatorRead;
+    locator.vHave.push_back(GetRandHash());
+
+    LOCK(pwalletMain->cs_wallet);
+
+    bitdb.journal.SetEnabled(true);
+
+    // Queued records are visible to reads before they are committed
+    BOOST_CHECK(walletdb.WriteBestBlock(locator));
+    BOOST_CHECK(bitdb.journal.HasPending(strFile));
+    BOOST_CHECK(walletdb.ReadBestBlock(locatorRead));
+    BOOST_CHECK(locatorRead.vHave == locator.vHave);
+
+    BOOST_CHECK(bitdb.journal.Flush(strFile));
+    BOOST_CHECK(!bitdb.journal.HasPending(strFile));
+    locatorRead.SetNull();
+    BOOST_CHECK(walletdb.ReadBestBlock(locatorRead));
+    BOOST_CHECK(locatorRead.vHave == locator.vHave);
+
+    // Cursors commit the queue first
+    CAccountingEntry ae;
+    ae.strAccount = "writebehind";
+    ae.nCreditDebit = 1;
+    ae.nTime = 1333333333;
+    BOOST_CHECK(walletdb.WriteAccountingEntry(ae));
+    BOOST_CHECK(bitdb.journal.HasPending(strFile));
+    std::list<CAccountingEntry> aes;
+    walletdb.ListAccountCreditDebit("writebehind", aes);
+    BOOST_CHECK(aes.size() == 1);
+    BOOST_CHECK(!bitdb.journal.HasPending(strFile));
+
+    // Once disabled, writes go straight to the database
+    bitdb.journal.SetEnabled(false);
+    BOOST_CHECK(walletdb.WriteBestBlock(locator));
+    BOOST_CHECK(!bitdb.journal.HasPending(strFile));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
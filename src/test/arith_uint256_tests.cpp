@@ -0,0 +1,168 @@
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "arith_uint256.h"
+#include "bignum.h"
+#include "main.h"
+#include "util.h"
+
+#include <stdint.h>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+// Every proof-of-work computation moved off CBigNum has to give exactly the
+// results it gave before, so compare against CBigNum rather than constants.
+
+static uint32_t RandomCompact(int i)
+{
+    uint32_t nCompact = (uint32_t)GetRand(0x100000000ULL);
+    // Mostly realistic exponents, with some around and past 2^256
+    if (i % 4 != 0)
+        nCompact = (nCompact & 0x00ffffff) | ((uint32_t)GetRand(36) << 24);
+    return nCompact;
+}
+
+static arith_uint256 RandomArith(unsigned int nMaxBits)
+{
+    arith_uint256 ret(GetRandHash());
+    return ret >> (256 - GetRand(nMaxBits + 1));
+}
+
+BOOST_AUTO_TEST_SUITE(arith_uint256_tests)
+
+BOOST_AUTO_TEST_CASE(arith_uint256_compact)
+{
+    for (int i = 0; i < 10000; i++)
+    {
+        uint32_t nCompact = RandomCompact(i);
+        CBigNum bn;
+        bn.SetCompact(nCompact);
+
+        bool fNegative, fOverflow;
+        arith_uint256 arith;
+        arith.SetCompact(nCompact, &fNegative, &fOverflow);
+
+        BOOST_CHECK_EQUAL(fNegative, bn < 0);
+        BOOST_CHECK_EQUAL(fOverflow, BN_num_bits(&bn) > 256);
+        if (fOverflow)
+            continue;
+        BOOST_CHECK(arith.getuint256() == (fNegative ? -bn : bn).getuint256());
+        BOOST_CHECK_EQUAL(arith.GetCompact(fNegative), bn.GetCompact());
+    }
+
+    // Corners of the format
+    bool fNegative, fOverflow;
+    arith_uint256 arith;
+    BOOST_CHECK(arith.SetCompact(0x01123456) == 0x12);
+    BOOST_CHECK(arith.SetCompact(0x04923456, &fNegative, &fOverflow) == 0x12345600);
+    BOOST_CHECK(fNegative && !fOverflow);
+    BOOST_CHECK(arith.SetCompact(0x00800000, &fNegative, &fOverflow) == 0);
+    BOOST_CHECK(!fNegative && !fOverflow);
+    arith.SetCompact(0x220000ff, &fNegative, &fOverflow);
+    BOOST_CHECK(!fOverflow);
+    arith.SetCompact(0x22000100, &fNegative, &fOverflow);
+    BOOST_CHECK(fOverflow);
+    BOOST_CHECK_EQUAL(arith_uint256(0x80).GetCompact(), 0x02008000U);
+}
+
+BOOST_AUTO_TEST_CASE(arith_uint256_blockwork)
+{
+    CBlockIndex index;
+    for (int i = 0; i < 10000; i++)
+    {
+        index.nBits = RandomCompact(i);
+        CBigNum bnTarget;
+        bnTarget.SetCompact(index.nBits);
+        CBigNum bnWork = (bnTarget <= 0) ? CBigNum(0) : (CBigNum(1)<<256) / (bnTarget+1);
+        BOOST_CHECK(index.GetBlockWork().getuint256() == bnWork.getuint256());
+    }
+
+    // The easiest target allowed, 0x0fffff * 2^216
+    index.nBits = Params().ProofOfWorkLimit().GetCompact();
+    BOOST_CHECK(index.GetBlockWork() == arith_uint256(1048577));
+}
+
+BOOST_AUTO_TEST_CASE(arith_uint256_arithmetic)
+{
+    for (int i = 0; i < 2000; i++)
+    {
+        arith_uint256 a = RandomArith(240);
+        arith_uint256 b = RandomArith(i % 2 ? 120 : 240) + 1;
+        CBigNum bnA(a.getuint256());
+        CBigNum bnB(b.getuint256());
+
+        BOOST_CHECK((a / b).getuint256() == (bnA / bnB).getuint256());
+        BOOST_CHECK((a + b).getuint256() == ((bnA + bnB) % (CBigNum(1)<<256)).getuint256());
+        BOOST_CHECK((a * b).getuint256() == ((bnA * bnB) % (CBigNum(1)<<256)).getuint256());
+        if (a >= b)
+            BOOST_CHECK((a - b).getuint256() == (bnA - bnB).getuint256());
+        BOOST_CHECK_EQUAL(a > b, bnA > bnB);
+        BOOST_CHECK_EQUAL(a.bits(), (unsigned int)BN_num_bits(&bnA));
+    }
+    BOOST_CHECK_THROW(arith_uint256(1) / arith_uint256(0), uint_error);
+}
+
+BOOST_AUTO_TEST_CASE(arith_uint256_retarget)
+{
+    // The retarget step of GetNextWorkRequired and ComputeMinWork as they were
+    const CBigNum bnLimit(Params().ProofOfWorkLimit().getuint256());
+    for (int i = 0; i < 5000; i++)
+    {
+        uint32_t nBits = (bnLimit >> GetRand(200)).GetCompact();
+        int64_t nActualTimespan = 1 + GetRand(2000);
+        int64_t nTargetTimespan = 1 + GetRand(2000);
+
+        CBigNum bnNew;
+        bnNew.SetCompact(nBits);
+        bnNew *= nActualTimespan;
+        bnNew /= nTargetTimespan;
+        if (bnNew > bnLimit)
+            bnNew = bnLimit;
+
+        arith_uint256 arith;
+        arith.SetCompact(nBits);
+        arith *= arith_uint256(nActualTimespan);
+        arith /= arith_uint256(nTargetTimespan);
+        if (arith > Params().ProofOfWorkLimit())
+            arith = Params().ProofOfWorkLimit();
+
+        BOOST_CHECK_EQUAL(arith.GetCompact(), bnNew.GetCompact());
+
+        unsigned int nMinWork = ComputeMinWork(nBits, GetRand(30 * 24 * 60 * 60));
+        CBigNum bnMinWork;
+        bnMinWork.SetCompact(nMinWork);
+        BOOST_CHECK(bnMinWork <= bnLimit);
+        BOOST_CHECK(bnMinWork >= CBigNum().SetCompact(nBits) || bnMinWork == bnLimit);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(arith_uint256_benchmark)
+{
+    CBlockIndex index;
+    index.nBits = 0x1b0404cb;
+    uint256 nWork;
+
+    int64_t nStart = GetTimeMicros();
+    for (int i = 0; i < 20000; i++)
+    {
+        CBigNum bnTarget;
+        bnTarget.SetCompact(index.nBits);
+        nWork = ((CBigNum(1)<<256) / (bnTarget+1)).getuint256();
+    }
+    int64_t nBigNum = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    int nMismatches = 0;
+    for (int i = 0; i < 20000; i++)
+        if (index.GetBlockWork().getuint256() != nWork)
+            nMismatches++;
+    int64_t nArith = GetTimeMicros() - nStart;
+    BOOST_CHECK_EQUAL(nMismatches, 0);
+
+    BOOST_TEST_MESSAGE(strprintf("20000 block work computations: CBigNum %dus, arith_uint256 %dus", nBigNum, nArith));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
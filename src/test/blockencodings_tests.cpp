@@ -0,0 +1,172 @@
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+
+#include "main.h"
+#include "txmempool.h"
+#include "util.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(blockencodings_tests)
+
+static CBlock BuildBlock(int nTx)
+{
+    CBlock block;
+    block.nBits = 0x207fffff;
+    block.nTime = 1400000000;
+
+    CTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << 1 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50 * COIN;
+    coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    block.vtx.push_back(coinbase);
+
+    for (int i = 0; i < nTx; i++)
+    {
+        CTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.hash = coinbase.GetHash();
+        tx.vin[0].prevout.n = i;
+        tx.vin[0].scriptSig = CScript() << OP_TRUE;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = COIN + i;
+        tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        block.vtx.push_back(tx);
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+static CBlockHeaderAndShortTxIDs RoundTrip(const CBlockHeaderAndShortTxIDs& cmpctblock)
+{
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << cmpctblock;
+    CBlockHeaderAndShortTxIDs result;
+    stream >> result;
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(compact_block_reconstruct)
+{
+    CBlock block = BuildBlock(20);
+    CTxMemPool pool;
+    // the mempool has every other transaction
+    for (unsigned int i = 1; i < block.vtx.size(); i += 2)
+        pool.addUnchecked(block.vtx[i].GetHash(), CTxMemPoolEntry(block.vtx[i], 0, 0, 0.0, 1));
+
+    CBlockHeaderAndShortTxIDs cmpctblock = RoundTrip(CBlockHeaderAndShortTxIDs(block));
+    BOOST_CHECK_EQUAL(cmpctblock.BlockTxCount(), block.vtx.size());
+    BOOST_CHECK_EQUAL(cmpctblock.vShortTxIds.size(), block.vtx.size() - 1);
+    // the receiver derives the same ids from the header and nonce
+    BOOST_CHECK_EQUAL(cmpctblock.vShortTxIds[0], cmpctblock.GetShortID(block.vtx[1].GetHash()));
+
+    CPartiallyDownloadedBlock partialBlock;
+    BOOST_CHECK_EQUAL(partialBlock.InitData(cmpctblock, pool), READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(partialBlock.GetMempoolCount(), 10U);
+
+    vector<unsigned int> vIndexes;
+    partialBlock.GetMissing(vIndexes);
+    BOOST_REQUIRE_EQUAL(vIndexes.size(), 10U);
+    vector<CTransaction> vtxMissing;
+    for (unsigned int i = 0; i < vIndexes.size(); i++)
+    {
+        BOOST_CHECK_EQUAL(vIndexes[i], 2 * i + 2);
+        vtxMissing.push_back(block.vtx[vIndexes[i]]);
+    }
+
+    // too few or too many transactions is the peer's fault
+    CBlock result;
+    vector<CTransaction> vtxShort(vtxMissing.begin(), vtxMissing.end() - 1);
+    BOOST_CHECK_EQUAL(partialBlock.FillBlock(result, vtxShort), READ_STATUS_INVALID);
+    vector<CTransaction> vtxLong(vtxMissing);
+    vtxLong.push_back(block.vtx[1]);
+    BOOST_CHECK_EQUAL(partialBlock.FillBlock(result, vtxLong), READ_STATUS_INVALID);
+
+    // the wrong transactions give a block that doesn't match its header
+    vector<CTransaction> vtxWrong(vtxMissing);
+    swap(vtxWrong[0], vtxWrong[1]);
+    BOOST_CHECK_EQUAL(partialBlock.FillBlock(result, vtxWrong), READ_STATUS_FAILED);
+
+    BOOST_CHECK_EQUAL(partialBlock.FillBlock(result, vtxMissing), READ_STATUS_OK);
+    BOOST_CHECK(result.GetHash() == block.GetHash());
+    BOOST_REQUIRE_EQUAL(result.vtx.size(), block.vtx.size());
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+        BOOST_CHECK(result.vtx[i].GetHash() == block.vtx[i].GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(compact_block_from_mempool)
+{
+    CBlock block = BuildBlock(5);
+    CTxMemPool pool;
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+        pool.addUnchecked(block.vtx[i].GetHash(), CTxMemPoolEntry(block.vtx[i], 0, 0, 0.0, 1));
+    // transactions outside the block don't get in the way
+    CBlock other = BuildBlock(30);
+    for (unsigned int i = 1; i < other.vtx.size(); i++)
+        if (other.vtx[i].vin[0].prevout.n >= 5)
+            pool.addUnchecked(other.vtx[i].GetHash(), CTxMemPoolEntry(other.vtx[i], 0, 0, 0.0, 1));
+
+    CPartiallyDownloadedBlock partialBlock;
+    BOOST_CHECK_EQUAL(partialBlock.InitData(RoundTrip(CBlockHeaderAndShortTxIDs(block)), pool), READ_STATUS_OK);
+
+    vector<unsigned int> vIndexes;
+    partialBlock.GetMissing(vIndexes);
+    BOOST_CHECK(vIndexes.empty());
+
+    CBlock result;
+    BOOST_CHECK_EQUAL(partialBlock.FillBlock(result, vector<CTransaction>()), READ_STATUS_OK);
+    BOOST_CHECK(result.GetHash() == block.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(compact_block_invalid)
+{
+    CBlock block = BuildBlock(3);
+    CTxMemPool pool;
+    CPartiallyDownloadedBlock partialBlock;
+
+    // a prefilled index past the end of the block
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+    cmpctblock.vPrefilledTxn[0].nIndex = 4;
+    BOOST_CHECK_EQUAL(partialBlock.InitData(cmpctblock, pool), READ_STATUS_INVALID);
+
+    // two transactions of the block with the same short id
+    cmpctblock = CBlockHeaderAndShortTxIDs(block);
+    cmpctblock.vShortTxIds[1] = cmpctblock.vShortTxIds[0];
+    BOOST_CHECK_EQUAL(partialBlock.InitData(cmpctblock, pool), READ_STATUS_FAILED);
+
+    // nothing at all
+    BOOST_CHECK_EQUAL(partialBlock.InitData(CBlockHeaderAndShortTxIDs(), pool), READ_STATUS_INVALID);
+}
+
+BOOST_AUTO_TEST_CASE(block_transactions_request_indexes)
+{
+    CBlockTransactionsRequest req;
+    BOOST_CHECK(req.CheckIndexes(3));
+
+    req.vIndexes.push_back(0);
+    req.vIndexes.push_back(2);
+    BOOST_CHECK(req.CheckIndexes(3));
+    // past the end of the block
+    BOOST_CHECK(!req.CheckIndexes(2));
+
+    // the same transaction twice
+    req.vIndexes.push_back(2);
+    BOOST_CHECK(!req.CheckIndexes(3));
+
+    // descending
+    req.vIndexes.clear();
+    req.vIndexes.push_back(2);
+    req.vIndexes.push_back(1);
+    BOOST_CHECK(!req.CheckIndexes(3));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,227 @@
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinselection.h"
+
+#include "core.h"
+#include "random.h"
+#include "util.h"
+
+#include <algorithm>
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(coinselection_tests)
+
+static vector<CSelectionCoin> make_coins(const vector<int64_t>& vValues)
+{
+    vector<CSelectionCoin> vCoins;
+    for (unsigned int i = 0; i < vValues.size(); i++)
+        vCoins.push_back(CSelectionCoin(vValues[i], i));
+    sort(vCoins.begin(), vCoins.end(), greater<CSelectionCoin>());
+    return vCoins;
+}
+
+static int64_t selected_total(const vector<CSelectionCoin>& vCoins, const vector<char>& vfSelected, unsigned int& nCount)
+{
+    int64_t nTotal = 0;
+    nCount = 0;
+    for (unsigned int i = 0; i < vCoins.size(); i++)
+    {
+        if (vfSelected[i])
+        {
+            nTotal += vCoins[i].nValue;
+            nCount++;
+        }
+    }
+    return nTotal;
+}
+
+BOOST_AUTO_TEST_CASE(bnb_search)
+{
+    vector<int64_t> vValues;
+    vValues.push_back(1 * CENT);
+    vValues.push_back(2 * CENT);
+    vValues.push_back(5 * CENT);
+    vValues.push_back(10 * CENT);
+    vValues.push_back(20 * CENT);
+    vector<CSelectionCoin> vCoins = make_coins(vValues);
+
+    vector<char> vfBest;
+    int64_t nBest;
+    unsigned int nCount;
+
+    // exact matches
+    BOOST_CHECK(SelectCoinsBnB(vCoins, 7 * CENT, 0, vfBest, nBest));
+    BOOST_CHECK_EQUAL(nBest, 7 * CENT);
+    BOOST_CHECK_EQUAL(selected_total(vCoins, vfBest, nCount), 7 * CENT);
+    BOOST_CHECK_EQUAL(nCount, 2U);
+
+    BOOST_CHECK(SelectCoinsBnB(vCoins, 38 * CENT, 0, vfBest, nBest));
+    BOOST_CHECK_EQUAL(selected_total(vCoins, vfBest, nCount), 38 * CENT);
+    BOOST_CHECK_EQUAL(nCount, 5U);
+
+    // 34 can't be made exactly, but 35 is inside a one cent window
+    BOOST_CHECK(!SelectCoinsBnB(vCoins, 34 * CENT, 0, vfBest, nBest));
+    BOOST_CHECK(SelectCoinsBnB(vCoins, 34 * CENT, CENT, vfBest, nBest));
+    BOOST_CHECK_EQUAL(nBest, 35 * CENT);
+
+    // the smallest excess inside the window wins
+    BOOST_CHECK(SelectCoinsBnB(vCoins, 4 * CENT, 2 * CENT, vfBest, nBest));
+    BOOST_CHECK_EQUAL(nBest, 5 * CENT);
+
+    // more than there is
+    BOOST_CHECK(!SelectCoinsBnB(vCoins, 39 * CENT, CENT, vfBest, nBest));
+
+    // equal values: the pruning of repeated values must not hide solutions
+    vValues.clear();
+    for (int i = 0; i < 20; i++)
+        vValues.push_back(3 * CENT);
+    vValues.push_back(2 * CENT);
+    vCoins = make_coins(vValues);
+    BOOST_CHECK(SelectCoinsBnB(vCoins, 29 * CENT, 0, vfBest, nBest));
+    BOOST_CHECK_EQUAL(selected_total(vCoins, vfBest, nCount), 29 * CENT);
+    BOOST_CHECK_EQUAL(nCount, 10U);
+    BOOST_CHECK(!SelectCoinsBnB(vCoins, 31 * CENT, 0, vfBest, nBest));
+
+    // the search gives up after the try limit
+    BOOST_CHECK(!SelectCoinsBnB(vCoins, 31 * CENT, 0, vfBest, nBest, 10));
+}
+
+/** A synthetic wallet: how its outputs are distributed and what it pays */
+struct SelectionScenario
+{
+    string strName;
+    vector<int64_t> vValues;
+    vector<int64_t> vTargets;
+};
+
+static int64_t rand_value(int64_t nMin, int64_t nMax)
+{
+    return nMin + (int64_t)(((uint64_t)insecure_rand() << 32 | insecure_rand()) % (uint64_t)(nMax - nMin));
+}
+
+// Half of the targets are sums of random subsets, so a changeless solution
+// exists; the other half are arbitrary amounts.
+static void add_targets(SelectionScenario& scenario, int nTargets)
+{
+    for (int i = 0; i < nTargets; i++)
+    {
+        int64_t nTarget = 0;
+        if (i % 2 == 0)
+        {
+            int nInputs = 1 + insecure_rand() % 6;
+            for (int j = 0; j < nInputs; j++)
+                nTarget += scenario.vValues[insecure_rand() % scenario.vValues.size()];
+        }
+        else
+            nTarget = rand_value(COIN / 100, 50 * COIN);
+        scenario.vTargets.push_back(nTarget);
+    }
+}
+
+static vector<SelectionScenario> make_scenarios()
+{
+    vector<SelectionScenario> vScenarios;
+    seed_insecure_rand(true);
+
+    // payments received in arbitrary amounts
+    SelectionScenario uniform;
+    uniform.strName = "uniform";
+    for (int i = 0; i < 200; i++)
+        uniform.vValues.push_back(rand_value(COIN / 100, 20 * COIN));
+    add_targets(uniform, 100);
+    vScenarios.push_back(uniform);
+
+    // a mixing wallet: mostly denominations with a few collateral sized outputs
+    static const int64_t denoms[] = {100*COIN+100000, 10*COIN+10000, 1*COIN+1000, COIN/10+100};
+    SelectionScenario denominated;
+    denominated.strName = "denominated";
+    for (int i = 0; i < 200; i++)
+    {
+        if (i % 10 == 0)
+            denominated.vValues.push_back(COIN / 10 * (1 + insecure_rand() % 3));
+        else
+            denominated.vValues.push_back(denoms[insecure_rand() % 4]);
+    }
+    add_targets(denominated, 100);
+    vScenarios.push_back(denominated);
+
+    // a long tail of small outputs, as left behind by mining and change
+    SelectionScenario dusty;
+    dusty.strName = "dusty";
+    for (int i = 0; i < 400; i++)
+    {
+        int64_t nScale = COIN / 10000;
+        for (int j = insecure_rand() % 6; j > 0; j--)
+            nScale *= 10;
+        dusty.vValues.push_back(rand_value(nScale, 10 * nScale));
+    }
+    add_targets(dusty, 100);
+    vScenarios.push_back(dusty);
+
+    return vScenarios;
+}
+
+// Replays the scenarios against both solvers. The data is the same on every
+// run, so the counts can be compared between versions of the solvers; the
+// timings are printed with --log_level=message.
+BOOST_AUTO_TEST_CASE(bnb_benchmark)
+{
+    vector<SelectionScenario> vScenarios = make_scenarios();
+
+    BOOST_FOREACH(const SelectionScenario& scenario, vScenarios)
+    {
+        vector<CSelectionCoin> vCoins = make_coins(scenario.vValues);
+        int64_t nTotal = 0;
+        BOOST_FOREACH(int64_t nValue, scenario.vValues)
+            nTotal += nValue;
+
+        int nChangeless = 0, nChangelessConstructed = 0;
+        int64_t nBnBMicros = 0, nApproxMicros = 0;
+        for (unsigned int i = 0; i < scenario.vTargets.size(); i++)
+        {
+            int64_t nTarget = scenario.vTargets[i];
+            vector<char> vfBest;
+            int64_t nBest;
+            unsigned int nCount;
+
+            int64_t nStart = GetTimeMicros();
+            bool fFound = SelectCoinsBnB(vCoins, nTarget, CTransaction::nMinTxFee, vfBest, nBest);
+            nBnBMicros += GetTimeMicros() - nStart;
+            if (fFound)
+            {
+                BOOST_CHECK_EQUAL(selected_total(vCoins, vfBest, nCount), nBest);
+                BOOST_CHECK(nBest >= nTarget && nBest <= nTarget + CTransaction::nMinTxFee);
+                nChangeless++;
+                if (i % 2 == 0)
+                    nChangelessConstructed++;
+            }
+
+            if (nTarget > nTotal)
+                continue;
+            nStart = GetTimeMicros();
+            ApproximateBestSubset(vCoins, nTotal, nTarget, vfBest, nBest, 1000);
+            nApproxMicros += GetTimeMicros() - nStart;
+            BOOST_CHECK_EQUAL(selected_total(vCoins, vfBest, nCount), nBest);
+            BOOST_CHECK(nBest >= nTarget);
+        }
+
+        // most of the targets built from existing outputs must be found
+        BOOST_CHECK_GE(nChangelessConstructed * 4, (int)scenario.vTargets.size() / 2 * 3);
+
+        BOOST_TEST_MESSAGE(strprintf("%s: %u coins, %u targets, %d changeless (%d constructed), bnb %dus, approximate %dus",
+            scenario.strName, scenario.vValues.size(), scenario.vTargets.size(),
+            nChangeless, nChangelessConstructed, nBnBMicros, nApproxMicros));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
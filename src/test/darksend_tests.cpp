@@ -0,0 +1,322 @@
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "darksend.h"
+
+#include "base58.h"
+#include "core.h"
+#include "key.h"
+#include "main.h"
+#include "util.h"
+#include "wallet.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+extern CWallet* pwalletMain;
+
+BOOST_AUTO_TEST_SUITE(darksend_tests)
+
+/*
+    Drives complete mixing sessions through a Masternode pool and its
+    clients in this process. Every message between them is serialized and
+    read back as it would be on the wire, but nothing goes through CNode,
+    so the numbers are the cost of the pool logic itself.
+
+    Only one side runs at a time and fMasterNode is flipped to match it,
+    since the pool reads the global to know which side it is on.
+*/
+
+enum SessionPhase
+{
+    PHASE_QUEUE,      // dsa: collateral checks until the queue is full
+    PHASE_ENTRIES,    // dsi: entries accepted and the final transaction built
+    PHASE_SIGN,       // dsf: every client checks and signs its inputs
+    PHASE_SIGNATURES, // dss: the Masternode verifies and collects the signatures
+    PHASE_COMMIT,     // the final transaction enters the mempool
+    PHASE_COUNT
+};
+
+static const char* phaseNames[PHASE_COUNT] = {"queue", "entries", "sign", "signatures", "commit"};
+
+// what each input pays towards the fee of the final transaction
+static const int64_t SIMULATION_INPUT_FEE = COIN / 1000;
+
+struct SimulatedClient
+{
+    CKey key;
+    CScript scriptPubKey;
+    CDarksendPool pool;
+    int64_t nMicros; // time spent on this client's side of the protocol
+
+    SimulatedClient() : nMicros(0) {}
+};
+
+struct SessionStats
+{
+    int nSessions;
+    int nParticipants;
+    int64_t nPhaseMicros[PHASE_COUNT];
+    int64_t nPhaseMaxMicros[PHASE_COUNT];
+    int64_t nMasternodeMicros;
+
+    SessionStats() : nSessions(0), nParticipants(0), nMasternodeMicros(0)
+    {
+        for (int i = 0; i < PHASE_COUNT; i++)
+            nPhaseMicros[i] = nPhaseMaxMicros[i] = 0;
+    }
+};
+
+// A transaction paying nValue to the client, put straight into the mempool.
+// Its own input doesn't exist; nothing in the pool looks that far back.
+static CTransaction fund(const SimulatedClient& client, int64_t nValue)
+{
+    CTransaction tx;
+    tx.vin.push_back(CTxIn(GetRandHash(), 0));
+    tx.vout.push_back(CTxOut(nValue, client.scriptPubKey));
+    mempool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 0, GetTime(), 0, chainActive.Height()));
+    return tx;
+}
+
+static void run_session(CDarksendPool& masternode, vector<SimulatedClient*>& vClients, int64_t nDenomValue, SessionStats& stats)
+{
+    LOCK(cs_main);
+
+    int64_t nPhaseMicros[PHASE_COUNT];
+    int64_t nStart;
+    for (int i = 0; i < PHASE_COUNT; i++)
+        nPhaseMicros[i] = 0;
+    int64_t nMasternodeMicros = 0;
+
+    // each client brings one denominated input and a collateral
+    vector<CTransaction> vCollateral;
+    vector<vector<CTxIn> > vIn;
+    vector<vector<CTxOut> > vOut;
+    BOOST_FOREACH(SimulatedClient* client, vClients)
+    {
+        CTransaction txFunding = fund(*client, 2 * DARKSEND_COLLATERAL);
+        CTransaction txCollateral;
+        txCollateral.vin.push_back(CTxIn(txFunding.GetHash(), 0));
+        txCollateral.vout.push_back(CTxOut(DARKSEND_COLLATERAL, client->scriptPubKey));
+        BOOST_REQUIRE(SignSignature(*pwalletMain, txFunding, txCollateral, 0));
+        vCollateral.push_back(txCollateral);
+
+        CTransaction txInput = fund(*client, nDenomValue + SIMULATION_INPUT_FEE);
+        CTxIn in(txInput.GetHash(), 0);
+        in.prevPubKey = client->scriptPubKey;
+        vIn.push_back(vector<CTxIn>(1, in));
+        vOut.push_back(vector<CTxOut>(1, CTxOut(nDenomValue, client->scriptPubKey)));
+
+        client->pool.SetNull(true);
+    }
+
+    fMasterNode = true;
+    int nDenom = masternode.GetDenominations(vOut[0]);
+    BOOST_REQUIRE(nDenom != 0);
+
+    // dsa
+    nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < vClients.size(); i++)
+    {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << nDenom << vCollateral[i];
+
+        int nDenomMsg;
+        CTransaction txCollateral;
+        ss >> nDenomMsg >> txCollateral;
+        string strReason;
+        // in unit test mode the pool skips the collateral check and the
+        // queue announcement for the first participant, so check it here
+        BOOST_REQUIRE(masternode.IsCollateralValid(txCollateral));
+        BOOST_REQUIRE_MESSAGE(masternode.IsCompatibleWithSession(nDenomMsg, txCollateral, strReason), strReason);
+    }
+    masternode.CheckForCompleteQueue();
+    BOOST_REQUIRE_EQUAL(masternode.GetState(), POOL_STATUS_ACCEPTING_ENTRIES);
+    nPhaseMicros[PHASE_QUEUE] = GetTimeMicros() - nStart;
+    nMasternodeMicros += nPhaseMicros[PHASE_QUEUE];
+
+    // dsi
+    nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < vClients.size(); i++)
+    {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << vIn[i] << nDenomValue << vCollateral[i] << vOut[i];
+
+        vector<CTxIn> in;
+        int64_t nAmount;
+        CTransaction txCollateral;
+        vector<CTxOut> out;
+        ss >> in >> nAmount >> txCollateral >> out;
+        string strError;
+        BOOST_REQUIRE(masternode.IsCompatibleWithEntries(out));
+        BOOST_REQUIRE_MESSAGE(masternode.AddEntry(in, nAmount, txCollateral, out, strError), strError);
+        masternode.Check();
+    }
+    BOOST_REQUIRE_EQUAL(masternode.GetState(), POOL_STATUS_SIGNING);
+    nPhaseMicros[PHASE_ENTRIES] = GetTimeMicros() - nStart;
+    nMasternodeMicros += nPhaseMicros[PHASE_ENTRIES];
+
+    CDataStream ssFinal(SER_NETWORK, PROTOCOL_VERSION);
+    ssFinal << masternode.sessionID << masternode.finalTransaction;
+
+    // dsf, and the dss each client sends back
+    fMasterNode = false;
+    vector<CDataStream> vSigs;
+    for (unsigned int i = 0; i < vClients.size(); i++)
+    {
+        SimulatedClient* client = vClients[i];
+        nStart = GetTimeMicros();
+
+        CDarkSendEntry e;
+        e.Add(vIn[i], nDenomValue, vCollateral[i], vOut[i]);
+        client->pool.myEntries.push_back(e);
+
+        CDataStream ss(ssFinal);
+        int nSessionID;
+        CTransaction txFinal;
+        ss >> nSessionID >> txFinal;
+        BOOST_REQUIRE(client->pool.SignFinalTransaction(txFinal, NULL));
+
+        vector<CTxIn> sigs;
+        BOOST_FOREACH(const CTxIn& in, client->pool.finalTransaction.vin)
+            if (in.prevout == vIn[i][0].prevout)
+                sigs.push_back(in);
+        BOOST_REQUIRE_EQUAL(sigs.size(), 1U);
+        CDataStream ssSigs(SER_NETWORK, PROTOCOL_VERSION);
+        ssSigs << sigs;
+        vSigs.push_back(ssSigs);
+
+        int64_t nElapsed = GetTimeMicros() - nStart;
+        client->nMicros += nElapsed;
+        nPhaseMicros[PHASE_SIGN] += nElapsed;
+    }
+
+    fMasterNode = true;
+    nStart = GetTimeMicros();
+    BOOST_FOREACH(CDataStream& ss, vSigs)
+    {
+        vector<CTxIn> sigs;
+        ss >> sigs;
+        BOOST_FOREACH(const CTxIn& in, sigs)
+            BOOST_REQUIRE(masternode.AddScriptSig(in));
+    }
+    BOOST_REQUIRE(masternode.SignaturesComplete());
+    nPhaseMicros[PHASE_SIGNATURES] = GetTimeMicros() - nStart;
+    nMasternodeMicros += nPhaseMicros[PHASE_SIGNATURES];
+
+    CTransaction txFinal = masternode.finalTransaction;
+    nStart = GetTimeMicros();
+    masternode.Check();
+    nPhaseMicros[PHASE_COMMIT] = GetTimeMicros() - nStart;
+    nMasternodeMicros += nPhaseMicros[PHASE_COMMIT];
+    fMasterNode = false;
+
+    BOOST_CHECK(mempool.exists(txFinal.GetHash()));
+    BOOST_CHECK_EQUAL(masternode.GetState(), POOL_STATUS_IDLE);
+
+    stats.nSessions++;
+    stats.nParticipants += vClients.size();
+    stats.nMasternodeMicros += nMasternodeMicros;
+    for (int i = 0; i < PHASE_COUNT; i++)
+    {
+        stats.nPhaseMicros[i] += nPhaseMicros[i];
+        stats.nPhaseMaxMicros[i] = max(stats.nPhaseMaxMicros[i], nPhaseMicros[i]);
+    }
+}
+
+// Puts back the globals the benchmark changes, also when a BOOST_REQUIRE
+// ends it early, so the suites that run after it find them as they were
+struct DarksendGlobalsGuard
+{
+    bool fDenominationsSet;
+    string strMasterNodePrivKeyOld;
+
+    DarksendGlobalsGuard()
+    {
+        fDenominationsSet = !darkSendDenominations.empty();
+        strMasterNodePrivKeyOld = strMasterNodePrivKey;
+    }
+
+    ~DarksendGlobalsGuard()
+    {
+        fMasterNode = false;
+        strMasterNodePrivKey = strMasterNodePrivKeyOld;
+        if (!fDenominationsSet)
+            darkSendDenominations.clear();
+
+        // the final transactions were synced into the wallet on their way in
+        vector<uint256> vHashes;
+        mempool.queryHashes(vHashes);
+        BOOST_FOREACH(const uint256& hash, vHashes)
+            pwalletMain->EraseFromWallet(hash);
+        mempool.clear();
+    }
+};
+
+// Runs sessions of GetMaxPoolTransactions() participants, drawn in turn from
+// a larger set of clients. Change POOL_MAX_TRANSACTIONS to compare pool
+// sizes; the results are printed with --log_level=message.
+BOOST_AUTO_TEST_CASE(darksend_session_benchmark)
+{
+    DarksendGlobalsGuard guard;
+
+    // normally set up by AppInit2
+    if (!guard.fDenominationsSet)
+    {
+        darkSendDenominations.push_back( (100      * COIN)+100000 );
+        darkSendDenominations.push_back( (10       * COIN)+10000 );
+        darkSendDenominations.push_back( (1        * COIN)+1000 );
+        darkSendDenominations.push_back( (.1       * COIN)+100 );
+    }
+
+    CKey keyMasternode;
+    keyMasternode.MakeNewKey(false);
+    strMasterNodePrivKey = CBitcoinSecret(keyMasternode).ToString();
+
+    CDarksendPool masternode;
+    masternode.unitTest = true;
+
+    const int nSessions = 20;
+    int nPoolSize = masternode.GetMaxPoolTransactions();
+    vector<SimulatedClient> vClients(nPoolSize * 3);
+    BOOST_FOREACH(SimulatedClient& client, vClients)
+    {
+        client.key.MakeNewKey(true);
+        CPubKey pubkey = client.key.GetPubKey();
+        BOOST_REQUIRE(pwalletMain->AddKeyPubKey(client.key, pubkey));
+        client.scriptPubKey.SetDestination(pubkey.GetID());
+    }
+
+    SessionStats stats;
+    int64_t nStart = GetTimeMicros();
+    for (int i = 0; i < nSessions; i++)
+    {
+        vector<SimulatedClient*> vSession;
+        for (int j = 0; j < nPoolSize; j++)
+            vSession.push_back(&vClients[(i * nPoolSize + j) % vClients.size()]);
+        run_session(masternode, vSession, darkSendDenominations[2], stats);
+    }
+    int64_t nTotalMicros = GetTimeMicros() - nStart;
+
+    BOOST_CHECK_EQUAL(stats.nSessions, nSessions);
+
+    BOOST_TEST_MESSAGE(strprintf("%d sessions of %d participants in %dms, %.1f sessions per minute",
+        stats.nSessions, nPoolSize, nTotalMicros / 1000, stats.nSessions * 60e6 / max(nTotalMicros, (int64_t)1)));
+    for (int i = 0; i < PHASE_COUNT; i++)
+        BOOST_TEST_MESSAGE(strprintf("  %-10s avg %6dus max %6dus", phaseNames[i],
+            stats.nPhaseMicros[i] / stats.nSessions, stats.nPhaseMaxMicros[i]));
+    int64_t nClientMicros = 0;
+    BOOST_FOREACH(const SimulatedClient& client, vClients)
+        nClientMicros += client.nMicros;
+    BOOST_TEST_MESSAGE(strprintf("  per participant: Masternode %dus, client %dus",
+        stats.nMasternodeMicros / stats.nParticipants, nClientMicros / stats.nParticipants));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
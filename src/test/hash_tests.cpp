@@ -46,4 +46,16 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+BOOST_AUTO_TEST_CASE(siphash)
+{
+    // Reference vector for the 32-byte message 00 01 .. 1f under key 00 01 .. 0f
+    uint256 x;
+    for (int i = 0; i < 32; i++)
+        x.begin()[i] = i;
+    BOOST_CHECK_EQUAL(SipHashUint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, x), 0x7127512f72f27cceULL);
+
+    // The key actually salts the result
+    BOOST_CHECK(SipHashUint256(1, 2, x) != SipHashUint256(2, 1, x));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,135 @@
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "jsonreader.h"
+
+#include "util.h"
+
+#include <stdint.h>
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+#include "json/json_spirit_reader_template.h"
+#include "json/json_spirit_writer_template.h"
+
+using namespace std;
+using namespace json_spirit;
+
+// Both readers must agree on the value; compare through the writer
+static void CheckSameAsSpirit(const string& strJSON)
+{
+    Value valSpirit, valFast;
+    BOOST_CHECK_MESSAGE(read_string(strJSON, valSpirit), strJSON);
+    BOOST_CHECK_MESSAGE(ReadJSON(strJSON, valFast), strJSON);
+    BOOST_CHECK_EQUAL(write_string(valFast, false), write_string(valSpirit, false));
+    BOOST_CHECK_EQUAL(valFast.type(), valSpirit.type());
+}
+
+// A batch of createrawtransaction calls like the ones payout scripts send
+static string BatchRequest(int nEntries)
+{
+    string strBatch = "[";
+    for (int i = 0; i < nEntries; i++)
+    {
+        if (i > 0)
+            strBatch += ",";
+        strBatch += strprintf("{\"jsonrpc\": \"1.0\", \"id\": %d, \"method\": \"createrawtransaction\", \"params\": "
+            "[[{\"txid\": \"a3a4a4ea2b0cd5dce5b1c9a4b8c6f1d6e7b9a8c7d6e5f4a3b2c1d0e9f8a7b6c5\", \"vout\": %d}], "
+            "{\"XmJ7vXfWgoJvc7dMSq6vGx5xJvGYYkLwyV\": %d.%08d, \"XrUbNQjsp7QgBf6rJkf2oP1mzA7bFpJYFu\": 0.17622195}]}",
+            i, i % 4, i, i * 7919 % 100000000);
+    }
+    strBatch += "]";
+    return strBatch;
+}
+
+BOOST_AUTO_TEST_SUITE(jsonreader_tests)
+
+BOOST_AUTO_TEST_CASE(jsonreader_values)
+{
+    CheckSameAsSpirit("null");
+    CheckSameAsSpirit("true");
+    CheckSameAsSpirit(" false ");
+    CheckSameAsSpirit("0");
+    CheckSameAsSpirit("-42");
+    CheckSameAsSpirit("9223372036854775807");
+    CheckSameAsSpirit("-9223372036854775808");
+    CheckSameAsSpirit("18446744073709551615");
+    CheckSameAsSpirit("0.17622195");
+    CheckSameAsSpirit("20999999.99999999");
+    CheckSameAsSpirit("-1.5e3");
+    CheckSameAsSpirit("1.234567890123456789012");
+    CheckSameAsSpirit("\"\"");
+    CheckSameAsSpirit("\"tab\\there \\\"quoted\\\" \\\\ \\/ \\b\\f\\n\\r\"");
+    CheckSameAsSpirit("\"\\u00e9\\x41\"");
+    CheckSameAsSpirit("[]");
+    CheckSameAsSpirit("{}");
+    CheckSameAsSpirit("[1, [2, [3, {}]], {\"a\": []}]");
+    CheckSameAsSpirit("{\"a\": 1, \"a\": 2, \"b\": {\"c\": [true, null]}}");
+    CheckSameAsSpirit("\n\t{ \"method\" : \"getinfo\" , \"params\" : [ ] , \"id\" : 1 }\r\n");
+    CheckSameAsSpirit(BatchRequest(10));
+
+    // Integers keep json_spirit's int64/uint64 split
+    Value val;
+    BOOST_CHECK(ReadJSON("9223372036854775808", val));
+    BOOST_CHECK(val.is_uint64());
+    BOOST_CHECK(ReadJSON("9223372036854775807", val));
+    BOOST_CHECK(!val.is_uint64() && val.get_int64() == 9223372036854775807LL);
+    BOOST_CHECK(ReadJSON("[1.0]", val));
+    BOOST_CHECK(val.get_array()[0].type() == real_type);
+
+    // An existing value is replaced, not merged into
+    BOOST_CHECK(ReadJSON("null", val));
+    BOOST_CHECK(val.is_null());
+}
+
+BOOST_AUTO_TEST_CASE(jsonreader_invalid)
+{
+    Value val;
+    BOOST_CHECK(!ReadJSON("", val));
+    BOOST_CHECK(!ReadJSON("   ", val));
+    BOOST_CHECK(!ReadJSON("nul", val));
+    BOOST_CHECK(!ReadJSON("truex", val));
+    BOOST_CHECK(!ReadJSON("[1,]", val));
+    BOOST_CHECK(!ReadJSON("[1 2]", val));
+    BOOST_CHECK(!ReadJSON("{\"a\" 1}", val));
+    BOOST_CHECK(!ReadJSON("{1: 2}", val));
+    BOOST_CHECK(!ReadJSON("{\"a\": 1", val));
+    BOOST_CHECK(!ReadJSON("\"unterminated", val));
+    BOOST_CHECK(!ReadJSON("\"bad \\q escape\"", val));
+    BOOST_CHECK(!ReadJSON("\"\\u12\"", val));
+    BOOST_CHECK(!ReadJSON("-", val));
+    BOOST_CHECK(!ReadJSON("1e", val));
+    BOOST_CHECK(!ReadJSON("18446744073709551616", val));
+    BOOST_CHECK(!ReadJSON("-9223372036854775809", val));
+    BOOST_CHECK(!ReadJSON("{} {}", val));
+    BOOST_CHECK(!ReadJSON("1 trailing", val));
+
+    // Nesting is bounded
+    string strDeep(MAX_JSON_DEPTH, '[');
+    strDeep += string(MAX_JSON_DEPTH, ']');
+    BOOST_CHECK(ReadJSON(strDeep, val));
+    strDeep = "[" + strDeep + "]";
+    BOOST_CHECK(!ReadJSON(strDeep, val));
+}
+
+BOOST_AUTO_TEST_CASE(jsonreader_benchmark)
+{
+    string strBatch = BatchRequest(2000);
+    Value valSpirit, valFast;
+
+    int64_t nStart = GetTimeMicros();
+    BOOST_CHECK(read_string(strBatch, valSpirit));
+    int64_t nSpirit = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    BOOST_CHECK(ReadJSON(strBatch, valFast));
+    int64_t nFast = GetTimeMicros() - nStart;
+
+    BOOST_CHECK(write_string(valFast, false) == write_string(valSpirit, false));
+    BOOST_TEST_MESSAGE(strprintf("2000 entry batch (%u bytes): json_spirit %dus, ReadJSON %dus",
+                                 strBatch.size(), nSpirit, nFast));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,8 @@
 #include "base58.h"
 
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 
 using namespace std;
@@ -138,4 +140,103 @@ BOOST_AUTO_TEST_CASE(rpc_parse_monetary_values)
     BOOST_CHECK(AmountFromValue(ValueFromString("20999999.99999999")) == 2099999999999999LL);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_parse_http_request)
+{
+    HTTPRequest req;
+    size_t nConsumed = 0;
+
+    // Two pipelined requests in one buffer
+    string strFirst = "POST / HTTP/1.1\r\nAuthorization: Basic dXNlcjpwYXNz\r\nContent-Length: 12\r\n\r\n{\"id\":1,\"a\"}";
+    string strSecond = "POST / HTTP/1.0\r\nContent-Length: 2\r\n\r\n[]";
+    string strBuf = strFirst + strSecond;
+
+    BOOST_CHECK(ParseHTTPRequest(strBuf.data(), strBuf.data() + strBuf.size(), req, nConsumed) == HTTP_PARSE_COMPLETE);
+    BOOST_CHECK_EQUAL(nConsumed, strFirst.size());
+    BOOST_CHECK_EQUAL(req.strMethod, "POST");
+    BOOST_CHECK_EQUAL(req.strURI, "/");
+    BOOST_CHECK_EQUAL(req.nProto, 1);
+    BOOST_CHECK_EQUAL(req.strBody, "{\"id\":1,\"a\"}");
+    BOOST_CHECK_EQUAL(req.mapHeaders["authorization"], "Basic dXNlcjpwYXNz");
+    BOOST_CHECK_EQUAL(req.mapHeaders["connection"], "keep-alive");
+
+    strBuf.erase(0, nConsumed);
+    BOOST_CHECK(ParseHTTPRequest(strBuf.data(), strBuf.data() + strBuf.size(), req, nConsumed) == HTTP_PARSE_COMPLETE);
+    BOOST_CHECK_EQUAL(nConsumed, strSecond.size());
+    BOOST_CHECK_EQUAL(req.strBody, "[]");
+    BOOST_CHECK_EQUAL(req.mapHeaders["connection"], "close");
+
+    // Truncated headers or body need more data
+    BOOST_CHECK(ParseHTTPRequest(strFirst.data(), strFirst.data() + 20, req, nConsumed) == HTTP_PARSE_INCOMPLETE);
+    BOOST_CHECK(ParseHTTPRequest(strFirst.data(), strFirst.data() + strFirst.size() - 1, req, nConsumed) == HTTP_PARSE_INCOMPLETE);
+
+    // Malformed request lines are rejected
+    string strBad = "DELETE / HTTP/1.1\r\n\r\n";
+    BOOST_CHECK(ParseHTTPRequest(strBad.data(), strBad.data() + strBad.size(), req, nConsumed) == HTTP_PARSE_INVALID);
+    strBad = "POST nothing HTTP/1.1\r\n\r\n";
+    BOOST_CHECK(ParseHTTPRequest(strBad.data(), strBad.data() + strBad.size(), req, nConsumed) == HTTP_PARSE_INVALID);
+}
+
+static void AppendChunk(string& strOut, int& nChunks, const string& strChunk)
+{
+    strOut += strChunk;
+    nChunks++;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_stream_writer)
+{
+    Object entry;
+    entry.push_back(Pair("txid", "7a\"b\\c"));
+    entry.push_back(Pair("amount", ValueFromAmount(17622195LL)));
+    entry.push_back(Pair("confirmations", 6));
+    entry.push_back(Pair("spendable", true));
+    entry.push_back(Pair("account", Value::null));
+    Array entries;
+    for (int i = 0; i < 50; i++)
+        entries.push_back(entry);
+    Object result;
+    result.push_back(Pair("empty", Array()));
+    result.push_back(Pair("entries", entries));
+
+    // A small flush size forces the output through the sink in many pieces
+    string strOut;
+    int nChunks = 0;
+    CJSONStreamWriter writer(boost::bind(&AppendChunk, boost::ref(strOut), boost::ref(nChunks), _1), 64);
+    BOOST_CHECK(!writer.HasFlushed());
+    writer.BeginObject();
+    writer.Key("result");
+    writer.BeginObject();
+    writer.Key("empty");
+    writer.BeginArray();
+    writer.EndArray();
+    writer.Key("entries");
+    writer.BeginArray();
+    BOOST_FOREACH(const Value& v, entries)
+        writer.Write(v);
+    writer.EndArray();
+    writer.EndObject();
+    writer.Key("error");
+    writer.Write(Value::null);
+    writer.Key("id");
+    writer.Write(1);
+    writer.EndObject();
+    writer.Flush();
+
+    BOOST_CHECK(writer.HasFlushed());
+    BOOST_CHECK(nChunks > 10);
+    BOOST_CHECK_EQUAL(strOut + "\n", JSONRPCReply(result, Value::null, 1));
+
+    // Pairs and escaped keys match json_spirit too
+    Object obj;
+    obj.push_back(Pair("a\tb", "x"));
+    obj.push_back(Pair("c", 1.5));
+    strOut.clear();
+    CJSONStreamWriter writer2(boost::bind(&AppendChunk, boost::ref(strOut), boost::ref(nChunks), _1));
+    writer2.BeginObject();
+    BOOST_FOREACH(const Pair& pair, obj)
+        writer2.WritePair(pair);
+    writer2.EndObject();
+    writer2.Flush();
+    BOOST_CHECK_EQUAL(strOut, write_string(Value(obj), false));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,94 @@
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "scheduler.h"
+
+#include "util.h"
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(scheduler_tests)
+
+static boost::mutex mutexRecord;
+static vector<int> vRecorded;
+static vector<int64_t> vRecordedTimes;
+
+static void Record(int n)
+{
+    boost::unique_lock<boost::mutex> lock(mutexRecord);
+    vRecorded.push_back(n);
+    vRecordedTimes.push_back(GetTimeMillis());
+}
+
+BOOST_AUTO_TEST_CASE(scheduler_order)
+{
+    vRecorded.clear();
+    vRecordedTimes.clear();
+
+    // a small wheel, 80ms per lap, so the later tasks have to wait out laps
+    CScheduler scheduler(10, 8);
+    int64_t nStart = GetTimeMillis();
+    scheduler.Schedule(boost::bind(&Record, 3), 300);
+    scheduler.Schedule(boost::bind(&Record, 1), 50);
+    scheduler.Schedule(boost::bind(&Record, 2), 150);
+    scheduler.ScheduleNow(boost::bind(&Record, 0));
+    BOOST_CHECK_EQUAL(scheduler.size(), 4U);
+
+    boost::thread thread(boost::bind(&CScheduler::ServiceQueue, &scheduler));
+    MilliSleep(500);
+    thread.interrupt();
+    thread.join();
+
+    BOOST_CHECK_EQUAL(scheduler.size(), 0U);
+    BOOST_REQUIRE_EQUAL(vRecorded.size(), 4U);
+    for (int i = 0; i < 4; i++)
+        BOOST_CHECK_EQUAL(vRecorded[i], i);
+
+    // never early
+    BOOST_CHECK_GE(vRecordedTimes[1] - nStart, 50);
+    BOOST_CHECK_GE(vRecordedTimes[2] - nStart, 150);
+    BOOST_CHECK_GE(vRecordedTimes[3] - nStart, 300);
+}
+
+BOOST_AUTO_TEST_CASE(scheduler_periodic)
+{
+    vRecorded.clear();
+    vRecordedTimes.clear();
+
+    CScheduler scheduler(100, 8);
+    scheduler.ScheduleEvery(boost::bind(&Record, 1), 100, 0);
+
+    boost::thread thread(boost::bind(&CScheduler::ServiceQueue, &scheduler));
+    MilliSleep(550);
+
+    // a task scheduled now runs without waiting for the end of the tick
+    int64_t nNow = GetTimeMillis();
+    scheduler.ScheduleNow(boost::bind(&Record, 2));
+    MilliSleep(50);
+    thread.interrupt();
+    thread.join();
+
+    // the periodic task stays queued
+    BOOST_CHECK_EQUAL(scheduler.size(), 1U);
+
+    int nPeriodic = 0;
+    for (unsigned int i = 0; i < vRecorded.size(); i++)
+    {
+        if (vRecorded[i] == 1)
+            nPeriodic++;
+        else
+            BOOST_CHECK_LT(vRecordedTimes[i] - nNow, 50);
+    }
+    // at 0, 100, ... 500ms, give or take scheduling jitter
+    BOOST_CHECK_GE(nPeriodic, 4);
+    BOOST_CHECK_LE(nPeriodic, 7);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,145 @@
+// Copyright (c) 2014 The Bitcoin Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "main.h"
+#include "util.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#define SKIPLIST_LENGTH 300000
+
+BOOST_AUTO_TEST_SUITE(skiplist_tests)
+
+BOOST_AUTO_TEST_CASE(skiplist_test)
+{
+    std::vector<CBlockIndex> vIndex(SKIPLIST_LENGTH);
+
+    for (int i=0; i<SKIPLIST_LENGTH; i++) {
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = (i == 0) ? NULL : &vIndex[i - 1];
+        vIndex[i].BuildSkip();
+    }
+
+    for (int i=0; i<SKIPLIST_LENGTH; i++) {
+        if (i > 0) {
+            BOOST_CHECK(vIndex[i].pskip == &vIndex[vIndex[i].pskip->nHeight]);
+            BOOST_CHECK(vIndex[i].pskip->nHeight < i);
+        } else {
+            BOOST_CHECK(vIndex[i].pskip == NULL);
+        }
+    }
+
+    for (int i=0; i < 1000; i++) {
+        int from = GetRand(SKIPLIST_LENGTH - 1);
+        int to = GetRand(from + 1);
+
+        BOOST_CHECK(vIndex[SKIPLIST_LENGTH - 1].GetAncestor(from) == &vIndex[from]);
+        BOOST_CHECK(vIndex[from].GetAncestor(to) == &vIndex[to]);
+        BOOST_CHECK(vIndex[from].GetAncestor(0) == &vIndex[0]);
+    }
+
+    BOOST_CHECK(vIndex[10].GetAncestor(11) == NULL);
+    BOOST_CHECK(vIndex[10].GetAncestor(-1) == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(getlocator_test)
+{
+    // Build a main chain 100000 blocks long.
+    std::vector<uint256> vHashMain(100000);
+    std::vector<CBlockIndex> vBlocksMain(100000);
+    for (unsigned int i=0; i<vBlocksMain.size(); i++) {
+        vHashMain[i] = i; // Set the hash equal to the height, so we can quickly check the distances.
+        vBlocksMain[i].nHeight = i;
+        vBlocksMain[i].pprev = i ? &vBlocksMain[i - 1] : NULL;
+        vBlocksMain[i].phashBlock = &vHashMain[i];
+        vBlocksMain[i].BuildSkip();
+        BOOST_CHECK_EQUAL((int)vBlocksMain[i].GetBlockHash().GetLow64(), vBlocksMain[i].nHeight);
+        BOOST_CHECK(vBlocksMain[i].pprev == NULL || vBlocksMain[i].nHeight == vBlocksMain[i].pprev->nHeight + 1);
+    }
+
+    // Build a branch that splits off at block 49999, 50000 blocks long.
+    std::vector<uint256> vHashSide(50000);
+    std::vector<CBlockIndex> vBlocksSide(50000);
+    for (unsigned int i=0; i<vBlocksSide.size(); i++) {
+        vHashSide[i] = i + 50000 + (uint256(1) << 128); // Add 1<<128 to the hashes, so GetLow64() still returns the height.
+        vBlocksSide[i].nHeight = i + 50000;
+        vBlocksSide[i].pprev = i ? &vBlocksSide[i - 1] : &vBlocksMain[49999];
+        vBlocksSide[i].phashBlock = &vHashSide[i];
+        vBlocksSide[i].BuildSkip();
+        BOOST_CHECK_EQUAL((int)vBlocksSide[i].GetBlockHash().GetLow64(), vBlocksSide[i].nHeight);
+        BOOST_CHECK(vBlocksSide[i].pprev == NULL || vBlocksSide[i].nHeight == vBlocksSide[i].pprev->nHeight + 1);
+    }
+
+    // Build a CChain for the main branch.
+    CChain chain;
+    chain.SetTip(&vBlocksMain.back());
+
+    // Test 100 random starting points for locators.
+    for (int n=0; n<100; n++) {
+        int r = GetRand(150000);
+        CBlockIndex* tip = (r < 100000) ? &vBlocksMain[r] : &vBlocksSide[r - 100000];
+        CBlockLocator locator = chain.GetLocator(tip);
+
+        // The first result must be the block itself, the last one must be genesis.
+        BOOST_CHECK(locator.vHave.front() == tip->GetBlockHash());
+        BOOST_CHECK(locator.vHave.back() == vBlocksMain[0].GetBlockHash());
+
+        // Entries 1 through 11 (inclusive) go back one step each.
+        for (unsigned int i = 1; i < 12 && i < locator.vHave.size() - 1; i++) {
+            BOOST_CHECK_EQUAL(locator.vHave[i].GetLow64(), tip->nHeight - i);
+        }
+
+        // The further ones (excluding the last one) go back with exponential steps.
+        unsigned int dist = 2;
+        for (unsigned int i = 12; i < locator.vHave.size() - 1; i++) {
+            BOOST_CHECK_EQUAL(locator.vHave[i - 1].GetLow64() - locator.vHave[i].GetLow64(), dist);
+            dist *= 2;
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(setTip_reorg_test)
+{
+    // Main chain of 1000 blocks and a 300 block branch off block 799
+    std::vector<uint256> vHashMain(1000);
+    std::vector<CBlockIndex> vBlocksMain(1000);
+    for (unsigned int i=0; i<vBlocksMain.size(); i++) {
+        vHashMain[i] = i;
+        vBlocksMain[i].nHeight = i;
+        vBlocksMain[i].pprev = i ? &vBlocksMain[i - 1] : NULL;
+        vBlocksMain[i].phashBlock = &vHashMain[i];
+        vBlocksMain[i].BuildSkip();
+    }
+    std::vector<uint256> vHashSide(300);
+    std::vector<CBlockIndex> vBlocksSide(300);
+    for (unsigned int i=0; i<vBlocksSide.size(); i++) {
+        vHashSide[i] = i + 800 + (uint256(1) << 128);
+        vBlocksSide[i].nHeight = i + 800;
+        vBlocksSide[i].pprev = i ? &vBlocksSide[i - 1] : &vBlocksMain[799];
+        vBlocksSide[i].phashBlock = &vHashSide[i];
+        vBlocksSide[i].BuildSkip();
+    }
+
+    CChain chain;
+    chain.SetTip(&vBlocksMain.back());
+    BOOST_CHECK(chain[900] == &vBlocksMain[900]);
+
+    // Height lookups follow the new branch after a reorg, and agree with the skiplist
+    BOOST_CHECK(chain.SetTip(&vBlocksSide.back()) == &vBlocksMain[799]);
+    BOOST_CHECK_EQUAL(chain.Height(), 1099);
+    for (int nHeight = 0; nHeight <= chain.Height(); nHeight++)
+        BOOST_CHECK(chain[nHeight] == chain.Tip()->GetAncestor(nHeight));
+    BOOST_CHECK(chain[900] == &vBlocksSide[100]);
+    BOOST_CHECK(!chain.Contains(&vBlocksMain[900]));
+
+    // And back again, to a shorter tip
+    BOOST_CHECK(chain.SetTip(&vBlocksMain[850]) == &vBlocksMain[799]);
+    BOOST_CHECK_EQUAL(chain.Height(), 850);
+    BOOST_CHECK(chain[851] == NULL);
+    BOOST_CHECK(chain[850] == &vBlocksMain[850]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,92 @@
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sync.h"
+#include "util.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+static volatile bool fWaiterStarted = false;
+
+static void LockBriefly(CCriticalSection* pcs)
+{
+    fWaiterStarted = true;
+    LOCK(*pcs);
+}
+
+static const CLockSiteStats* FindLockStats(const std::vector<CLockSiteStats>& vStats, const std::string& strName)
+{
+    for (unsigned int i = 0; i < vStats.size(); i++)
+        if (vStats[i].strName == strName)
+            return &vStats[i];
+    return NULL;
+}
+
+BOOST_AUTO_TEST_SUITE(sync_tests)
+
+BOOST_AUTO_TEST_CASE(lockstats_contention)
+{
+    std::vector<CLockSiteStats> vStats;
+    GetLockStats(vStats, true);
+    fLockStats = true;
+    nLockStatsSampleRate = 1;
+
+    // A wait is only recorded once the waiter gets the lock, and the waiter
+    // can be descheduled before it reaches it. Hold the lock longer each round
+    // until a round has seen the wait, rather than trusting one sleep.
+    CCriticalSection cs;
+    int64_t nHeldMicros = 0;
+    const CLockSiteStats* pwaiter = NULL;
+    for (int64_t nHoldMillis = 10; nHoldMillis <= 10240 && pwaiter == NULL; nHoldMillis *= 2)
+    {
+        fWaiterStarted = false;
+        boost::thread* pthread;
+        {
+            LOCK(cs);
+            int64_t nLocked = GetTimeMicros();
+            pthread = new boost::thread(boost::bind(&LockBriefly, &cs));
+            while (!fWaiterStarted)
+                MilliSleep(1);
+            MilliSleep(nHoldMillis);
+            nHeldMicros = GetTimeMicros() - nLocked;
+        }
+        pthread->join();
+        delete pthread;
+
+        GetLockStats(vStats, true);
+        pwaiter = FindLockStats(vStats, "*pcs");
+        if (pwaiter != NULL && pwaiter->nContended == 0)
+            pwaiter = NULL;
+    }
+
+    fLockStats = false;
+    nLockStatsSampleRate = 0;
+
+    // The holder was sampled for at least as long as it held the lock
+    const CLockSiteStats* pholder = FindLockStats(vStats, "cs");
+    BOOST_REQUIRE(pholder != NULL);
+    BOOST_CHECK_EQUAL(pholder->nSampled, 1U);
+    BOOST_CHECK(pholder->nMaxHoldMicros >= nHeldMicros);
+    BOOST_CHECK_EQUAL(pholder->nContended, 0U);
+
+    // The other thread had to wait for it
+    BOOST_REQUIRE(pwaiter != NULL);
+    BOOST_CHECK_EQUAL(pwaiter->nContended, 1U);
+    BOOST_CHECK(pwaiter->nWaitMicros > 0);
+    BOOST_CHECK_EQUAL(pwaiter->nSampled, 1U);
+
+    // Reset cleared everything, and nothing is recorded while disabled
+    {
+        LOCK(cs);
+    }
+    GetLockStats(vStats, false);
+    BOOST_CHECK(vStats.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,83 @@
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "trace.h"
+#include "util.h"
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/test/unit_test.hpp>
+
+static std::string ReadFile(const boost::filesystem::path& path)
+{
+    boost::filesystem::ifstream file(path);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+static size_t CountOccurrences(const std::string& str, const std::string& strFind)
+{
+    size_t n = 0;
+    for (size_t pos = str.find(strFind); pos != std::string::npos; pos = str.find(strFind, pos + 1))
+        n++;
+    return n;
+}
+
+BOOST_AUTO_TEST_SUITE(trace_tests)
+
+BOOST_AUTO_TEST_CASE(trace_capture)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    uint64_t nEvents, nDropped;
+
+    // Nothing is recorded outside a capture
+    {
+        CTraceSpan span("before");
+    }
+
+    StartTraceCapture();
+    {
+        CTraceSpan outer("outer");
+        for (int i = 0; i < 3; i++)
+        {
+            CTraceSpan inner("ProcessMessage", "dseep");
+        }
+        // Characters that would need escaping in JSON are replaced
+        CTraceSpan odd("ProcessMessage", "a\"b\\c");
+    }
+    BOOST_CHECK(StopTraceCapture(path.string(), nEvents, nDropped));
+    BOOST_CHECK_EQUAL(nEvents, 5U);
+    BOOST_CHECK_EQUAL(nDropped, 0U);
+
+    std::string strTrace = ReadFile(path);
+    BOOST_CHECK_EQUAL(strTrace.substr(0, 15), "{\"traceEvents\":");
+    BOOST_CHECK_EQUAL(CountOccurrences(strTrace, "\"name\":\"ProcessMessage:dseep\""), 3U);
+    BOOST_CHECK_EQUAL(CountOccurrences(strTrace, "\"name\":\"outer\""), 1U);
+    BOOST_CHECK_EQUAL(CountOccurrences(strTrace, "\"name\":\"ProcessMessage:a_b_c\""), 1U);
+    BOOST_CHECK_EQUAL(CountOccurrences(strTrace, "\"before\""), 0U);
+    BOOST_CHECK_EQUAL(CountOccurrences(strTrace, "\"ph\":\"M\""), 1U);
+
+    // Stopping clears the buffers, and spans after it are not recorded
+    {
+        CTraceSpan span("after");
+    }
+    StartTraceCapture();
+    BOOST_CHECK(StopTraceCapture(path.string(), nEvents, nDropped));
+    BOOST_CHECK_EQUAL(nEvents, 0U);
+
+    // A wrapped buffer keeps the newest spans
+    StartTraceCapture();
+    for (int i = 0; i < 20000; i++)
+    {
+        CTraceSpan span("loop");
+    }
+    BOOST_CHECK(StopTraceCapture(path.string(), nEvents, nDropped));
+    BOOST_CHECK_EQUAL(nEvents, 16384U);
+    BOOST_CHECK_EQUAL(nDropped, 20000U - 16384U);
+
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
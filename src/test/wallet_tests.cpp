@@ -303,4 +303,44 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(output_class_tests)
+{
+    // the denominations are only known after the wallet is loaded
+    vector<int64_t> vDenominationsOld = darkSendDenominations;
+    darkSendDenominations.clear();
+
+    int64_t nDenom = 10*COIN + 10000;
+    CTransaction tx;
+    tx.vout.resize(4);
+    tx.vout[0].nValue = nDenom;
+    tx.vout[1].nValue = 3 * DARKSEND_COLLATERAL;
+    tx.vout[2].nValue = 1000*COIN;
+    tx.vout[3].nValue = 2*COIN;
+    CWalletTx wtx(&wallet, tx);
+
+    wtx.ClassifyOutputs();
+    BOOST_CHECK_EQUAL(wtx.GetOutputClass(0), OUTPUT_CLASS_OTHER);
+    BOOST_CHECK(!wtx.IsDenominatedOutput(0));
+    BOOST_CHECK(!wallet.IsDenominatedAmount(nDenom));
+
+    // filling them in reclassifies on the next lookup
+    darkSendDenominations.push_back(100*COIN + 100000);
+    darkSendDenominations.push_back(nDenom);
+    BOOST_CHECK_EQUAL(wtx.GetOutputClass(0), 1);
+    BOOST_CHECK(wtx.IsDenominatedOutput(0));
+    BOOST_CHECK(wallet.IsDenominatedAmount(nDenom));
+
+    BOOST_CHECK_EQUAL(wtx.GetOutputClass(1), OUTPUT_CLASS_COLLATERAL);
+    BOOST_CHECK(!wtx.IsDenominatedOutput(1));
+    BOOST_CHECK(wallet.IsCollateralAmount(tx.vout[1].nValue));
+    BOOST_CHECK(!wallet.IsCollateralAmount(DARKSEND_COLLATERAL));
+
+    BOOST_CHECK_EQUAL(wtx.GetOutputClass(2), OUTPUT_CLASS_MASTERNODE);
+    BOOST_CHECK_EQUAL(wtx.GetOutputClass(3), OUTPUT_CLASS_OTHER);
+    BOOST_CHECK(!wallet.IsDenominatedAmount(tx.vout[3].nValue));
+    BOOST_CHECK(!wallet.IsCollateralAmount(tx.vout[3].nValue));
+
+    darkSendDenominations = vDenominationsOld;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
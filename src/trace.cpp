@@ -0,0 +1,218 @@
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "trace.h"
+
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+volatile bool fTraceCapture = false;
+
+// Spans per thread kept during a capture; older ones are overwritten
+static const unsigned int TRACE_BUFFER_SIZE = 16384;
+static const unsigned int TRACE_NAME_SIZE = 40;
+
+struct CTraceEvent
+{
+    int64_t nStart;
+    int64_t nDuration;
+    char szName[TRACE_NAME_SIZE];
+};
+
+/**
+ * Ring of recent spans of one thread. Only that thread writes to it; the
+ * mutex is there for the capture being stopped and read from another
+ * thread, so it is practically never contended.
+ */
+class CTraceBuffer
+{
+public:
+    boost::mutex mutex;
+    int nThread;
+    std::string strThreadName;
+    std::vector<CTraceEvent> vEvents;
+    uint64_t nWritten;
+    bool fThreadExited;
+
+    CTraceBuffer(int nThreadIn, const std::string& strThreadNameIn) :
+        nThread(nThreadIn), strThreadName(strThreadNameIn), nWritten(0), fThreadExited(false) {}
+};
+
+// Every buffer ever handed to a thread, so a capture can be collected from
+// all of them. Heap allocated and never freed, like the debug log state in
+// util.cpp, because threads may still trace during global destruction.
+static boost::once_flag traceInitFlag = BOOST_ONCE_INIT;
+static boost::mutex* mutexTraceBuffers = NULL;
+static std::vector<CTraceBuffer*>* vTraceBuffers = NULL;
+static int nTraceThreads = 0;
+
+static void TraceThreadExit(CTraceBuffer* pbuffer)
+{
+    // The buffer stays registered until the next capture starts or stops
+    boost::mutex::scoped_lock lock(pbuffer->mutex);
+    pbuffer->fThreadExited = true;
+}
+
+static boost::thread_specific_ptr<CTraceBuffer> traceBuffer(&TraceThreadExit);
+
+static void TraceInit()
+{
+    mutexTraceBuffers = new boost::mutex();
+    vTraceBuffers = new std::vector<CTraceBuffer*>();
+}
+
+static std::string GetThreadName(int nThread)
+{
+#if defined(PR_GET_NAME)
+    char szName[17] = {0};
+    if (::prctl(PR_GET_NAME, szName, 0, 0, 0) == 0 && szName[0] != 0)
+        return std::string(szName);
+#endif
+    return strprintf("thread-%d", nThread);
+}
+
+static CTraceBuffer* GetTraceBuffer()
+{
+    CTraceBuffer* pbuffer = traceBuffer.get();
+    if (pbuffer == NULL)
+    {
+        boost::call_once(&TraceInit, traceInitFlag);
+        boost::mutex::scoped_lock lock(*mutexTraceBuffers);
+        int nThread = ++nTraceThreads;
+        pbuffer = new CTraceBuffer(nThread, GetThreadName(nThread));
+        vTraceBuffers->push_back(pbuffer);
+        traceBuffer.reset(pbuffer);
+    }
+    return pbuffer;
+}
+
+static void RecordSpan(const char* pszName, const std::string& strDetail, int64_t nStart, int64_t nEnd)
+{
+    CTraceBuffer* pbuffer = GetTraceBuffer();
+    boost::mutex::scoped_lock lock(pbuffer->mutex);
+    if (!fTraceCapture)
+        return;
+    if (pbuffer->vEvents.size() < TRACE_BUFFER_SIZE)
+        pbuffer->vEvents.resize(pbuffer->vEvents.size() + 1);
+    CTraceEvent& event = pbuffer->vEvents[pbuffer->nWritten % TRACE_BUFFER_SIZE];
+    pbuffer->nWritten++;
+    event.nStart = nStart;
+    event.nDuration = nEnd - nStart;
+
+    // Names end up in a JSON string; keep them to characters that need no escaping
+    std::string strName(pszName);
+    if (!strDetail.empty())
+        strName += ":" + strDetail;
+    unsigned int n = std::min((unsigned int)strName.size(), TRACE_NAME_SIZE - 1);
+    for (unsigned int i = 0; i < n; i++)
+    {
+        char c = strName[i];
+        bool fSafe = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == ':' || c == '.' || c == '-';
+        event.szName[i] = fSafe ? c : '_';
+    }
+    event.szName[n] = 0;
+}
+
+CTraceSpan::CTraceSpan(const char* pszNameIn) : pszName(pszNameIn), nStart(0)
+{
+    if (fTraceCapture)
+        nStart = GetTimeMicros();
+}
+
+CTraceSpan::CTraceSpan(const char* pszNameIn, const std::string& strDetailIn) : pszName(pszNameIn), nStart(0)
+{
+    if (fTraceCapture)
+    {
+        strDetail = strDetailIn;
+        nStart = GetTimeMicros();
+    }
+}
+
+CTraceSpan::~CTraceSpan()
+{
+    if (nStart != 0 && fTraceCapture)
+        RecordSpan(pszName, strDetail, nStart, GetTimeMicros());
+}
+
+// Caller holds mutexTraceBuffers. Drop the buffers of threads that ended and
+// empty the others.
+static void ResetTraceBuffers()
+{
+    std::vector<CTraceBuffer*> vKeep;
+    BOOST_FOREACH(CTraceBuffer* pbuffer, *vTraceBuffers)
+    {
+        bool fExited;
+        {
+            boost::mutex::scoped_lock lock(pbuffer->mutex);
+            fExited = pbuffer->fThreadExited;
+            pbuffer->vEvents.clear();
+            pbuffer->nWritten = 0;
+        }
+        if (fExited)
+            delete pbuffer;
+        else
+            vKeep.push_back(pbuffer);
+    }
+    vTraceBuffers->swap(vKeep);
+}
+
+void StartTraceCapture()
+{
+    boost::call_once(&TraceInit, traceInitFlag);
+    boost::mutex::scoped_lock lock(*mutexTraceBuffers);
+    fTraceCapture = false;
+    ResetTraceBuffers();
+    fTraceCapture = true;
+}
+
+bool StopTraceCapture(const std::string& strPath, uint64_t& nEvents, uint64_t& nDropped)
+{
+    boost::call_once(&TraceInit, traceInitFlag);
+    boost::mutex::scoped_lock lock(*mutexTraceBuffers);
+    fTraceCapture = false;
+    nEvents = 0;
+    nDropped = 0;
+
+    FILE* file = fopen(strPath.c_str(), "w");
+    if (!file)
+    {
+        ResetTraceBuffers();
+        return false;
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool fFirst = true;
+    BOOST_FOREACH(CTraceBuffer* pbuffer, *vTraceBuffers)
+    {
+        boost::mutex::scoped_lock lockBuffer(pbuffer->mutex);
+        if (pbuffer->vEvents.empty())
+            continue;
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                fFirst ? "" : ",\n", pbuffer->nThread, SanitizeString(pbuffer->strThreadName).c_str());
+        fFirst = false;
+        BOOST_FOREACH(const CTraceEvent& event, pbuffer->vEvents)
+        {
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"span\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}",
+                    event.szName, pbuffer->nThread, (long long)event.nStart, (long long)event.nDuration);
+        }
+        nEvents += pbuffer->vEvents.size();
+        nDropped += pbuffer->nWritten - pbuffer->vEvents.size();
+    }
+    fprintf(file, "\n]}\n");
+    bool fOk = (ferror(file) == 0);
+    fOk = (fclose(file) == 0) && fOk;
+
+    ResetTraceBuffers();
+    return fOk;
+}
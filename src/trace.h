@@ -0,0 +1,45 @@
+// Copyright (c) 2014-2015 The Dash developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TRACE_H
+#define BITCOIN_TRACE_H
+
+#include <stdint.h>
+#include <string>
+
+/** True while a trace capture is running; spans do nothing otherwise */
+extern volatile bool fTraceCapture;
+
+/**
+ * Scoped trace span. While a capture is running, records the name, start
+ * and duration of the enclosing scope into a ring buffer owned by the
+ * calling thread. Spans nest, so a span inside ProcessMessage shows up
+ * under it in the trace viewer.
+ */
+class CTraceSpan
+{
+private:
+    const char* pszName;
+    std::string strDetail;
+    int64_t nStart;
+
+public:
+    explicit CTraceSpan(const char* pszNameIn);
+    /** Span named "name:detail", e.g. the command of a network message */
+    CTraceSpan(const char* pszNameIn, const std::string& strDetailIn);
+    ~CTraceSpan();
+};
+
+/** Clear all buffers and start recording spans */
+void StartTraceCapture();
+
+/**
+ * Stop recording and write what the buffers hold as a Chrome trace event
+ * file, which chrome://tracing and Perfetto open. Returns false if the
+ * file could not be written; nEvents and nDropped tell how many spans were
+ * written and how many were overwritten because a buffer wrapped.
+ */
+bool StopTraceCapture(const std::string& strPath, uint64_t& nEvents, uint64_t& nDropped);
+
+#endif // BITCOIN_TRACE_H
@@ -122,6 +122,7 @@ string strMiscWarning;
 bool fNoListen = false;
 bool fLogTimestamps = false;
 volatile bool fReopenDebugLog = false;
+int64_t nMaxDebugLogSize = 0;
 CClientUIInterface uiInterface;
 
 // Init OpenSSL library multithreading support
@@ -250,6 +251,21 @@ static boost::once_flag debugPrintInitFlag = BOOST_ONCE_INIT;
 static FILE* fileout = NULL;
 static boost::mutex* mutexDebugLog = NULL;
 
+// Lines waiting for ThreadLogWriter. Callers only hold mutexLogQueue for
+// the time it takes to append a record; formatting the timestamp and the
+// write itself happen on the writer thread.
+struct CLogRecord
+{
+    int64_t nTime;
+    std::string str;
+};
+static const size_t MAX_LOG_QUEUE = 100000;
+static std::vector<CLogRecord>* vLogQueue = NULL;
+static boost::mutex* mutexLogQueue = NULL;
+static boost::condition_variable* condLogQueued = NULL;
+static boost::condition_variable* condLogSpace = NULL;
+static bool fLogAsync = false; // protected by mutexLogQueue
+
 static void DebugPrintInit()
 {
     assert(fileout == NULL);
@@ -257,11 +273,22 @@ static void DebugPrintInit()
 
     boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
     fileout = fopen(pathDebug.string().c_str(), "a");
-    if (fileout) setbuf(fileout, NULL); // unbuffered
 
     mutexDebugLog = new boost::mutex();
+    vLogQueue = new std::vector<CLogRecord>();
+    mutexLogQueue = new boost::mutex();
+    condLogQueued = new boost::condition_variable();
+    condLogSpace = new boost::condition_variable();
 }
 
+struct CLogCategories
+{
+    bool fAll;
+    set<string> setCategories;
+    // Categories are string literals, so answers are remembered by address
+    map<const char*, bool> mapAccepted;
+};
+
 bool LogAcceptCategory(const char* category)
 {
     if (category != NULL)
@@ -273,23 +300,61 @@ bool LogAcceptCategory(const char* category)
         // This helps prevent issues debugging global destructors,
         // where mapMultiArgs might be deleted before another
         // global destructor calls LogPrint()
-        static boost::thread_specific_ptr<set<string> > ptrCategory;
+        static boost::thread_specific_ptr<CLogCategories> ptrCategory;
         if (ptrCategory.get() == NULL)
         {
             const vector<string>& categories = mapMultiArgs["-debug"];
-            ptrCategory.reset(new set<string>(categories.begin(), categories.end()));
-            // thread_specific_ptr automatically deletes the set when the thread ends.
+            ptrCategory.reset(new CLogCategories());
+            ptrCategory->setCategories.insert(categories.begin(), categories.end());
+            ptrCategory->fAll = ptrCategory->setCategories.count(string("")) != 0;
+            // thread_specific_ptr automatically deletes it when the thread ends.
         }
-        const set<string>& setCategories = *ptrCategory.get();
+        CLogCategories& cats = *ptrCategory.get();
 
         // if not debugging everything and not debugging specific category, LogPrint does nothing.
-        if (setCategories.count(string("")) == 0 &&
-            setCategories.count(string(category)) == 0)
-            return false;
+        if (cats.fAll)
+            return true;
+        map<const char*, bool>::iterator it = cats.mapAccepted.find(category);
+        if (it == cats.mapAccepted.end())
+            it = cats.mapAccepted.insert(make_pair(category, cats.setCategories.count(string(category)) != 0)).first;
+        return it->second;
     }
     return true;
 }
 
+// Caller holds mutexDebugLog
+static int WriteDebugLog(int64_t nTime, const std::string &str)
+{
+    static bool fStartedNewLine = true;
+    static int64_t nLastTime = -1;
+    static std::string strLastTime;
+    int ret = 0;
+
+    // reopen the log file, if requested
+    if (fReopenDebugLog) {
+        fReopenDebugLog = false;
+        boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
+        if (freopen(pathDebug.string().c_str(),"a",fileout) == NULL)
+            return ret;
+    }
+
+    // Debug print useful for profiling
+    if (fLogTimestamps && fStartedNewLine) {
+        if (nTime != nLastTime) {
+            strLastTime = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nTime);
+            nLastTime = nTime;
+        }
+        ret += fprintf(fileout, "%s ", strLastTime.c_str());
+    }
+    if (!str.empty() && str[str.size()-1] == '\n')
+        fStartedNewLine = true;
+    else
+        fStartedNewLine = false;
+
+    ret = fwrite(str.data(), 1, str.size(), fileout);
+    return ret;
+}
+
 int LogPrintStr(const std::string &str)
 {
     int ret = 0; // Returns total number of characters written
@@ -300,36 +365,108 @@ int LogPrintStr(const std::string &str)
     }
     else if (fPrintToDebugLog)
     {
-        static bool fStartedNewLine = true;
         boost::call_once(&DebugPrintInit, debugPrintInitFlag);
 
         if (fileout == NULL)
             return ret;
 
-        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
-
-        // reopen the log file, if requested
-        if (fReopenDebugLog) {
-            fReopenDebugLog = false;
-            boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
-            if (freopen(pathDebug.string().c_str(),"a",fileout) != NULL)
-                setbuf(fileout, NULL); // unbuffered
+        CLogRecord record;
+        record.nTime = GetTime();
+        record.str = str;
+        {
+            boost::unique_lock<boost::mutex> lock(*mutexLogQueue);
+            // Never let a stalled disk grow the queue without bound
+            if (fLogAsync && vLogQueue->size() >= MAX_LOG_QUEUE) {
+                boost::this_thread::disable_interruption di;
+                while (fLogAsync && vLogQueue->size() >= MAX_LOG_QUEUE)
+                    condLogSpace->wait(lock);
+            }
+            if (fLogAsync) {
+                vLogQueue->push_back(CLogRecord());
+                vLogQueue->back().nTime = record.nTime;
+                vLogQueue->back().str.swap(record.str);
+                if (vLogQueue->size() == 1)
+                    condLogQueued->notify_one();
+                return str.size();
+            }
         }
 
-        // Debug print useful for profiling
-        if (fLogTimestamps && fStartedNewLine)
-            ret += fprintf(fileout, "%s ", DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetTime()).c_str());
-        if (!str.empty() && str[str.size()-1] == '\n')
-            fStartedNewLine = true;
-        else
-            fStartedNewLine = false;
-
-        ret = fwrite(str.data(), 1, str.size(), fileout);
+        // No writer thread (yet, or any more): write through
+        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+        ret = WriteDebugLog(record.nTime, str);
+        fflush(fileout);
     }
 
     return ret;
 }
 
+// Caller holds mutexDebugLog. Once debug.log passes -maxlogsize it becomes
+// debug.log.1, replacing the previous one, and a new debug.log is started.
+static void RotateDebugLog()
+{
+    if (nMaxDebugLogSize <= 0 || ftell(fileout) < nMaxDebugLogSize)
+        return;
+    boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
+    // the next write reopens debug.log, as after SIGHUP
+    if (RenameOver(pathDebug, GetDataDir() / "debug.log.1"))
+        fReopenDebugLog = true;
+}
+
+// Caller holds mutexDebugLog
+static void WriteDebugLogBatch(const std::vector<CLogRecord>& vBatch)
+{
+    BOOST_FOREACH(const CLogRecord& record, vBatch)
+        WriteDebugLog(record.nTime, record.str);
+    fflush(fileout);
+    RotateDebugLog();
+}
+
+void ThreadLogWriter()
+{
+    RenameThread("testinterzone-logwriter");
+    if (fPrintToConsole || !fPrintToDebugLog)
+        return;
+    boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+    if (fileout == NULL)
+        return;
+
+    std::vector<CLogRecord> vBatch;
+    {
+        boost::unique_lock<boost::mutex> lock(*mutexLogQueue);
+        fLogAsync = true;
+    }
+    try
+    {
+        while (true)
+        {
+            {
+                boost::unique_lock<boost::mutex> lock(*mutexLogQueue);
+                while (vLogQueue->empty())
+                    condLogQueued->wait(lock);
+                vBatch.swap(*vLogQueue);
+                condLogSpace->notify_all();
+            }
+            boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+            WriteDebugLogBatch(vBatch);
+            vBatch.clear();
+        }
+    }
+    catch (boost::thread_interrupted)
+    {
+        // Write out what is left, and have later lines written through.
+        // Holding mutexDebugLog first keeps those behind the queued ones.
+        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+        {
+            boost::unique_lock<boost::mutex> lock(*mutexLogQueue);
+            fLogAsync = false;
+            vBatch.swap(*vLogQueue);
+            condLogSpace->notify_all();
+        }
+        WriteDebugLogBatch(vBatch);
+        throw;
+    }
+}
+
 string FormatMoney(int64_t n, bool fPlus)
 {
     // Note: not using straight sprintf here because we do NOT want
@@ -118,6 +118,7 @@ extern std::string strMiscWarning;
 extern bool fNoListen;
 extern bool fLogTimestamps;
 extern volatile bool fReopenDebugLog;
+extern int64_t nMaxDebugLogSize;
 
 void RandAddSeed();
 void RandAddSeedPerfmon();
@@ -127,6 +128,8 @@ void SetupEnvironment();
 bool LogAcceptCategory(const char* category);
 /* Send a string to the log output */
 int LogPrintStr(const std::string &str);
+/* Write queued log lines to debug.log until interrupted; until it runs, LogPrintStr writes through */
+void ThreadLogWriter();
 
 #define strprintf tfm::format
 #define LogPrintf(...) LogPrint(NULL, __VA_ARGS__)
@@ -27,7 +27,7 @@ extern const std::string CLIENT_DATE;
 // network protocol versioning
 //
 
-static const int PROTOCOL_VERSION = 80005;
+static const int PROTOCOL_VERSION = 80007;
 
 // intial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -49,4 +49,10 @@ static const int BIP0031_VERSION = 60000;
 // "mempool" command, enhanced "getdata" behavior starts with this version:
 static const int MEMPOOL_GD_VERSION = 60002;
 
+// "mnlistreq" and "mnlist" masternode list sync starts with this version
+static const int MNLIST_SYNC_VERSION = 80006;
+
+// "sendcmpct", "cmpctblock", "getblocktxn" and "blocktxn" compact block relay starts with this version
+static const int COMPACT_BLOCKS_VERSION = 80007;
+
 #endif
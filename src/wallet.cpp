@@ -9,6 +9,7 @@
 #include "base58.h"
 #include "checkpoints.h"
 #include "coincontrol.h"
+#include "coinselection.h"
 #include "net.h"
 #include "darksend.h"
 #include "keepass.h"
@@ -78,6 +79,8 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    // outputs already in the wallet can be ours now
+    fCoinIndexBuilt = false;
     if (!fFileBacked)
         return true;
     if (!IsCrypted()) {
@@ -93,6 +96,10 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
 {
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
+    {
+        LOCK(cs_wallet);
+        fCoinIndexBuilt = false;
+    }
     if (!fFileBacked)
         return true;
     {
@@ -128,6 +135,10 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    {
+        LOCK(cs_wallet);
+        fCoinIndexBuilt = false;
+    }
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -554,7 +565,10 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
     {
         mapWallet[hash] = wtxIn;
         mapWallet[hash].BindWallet(this);
+        mapWallet[hash].ClassifyOutputs();
         AddToSpends(hash);
+        if (fCoinIndexBuilt)
+            AddToCoinIndex(hash, mapWallet[hash]);
     }
     else
     {
@@ -570,6 +584,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
             wtx.nOrderPos = IncOrderPosNext();
 
             wtx.nTimeSmart = wtx.nTimeReceived;
+            wtx.ClassifyOutputs();
             if (wtxIn.hashBlock != 0)
             {
                 if (mapBlockIndex.count(wtxIn.hashBlock))
@@ -647,6 +662,10 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
             if (!wtx.WriteToDisk())
                 return false;
 
+        // Keys may have been added since, when a rescan updates the transaction
+        if (fCoinIndexBuilt)
+            AddToCoinIndex(hash, wtx);
+
         // Break debit/credit balance caches:
         wtx.MarkDirty();
 
@@ -756,18 +775,29 @@ bool CWallet::IsDenominated(const CTxIn &txin) const
         if (mi != mapWallet.end())
         {
             const CWalletTx& prev = (*mi).second;
-            if (txin.prevout.n < prev.vout.size()) return IsDenominatedAmount(prev.vout[txin.prevout.n].nValue);
+            if (txin.prevout.n < prev.vout.size()) return prev.IsDenominatedOutput(txin.prevout.n);
         }
     }
     return false;
 }
 
+// The one place that decides what an amount is to Darksend; IsDenominatedAmount
+// and IsCollateralAmount answer from it
+unsigned char GetOutputClassByAmount(int64_t nValue)
+{
+    for (unsigned int i = 0; i < darkSendDenominations.size() && i < OUTPUT_CLASS_COLLATERAL; i++)
+        if (nValue == darkSendDenominations[i])
+            return i;
+    if (nValue != 0 && nValue % DARKSEND_COLLATERAL == 0 && nValue < DARKSEND_COLLATERAL * 5 && nValue > DARKSEND_COLLATERAL)
+        return OUTPUT_CLASS_COLLATERAL;
+    if (nValue == 1000*COIN)
+        return OUTPUT_CLASS_MASTERNODE;
+    return OUTPUT_CLASS_OTHER;
+}
+
 bool CWallet::IsDenominatedAmount(int64_t nInputAmount) const
 {
-    BOOST_FOREACH(int64_t d, darkSendDenominations)
-        if(nInputAmount == d)
-            return true;
-    return false;
+    return GetOutputClassByAmount(nInputAmount) < OUTPUT_CLASS_COLLATERAL;
 }
 
 bool CWallet::IsChange(const CTxOut& txout) const
@@ -1104,9 +1134,9 @@ int64_t CWallet::GetAnonymizedBalance() const
                 uint256 hash = (*it).first;
                 for (unsigned int i = 0; i < pcoin->vout.size(); i++)
                 {
-                    CTxIn vin = CTxIn(hash, i);
+                    if(!pcoin->IsDenominatedOutput(i) || IsSpent(hash, i) || !IsMine(pcoin->vout[i])) continue;
 
-                    if(IsSpent(hash, i) || !IsMine(pcoin->vout[i]) || !IsDenominated(vin)) continue;
+                    CTxIn vin = CTxIn(hash, i);
 
                     int rounds = GetInputDarksendRounds(vin);
                     if(rounds >= nDarksendRounds){
@@ -1137,9 +1167,9 @@ double CWallet::GetAverageAnonymizedRounds() const
 
                 for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
 
-                    CTxIn vin = CTxIn(hash, i);
+                    if(!pcoin->IsDenominatedOutput(i) || IsSpent(hash, i) || !IsMine(pcoin->vout[i])) continue;
 
-                    if(IsSpent(hash, i) || !IsMine(pcoin->vout[i]) || !IsDenominated(vin)) continue;
+                    CTxIn vin = CTxIn(hash, i);
 
                     int rounds = GetInputDarksendRounds(vin);
                     fTotal += (float)rounds;
@@ -1170,9 +1200,9 @@ int64_t CWallet::GetNormalizedAnonymizedBalance() const
 
                 for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
 
-                    CTxIn vin = CTxIn(hash, i);
+                    if(!pcoin->IsDenominatedOutput(i) || IsSpent(hash, i) || !IsMine(pcoin->vout[i])) continue;
 
-                    if(IsSpent(hash, i) || !IsMine(pcoin->vout[i]) || !IsDenominated(vin)) continue;
+                    CTxIn vin = CTxIn(hash, i);
 
                     int rounds = GetInputDarksendRounds(vin);
                     nTotal += pcoin->vout[i].nValue * rounds / nDarksendRounds;
@@ -1206,7 +1236,7 @@ int64_t CWallet::GetDenominatedBalance(bool onlyDenom, bool onlyUnconfirmed) con
             {
                 if(IsSpent(hash, i)) continue;
                 if(!IsMine(pcoin->vout[i])) continue;
-                if(onlyDenom != IsDenominatedAmount(pcoin->vout[i].nValue)) continue;
+                if(onlyDenom != pcoin->IsDenominatedOutput(i)) continue;
 
                 nTotal += pcoin->vout[i].nValue;
             }
@@ -1247,104 +1277,147 @@ int64_t CWallet::GetImmatureBalance() const
     return nTotal;
 }
 
-// populate vCoins with vector of spendable COutputs
-void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl, AvailableCoinsType coin_type, bool useIX) const
+// Spent outputs are dropped from the coin index once the spend is this deep
+static const int COIN_INDEX_PRUNE_DEPTH = 100;
+
+CWallet::CoinClassKey CWallet::GetCoinClass(const CWalletTx& wtx, unsigned int n) const
 {
-    vCoins.clear();
+    unsigned char nClass = wtx.GetOutputClass(n);
+    if (nClass < OUTPUT_CLASS_COLLATERAL)
+        return make_pair((int)COIN_CLASS_DENOMINATED, wtx.vout[n].nValue);
+    if (nClass == OUTPUT_CLASS_COLLATERAL)
+        return make_pair((int)COIN_CLASS_COLLATERAL, (int64_t)0);
+    if (nClass == OUTPUT_CLASS_MASTERNODE)
+        return make_pair((int)COIN_CLASS_MASTERNODE, (int64_t)0);
+    return make_pair((int)COIN_CLASS_OTHER, (int64_t)0);
+}
 
+void CWallet::AddToCoinIndex(const uint256& hash, const CWalletTx& wtx) const
+{
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
     {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (!IsFinalTx(*pcoin))
-                continue;
-
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
-                continue;
-
-            if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
-
-            int nDepth = pcoin->GetDepthInMainChain(false);
-            // do not use IX for inputs that have less then 6 blockchain confirmations
-            if (useIX && nDepth < 6)
-                continue;
-
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                bool found = false;
-                if(coin_type == ONLY_DENOMINATED) {
-                    //should make this a vector
-
-                    found = IsDenominatedAmount(pcoin->vout[i].nValue);
-                } else if(coin_type == ONLY_NONDENOMINATED || coin_type == ONLY_NONDENOMINATED_NOTMN) {
-                    found = true;
-                    if (IsCollateralAmount(pcoin->vout[i].nValue)) continue; // do not use collateral amounts
-                    found = !IsDenominatedAmount(pcoin->vout[i].nValue);
-                    if(found && coin_type == ONLY_NONDENOMINATED_NOTMN) found = (pcoin->vout[i].nValue != 1000*COIN); // do not use MN funds
-                } else {
-                    found = true;
-                }
-                if(!found) continue;
+        const CTxOut& txout = wtx.vout[i];
+        if (txout.nValue > 0 && IsMine(txout))
+            mapCoinIndex[GetCoinClass(wtx, i)].insert(COutPoint(hash, i));
+    }
+}
 
-                if (!(IsSpent(wtxid, i)) && IsMine(pcoin->vout[i]) &&
-                    !IsLockedCoin((*it).first, i) && pcoin->vout[i].nValue > 0 &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i)))
-                        vCoins.push_back(COutput(pcoin, i, nDepth));
-            }
+void CWallet::BuildCoinIndex() const
+{
+    AssertLockHeld(cs_wallet);
+    mapCoinIndex.clear();
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    {
+        for (unsigned int i = 0; i < it->second.vout.size(); i++)
+        {
+            const CTxOut& txout = it->second.vout[i];
+            COutPoint outpoint(it->first, i);
+            if (txout.nValue > 0 && IsMine(txout) && !IsSpentDeeply(outpoint))
+                mapCoinIndex[GetCoinClass(it->second, i)].insert(outpoint);
         }
     }
+    // the classes depend on the denominations, which are set up after the wallet is loaded
+    nCoinIndexDenominations = darkSendDenominations.size();
+    fCoinIndexBuilt = true;
 }
 
-static void ApproximateBestSubset(vector<pair<int64_t, pair<const CWalletTx*,unsigned int> > >vValue, int64_t nTotalLower, int64_t nTargetValue,
-                                  vector<char>& vfBest, int64_t& nBest, int iterations = 1000)
+bool CWallet::IsSpentDeeply(const COutPoint& outpoint) const
 {
-    vector<char> vfIncluded;
+    pair<TxSpends::const_iterator, TxSpends::const_iterator> range;
+    range = mapTxSpends.equal_range(outpoint);
 
-    vfBest.assign(vValue.size(), true);
-    nBest = nTotalLower;
+    for (TxSpends::const_iterator it = range.first; it != range.second; ++it)
+    {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() >= COIN_INDEX_PRUNE_DEPTH)
+            return true;
+    }
+    return false;
+}
 
-    seed_insecure_rand();
+// populate vCoins with vector of spendable COutputs
+void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl, AvailableCoinsType coin_type, bool useIX) const
+{
+    vCoins.clear();
 
-    for (int nRep = 0; nRep < iterations && nBest != nTargetValue; nRep++)
     {
-        vfIncluded.assign(vValue.size(), false);
-        int64_t nTotal = 0;
-        bool fReachedTarget = false;
-        for (int nPass = 0; nPass < 2 && !fReachedTarget; nPass++)
+        LOCK2(cs_main, cs_wallet);
+        if (!fCoinIndexBuilt || nCoinIndexDenominations != darkSendDenominations.size())
+            BuildCoinIndex();
+
+        for (CoinIndex::iterator itClass = mapCoinIndex.begin(); itClass != mapCoinIndex.end(); ++itClass)
         {
-            for (unsigned int i = 0; i < vValue.size(); i++)
+            int nClass = itClass->first.first;
+            bool found = false;
+            if(coin_type == ONLY_DENOMINATED) {
+                found = nClass == COIN_CLASS_DENOMINATED;
+            } else if(coin_type == ONLY_NONDENOMINATED) {
+                found = nClass == COIN_CLASS_OTHER || nClass == COIN_CLASS_MASTERNODE; // do not use collateral amounts
+            } else if(coin_type == ONLY_NONDENOMINATED_NOTMN) {
+                found = nClass == COIN_CLASS_OTHER; // do not use MN funds
+            } else {
+                found = true;
+            }
+            if(!found) continue;
+
+            // outputs of one transaction are adjacent, check the transaction once
+            const CWalletTx* pcoinLast = NULL;
+            bool fLastUsable = false;
+            int nDepth = 0;
+
+            std::set<COutPoint>& setCoins = itClass->second;
+            for (std::set<COutPoint>::iterator it = setCoins.begin(); it != setCoins.end(); )
             {
-                //The solver here uses a randomized algorithm,
-                //the randomness serves no real security purpose but is just
-                //needed to prevent degenerate behavior and it is important
-                //that the rng fast. We do not use a constant random sequence,
-                //because there may be some privacy improvement by making
-                //the selection random.
-                if (nPass == 0 ? insecure_rand()&1 : !vfIncluded[i])
+                const COutPoint& outpoint = *it;
+                std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(outpoint.hash);
+                if (mi == mapWallet.end())
                 {
-                    nTotal += vValue[i].first;
-                    vfIncluded[i] = true;
-                    if (nTotal >= nTargetValue)
-                    {
-                        fReachedTarget = true;
-                        if (nTotal < nBest)
-                        {
-                            nBest = nTotal;
-                            vfBest = vfIncluded;
-                        }
-                        nTotal -= vValue[i].first;
-                        vfIncluded[i] = false;
-                    }
+                    setCoins.erase(it++);
+                    continue;
                 }
+                if (IsSpent(outpoint.hash, outpoint.n))
+                {
+                    if (IsSpentDeeply(outpoint))
+                        setCoins.erase(it++);
+                    else
+                        ++it;
+                    continue;
+                }
+                ++it;
+
+                const CWalletTx* pcoin = &mi->second;
+                if (pcoin != pcoinLast)
+                {
+                    pcoinLast = pcoin;
+                    fLastUsable = false;
+
+                    if (!IsFinalTx(*pcoin))
+                        continue;
+
+                    if (fOnlyConfirmed && !pcoin->IsTrusted())
+                        continue;
+
+                    if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
+                        continue;
+
+                    nDepth = pcoin->GetDepthInMainChain(false);
+                    // do not use IX for inputs that have less then 6 blockchain confirmations
+                    if (useIX && nDepth < 6)
+                        continue;
+
+                    fLastUsable = true;
+                }
+                if (!fLastUsable)
+                    continue;
+
+                if (!IsLockedCoin(outpoint.hash, outpoint.n) &&
+                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected(outpoint.hash, outpoint.n)))
+                        vCoins.push_back(COutput(pcoin, outpoint.n, nDepth));
             }
         }
     }
 }
 
-
 // TODO: find appropriate place for this sort function
 // move denoms down
 bool less_then_denom (const COutput& out1, const COutput& out2)
@@ -1450,14 +1523,36 @@ bool CWallet::SelectCoinsMinConf(int64_t nTargetValue, int nConfMine, int nConfT
 
     }
 
-    // Solve subset sum by stochastic approximation
-    sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+    // Largest first; a stable sort keeps the shuffled order among equal values
+    stable_sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+    vector<CSelectionCoin> vSelection;
+    vSelection.reserve(vValue.size());
+    for (unsigned int i = 0; i < vValue.size(); i++)
+        vSelection.push_back(CSelectionCoin(vValue[i].first, i));
+
     vector<char> vfBest;
     int64_t nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
+    // A subset that overshoots by less than the minimum fee needs no change output
+    if (SelectCoinsBnB(vSelection, nTargetValue, CTransaction::nMinTxFee, vfBest, nBest))
+    {
+        for (unsigned int i = 0; i < vSelection.size(); i++)
+        {
+            if (vfBest[i])
+            {
+                setCoinsRet.insert(vValue[vSelection[i].nIndex].second);
+                nValueRet += vSelection[i].nValue;
+            }
+        }
+        LogPrint("selectcoins", "CWallet::SelectCoinsMinConf changeless subset of %u coins - total %s\n",
+            setCoinsRet.size(), FormatMoney(nBest));
+        return true;
+    }
+
+    // Otherwise solve subset sum by stochastic approximation
+    ApproximateBestSubset(vSelection, nTotalLower, nTargetValue, vfBest, nBest, 1000);
     if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+        ApproximateBestSubset(vSelection, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
 
     // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
@@ -1632,7 +1727,7 @@ bool CWallet::SelectCoinsDark(int64_t nValueMin, int64_t nValueMax, std::vector<
     BOOST_FOREACH(const COutput& out, vCoins)
     {
         //there's no reason to allow inputs less than 1 COIN into DS (other than denominations smaller than that amount)
-        if(out.tx->vout[out.i].nValue < 1*COIN && !IsDenominatedAmount(out.tx->vout[out.i].nValue)) continue;
+        if(out.tx->vout[out.i].nValue < 1*COIN && !out.tx->IsDenominatedOutput(out.i)) continue;
         if(fMasterNode && out.tx->vout[out.i].nValue == 1000*COIN) continue; //masternode input
 
         if(nValueRet + out.tx->vout[out.i].nValue <= nValueMax){
@@ -1669,7 +1764,7 @@ bool CWallet::SelectCoinsCollateral(std::vector<CTxIn>& setCoinsRet, int64_t& nV
     BOOST_FOREACH(const COutput& out, vCoins)
     {
         // collateral inputs will always be a multiple of DARSEND_COLLATERAL, up to five
-        if(IsCollateralAmount(out.tx->vout[out.i].nValue))
+        if(out.tx->GetOutputClass(out.i) == OUTPUT_CLASS_COLLATERAL)
         {
             CTxIn vin = CTxIn(out.tx->GetHash(),out.i);
 
@@ -1693,15 +1788,10 @@ int CWallet::CountInputsWithAmount(int64_t nInputAmount)
         {
             const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted()){
-                int nDepth = pcoin->GetDepthInMainChain(false);
-
                 for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                    COutput out = COutput(pcoin, i, nDepth);
-                    CTxIn vin = CTxIn(out.tx->GetHash(), out.i);
-
-                    if(out.tx->vout[out.i].nValue != nInputAmount) continue;
-                    if(!IsDenominatedAmount(pcoin->vout[i].nValue)) continue;
-                    if(IsSpent(out.tx->GetHash(), i) || !IsMine(pcoin->vout[i]) || !IsDenominated(vin)) continue;
+                    if(pcoin->vout[i].nValue != nInputAmount) continue;
+                    if(!pcoin->IsDenominatedOutput(i)) continue;
+                    if(IsSpent((*it).first, i) || !IsMine(pcoin->vout[i])) continue;
 
                     nTotal++;
                 }
@@ -1719,14 +1809,14 @@ bool CWallet::HasCollateralInputs() const
 
     int nFound = 0;
     BOOST_FOREACH(const COutput& out, vCoins)
-        if(IsCollateralAmount(out.tx->vout[out.i].nValue)) nFound++;
+        if(out.tx->GetOutputClass(out.i) == OUTPUT_CLASS_COLLATERAL) nFound++;
 
     return nFound > 0;
 }
 
 bool CWallet::IsCollateralAmount(int64_t nInputAmount) const
 {
-    return  nInputAmount != 0 && nInputAmount % DARKSEND_COLLATERAL == 0 && nInputAmount < DARKSEND_COLLATERAL * 5 && nInputAmount > DARKSEND_COLLATERAL;
+    return GetOutputClassByAmount(nInputAmount) == OUTPUT_CLASS_COLLATERAL;
 }
 
 bool CWallet::SelectCoinsWithoutDenomination(int64_t nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet) const
@@ -1910,6 +2000,15 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, int64_t> >& vecSend,
                     nFeeRet += nMoveToFee;
                 }
 
+                // Change no larger than the minimum fee costs more to create and
+                // later spend than it is worth; SelectCoinsMinConf picks inputs
+                // that overshoot by up to this much to go without a change output
+                if (nChange > 0 && nChange <= CTransaction::nMinTxFee)
+                {
+                    nFeeRet += nChange;
+                    nChange = 0;
+                }
+
                 //over pay for denominated transactions
                 if(coin_type == ONLY_DENOMINATED) {
                     nFeeRet += nChange;
@@ -2843,7 +2942,7 @@ void CWallet::GetKeyBirthTimes(std::map<CKeyID, int64_t> &mapKeyBirth) const {
     for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); it++) {
         // iterate over all wallet transactions...
         const CWalletTx &wtx = (*it).second;
-        std::map<uint256, CBlockIndex*>::const_iterator blit = mapBlockIndex.find(wtx.hashBlock);
+        BlockMap::const_iterator blit = mapBlockIndex.find(wtx.hashBlock);
         if (blit != mapBlockIndex.end() && chainActive.Contains(blit->second)) {
             // ... which are already in a block
             int nHeight = blit->second->nHeight;
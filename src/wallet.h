@@ -131,6 +131,28 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    // Our own outputs, so AvailableCoins does not have to walk mapWallet.
+    // Keyed by coin class and, for denominated outputs, the denomination.
+    // Spent outputs stay until the spend is too deep to be reorganized away,
+    // so users still check IsSpent. Built on first use, and built again after
+    // a key or script is added, since that can make outputs already in the
+    // wallet ours (importprivkey without a rescan).
+    enum CoinClass {
+        COIN_CLASS_OTHER,
+        COIN_CLASS_DENOMINATED,
+        COIN_CLASS_COLLATERAL,
+        COIN_CLASS_MASTERNODE
+    };
+    typedef std::pair<int, int64_t> CoinClassKey;
+    typedef std::map<CoinClassKey, std::set<COutPoint> > CoinIndex;
+    mutable CoinIndex mapCoinIndex;
+    mutable bool fCoinIndexBuilt;
+    mutable unsigned int nCoinIndexDenominations; // darkSendDenominations.size() when built
+    CoinClassKey GetCoinClass(const CWalletTx& wtx, unsigned int n) const;
+    void AddToCoinIndex(const uint256& hash, const CWalletTx& wtx) const;
+    void BuildCoinIndex() const;
+    bool IsSpentDeeply(const COutPoint& outpoint) const;
+
 public:
     bool SelectCoins(int64_t nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet, const CCoinControl *coinControl = NULL, AvailableCoinsType coin_type=ALL_COINS, bool useIX = true) const;
     bool SelectCoinsDark(int64_t nValueMin, int64_t nValueMax, std::vector<CTxIn>& setCoinsRet, int64_t& nValueRet, int nDarksendRoundsMin, int nDarksendRoundsMax) const;
@@ -185,6 +207,8 @@ public:
         nLastResend = 0;
         nTimeFirstKey = 0;
         fWalletUnlockAnonymizeOnly = false;
+        fCoinIndexBuilt = false;
+        nCoinIndexDenominations = 0;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -497,6 +521,20 @@ static void WriteOrderPos(const int64_t& nOrderPos, mapValue_t& mapValue)
 }
 
 
+/** What a wallet output is to Darksend, kept as one byte per output by
+ * CWalletTx. Values below OUTPUT_CLASS_COLLATERAL are the index of the
+ * output's value in darkSendDenominations.
+ */
+enum OutputClass
+{
+    OUTPUT_CLASS_COLLATERAL = 0xfd,
+    OUTPUT_CLASS_MASTERNODE = 0xfe,
+    OUTPUT_CLASS_OTHER = 0xff
+};
+
+unsigned char GetOutputClassByAmount(int64_t nValue);
+
+
 /** A transaction with a bunch of additional info that only the owner cares about.
  * It includes any unrecorded transactions needed to link it back to the block chain.
  */
@@ -526,6 +564,8 @@ public:
     mutable int64_t nImmatureCreditCached;
     mutable int64_t nAvailableCreditCached;
     mutable int64_t nChangeCached;
+    mutable std::vector<unsigned char> vOutputClass; // OutputClass of each output
+    mutable unsigned int nOutputClassDenominations;  // darkSendDenominations.size() when classified
 
     CWalletTx()
     {
@@ -567,6 +607,8 @@ public:
         nImmatureCreditCached = 0;
         nAvailableCreditCached = 0;
         nChangeCached = 0;
+        vOutputClass.clear();
+        nOutputClassDenominations = 0;
         nOrderPos = -1;
     }
 
@@ -646,6 +688,27 @@ public:
         return pwallet->IsDenominated(*this);
     }
 
+    void ClassifyOutputs() const
+    {
+        vOutputClass.resize(vout.size());
+        for (unsigned int i = 0; i < vout.size(); i++)
+            vOutputClass[i] = GetOutputClassByAmount(vout[i].nValue);
+        nOutputClassDenominations = darkSendDenominations.size();
+    }
+
+    unsigned char GetOutputClass(unsigned int n) const
+    {
+        // the denominations are set up after the wallet is loaded
+        if (vOutputClass.size() != vout.size() || nOutputClassDenominations != darkSendDenominations.size())
+            ClassifyOutputs();
+        return vOutputClass[n];
+    }
+
+    bool IsDenominatedOutput(unsigned int n) const
+    {
+        return GetOutputClass(n) < OUTPUT_CLASS_COLLATERAL;
+    }
+
     int64_t GetCredit(bool fUseCache=true) const
     {
         // Must wait until coinbase is safely deep enough in the chain before valuing it
@@ -785,8 +848,7 @@ public:
     //Used with Darksend. Will return largest nondenom, then denominations, then very small inputs
     int Priority() const
     {
-        BOOST_FOREACH(int64_t d, darkSendDenominations)
-            if(tx->vout[i].nValue == d) return 10000;
+        if(tx->IsDenominatedOutput(i)) return 10000;
         if(tx->vout[i].nValue < 1*COIN) return 20000;
 
         //nondenom return largest first
@@ -12,8 +12,10 @@
 #include "sync.h"
 #include "wallet.h"
 
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 
 using namespace std;
 using namespace boost;
@@ -21,6 +23,9 @@ using namespace boost;
 
 static uint64_t nAccountingEntryNumber = 0;
 
+// Bulk read buffer for LoadWallet; grown for records that do not fit
+static const unsigned int WALLET_LOAD_BUFFER_SIZE = 4 * 1024 * 1024;
+
 //
 // CWalletDB
 //
@@ -28,7 +33,7 @@ static uint64_t nAccountingEntryNumber = 0;
 bool CWalletDB::WriteName(const string& strAddress, const string& strName)
 {
     nWalletDBUpdated++;
-    return Write(make_pair(string("name"), strAddress), strName);
+    return WriteBehind(make_pair(string("name"), strAddress), strName);
 }
 
 bool CWalletDB::EraseName(const string& strAddress)
@@ -36,31 +41,31 @@ bool CWalletDB::EraseName(const string& strAddress)
     // This should only be used for sending addresses, never for receiving addresses,
     // receiving addresses must always have an address book entry if they're not change return.
     nWalletDBUpdated++;
-    return Erase(make_pair(string("name"), strAddress));
+    return EraseBehind(make_pair(string("name"), strAddress));
 }
 
 bool CWalletDB::WritePurpose(const string& strAddress, const string& strPurpose)
 {
     nWalletDBUpdated++;
-    return Write(make_pair(string("purpose"), strAddress), strPurpose);
+    return WriteBehind(make_pair(string("purpose"), strAddress), strPurpose);
 }
 
 bool CWalletDB::ErasePurpose(const string& strPurpose)
 {
     nWalletDBUpdated++;
-    return Erase(make_pair(string("purpose"), strPurpose));
+    return EraseBehind(make_pair(string("purpose"), strPurpose));
 }
 
 bool CWalletDB::WriteTx(uint256 hash, const CWalletTx& wtx)
 {
     nWalletDBUpdated++;
-    return Write(std::make_pair(std::string("tx"), hash), wtx);
+    return WriteBehind(std::make_pair(std::string("tx"), hash), wtx);
 }
 
 bool CWalletDB::EraseTx(uint256 hash)
 {
     nWalletDBUpdated++;
-    return Erase(std::make_pair(std::string("tx"), hash));
+    return EraseBehind(std::make_pair(std::string("tx"), hash));
 }
 
 bool CWalletDB::WriteKey(const CPubKey& vchPubKey, const CPrivKey& vchPrivKey, const CKeyMetadata& keyMeta)
@@ -116,7 +121,7 @@ bool CWalletDB::WriteCScript(const uint160& hash, const CScript& redeemScript)
 bool CWalletDB::WriteBestBlock(const CBlockLocator& locator)
 {
     nWalletDBUpdated++;
-    return Write(std::string("bestblock"), locator);
+    return WriteBehind(std::string("bestblock"), locator);
 }
 
 bool CWalletDB::ReadBestBlock(CBlockLocator& locator)
@@ -127,7 +132,7 @@ bool CWalletDB::ReadBestBlock(CBlockLocator& locator)
 bool CWalletDB::WriteOrderPosNext(int64_t nOrderPosNext)
 {
     nWalletDBUpdated++;
-    return Write(std::string("orderposnext"), nOrderPosNext);
+    return WriteBehind(std::string("orderposnext"), nOrderPosNext);
 }
 
 bool CWalletDB::WriteDefaultKey(const CPubKey& vchPubKey)
@@ -166,12 +171,12 @@ bool CWalletDB::ReadAccount(const string& strAccount, CAccount& account)
 
 bool CWalletDB::WriteAccount(const string& strAccount, const CAccount& account)
 {
-    return Write(make_pair(string("acc"), strAccount), account);
+    return WriteBehind(make_pair(string("acc"), strAccount), account);
 }
 
 bool CWalletDB::WriteAccountingEntry(const uint64_t nAccEntryNum, const CAccountingEntry& acentry)
 {
-    return Write(boost::make_tuple(string("acentry"), acentry.strAccount, nAccEntryNum), acentry);
+    return WriteBehind(boost::make_tuple(string("acentry"), acentry.strAccount, nAccEntryNum), acentry);
 }
 
 bool CWalletDB::WriteAccountingEntry(const CAccountingEntry& acentry)
@@ -325,6 +330,120 @@ public:
     }
 };
 
+// Transaction and key records are decoded by these without touching the wallet,
+// so LoadWallet can run them on several threads
+
+static bool ReadWalletTx(CDataStream& ssKey, CDataStream& ssValue, uint256& hash, CWalletTx& wtx,
+                         bool& fUpgraded, string& strErr)
+{
+    ssKey >> hash;
+    ssValue >> wtx;
+    CValidationState state;
+    if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid()))
+        return false;
+
+    // Undo serialize changes in 31600
+    fUpgraded = false;
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+    {
+        if (!ssValue.empty())
+        {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                               wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        }
+        else
+        {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        fUpgraded = true;
+    }
+    return true;
+}
+
+static bool ReadWalletKey(const string& strType, CDataStream& ssKey, CDataStream& ssValue,
+                          CPubKey& vchPubKey, CKey& key, string& strErr)
+{
+    ssKey >> vchPubKey;
+    if (!vchPubKey.IsValid())
+    {
+        strErr = "Error reading wallet database: CPubKey corrupt";
+        return false;
+    }
+    CPrivKey pkey;
+    uint256 hash = 0;
+
+    if (strType == "key")
+        ssValue >> pkey;
+    else
+    {
+        CWalletKey wkey;
+        ssValue >> wkey;
+        pkey = wkey.vchPrivKey;
+    }
+
+    // Old wallets store keys as "key" [pubkey] => [privkey]
+    // ... which was slow for wallets with lots of keys, because the public key is re-derived from the private key
+    // using EC operations as a checksum.
+    // Newer wallets store keys as "key"[pubkey] => [privkey][hash(pubkey,privkey)], which is much faster while
+    // remaining backwards-compatible.
+    try
+    {
+        ssValue >> hash;
+    }
+    catch(...){}
+
+    bool fSkipCheck = false;
+
+    if (hash != 0)
+    {
+        // hash pubkey/privkey to accelerate wallet load
+        std::vector<unsigned char> vchKey;
+        vchKey.reserve(vchPubKey.size() + pkey.size());
+        vchKey.insert(vchKey.end(), vchPubKey.begin(), vchPubKey.end());
+        vchKey.insert(vchKey.end(), pkey.begin(), pkey.end());
+
+        if (Hash(vchKey.begin(), vchKey.end()) != hash)
+        {
+            strErr = "Error reading wallet database: CPubKey/CPrivKey corrupt";
+            return false;
+        }
+
+        fSkipCheck = true;
+    }
+
+    if (!key.Load(pkey, vchPubKey, fSkipCheck))
+    {
+        strErr = "Error reading wallet database: CPrivKey corrupt";
+        return false;
+    }
+    return true;
+}
+
+static void LoadWalletTx(CWallet* pwallet, CWalletScanState& wss, const uint256& hash, CWalletTx& wtx, bool fUpgraded)
+{
+    if (fUpgraded)
+        wss.vWalletUpgrade.push_back(hash);
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+
+    pwallet->AddToWallet(wtx, true);
+    //// debug print
+    //LogPrintf("LoadWallet  %s\n", wtx.GetHash().ToString());
+    if(fDebug) LogPrintf("LoadWallet %12d %2s %20s %s %s\n",
+            wtx.vout[0].nValue,
+            wtx.mapValue["DS"] == "1" ? "DS" : "",
+            DateTimeStrFormat("%Y-%m-%d %H:%M:%S", wtx.GetTxTime()),
+            wtx.GetHash().ToString(),
+            wtx.hashBlock.ToString()
+    );
+}
+
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
              CWalletScanState &wss, string& strType, string& strErr)
@@ -349,46 +468,11 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         else if (strType == "tx")
         {
             uint256 hash;
-            ssKey >> hash;
             CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid()))
+            bool fUpgraded;
+            if (!ReadWalletTx(ssKey, ssValue, hash, wtx, fUpgraded, strErr))
                 return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            pwallet->AddToWallet(wtx, true);
-            //// debug print
-            //LogPrintf("LoadWallet  %s\n", wtx.GetHash().ToString());
-            if(fDebug) LogPrintf("LoadWallet %12d %2s %20s %s %s\n",
-                    wtx.vout[0].nValue,
-                    wtx.mapValue["DS"] == "1" ? "DS" : "",
-                    DateTimeStrFormat("%Y-%m-%d %H:%M:%S", wtx.GetTxTime()),
-                    wtx.GetHash().ToString(),
-                    wtx.hashBlock.ToString()
-            );
+            LoadWalletTx(pwallet, wss, hash, wtx, fUpgraded);
         }
         else if (strType == "acentry")
         {
@@ -410,61 +494,11 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         else if (strType == "key" || strType == "wkey")
         {
             CPubKey vchPubKey;
-            ssKey >> vchPubKey;
-            if (!vchPubKey.IsValid())
-            {
-                strErr = "Error reading wallet database: CPubKey corrupt";
-                return false;
-            }
             CKey key;
-            CPrivKey pkey;
-            uint256 hash = 0;
-
+            if (!ReadWalletKey(strType, ssKey, ssValue, vchPubKey, key, strErr))
+                return false;
             if (strType == "key")
-            {
                 wss.nKeys++;
-                ssValue >> pkey;
-            } else {
-                CWalletKey wkey;
-                ssValue >> wkey;
-                pkey = wkey.vchPrivKey;
-            }
-
-            // Old wallets store keys as "key" [pubkey] => [privkey]
-            // ... which was slow for wallets with lots of keys, because the public key is re-derived from the private key
-            // using EC operations as a checksum.
-            // Newer wallets store keys as "key"[pubkey] => [privkey][hash(pubkey,privkey)], which is much faster while
-            // remaining backwards-compatible.
-            try
-            {
-                ssValue >> hash;
-            }
-            catch(...){}
-
-            bool fSkipCheck = false;
-
-            if (hash != 0)
-            {
-                // hash pubkey/privkey to accelerate wallet load
-                std::vector<unsigned char> vchKey;
-                vchKey.reserve(vchPubKey.size() + pkey.size());
-                vchKey.insert(vchKey.end(), vchPubKey.begin(), vchPubKey.end());
-                vchKey.insert(vchKey.end(), pkey.begin(), pkey.end());
-
-                if (Hash(vchKey.begin(), vchKey.end()) != hash)
-                {
-                    strErr = "Error reading wallet database: CPubKey/CPrivKey corrupt";
-                    return false;
-                }
-
-                fSkipCheck = true;
-            }
-
-            if (!key.Load(pkey, vchPubKey, fSkipCheck))
-            {
-                strErr = "Error reading wallet database: CPrivKey corrupt";
-                return false;
-            }
             if (!pwallet->LoadKey(key, vchPubKey))
             {
                 strErr = "Error reading wallet database: LoadKey failed";
@@ -582,6 +616,70 @@ static bool IsKeyType(string strType)
             strType == "mkey" || strType == "ckey");
 }
 
+/** A transaction or key record decoded ahead of being added to the wallet */
+class CWalletLoadRecord
+{
+public:
+    size_t nRecord;
+    string strType;
+    string strErr;
+    bool fValid;
+
+    // "tx"
+    uint256 hash;
+    CWalletTx wtx;
+    bool fUpgraded;
+
+    // "key", "wkey"
+    CPubKey vchPubKey;
+    CKey key;
+
+    CWalletLoadRecord(size_t nRecordIn, const string& strTypeIn) : nRecord(nRecordIn), strType(strTypeIn), fValid(false), fUpgraded(false) {}
+};
+
+typedef std::vector<std::pair<CSerializeData, CSerializeData> > WalletRecords;
+
+static void DecodeWalletRecords(const WalletRecords& vRecords, std::vector<CWalletLoadRecord>& vDecoded, size_t nFirst, size_t nStep)
+{
+    for (size_t i = nFirst; i < vDecoded.size(); i += nStep)
+    {
+        CWalletLoadRecord& rec = vDecoded[i];
+        const std::pair<CSerializeData, CSerializeData>& record = vRecords[rec.nRecord];
+        try {
+            CDataStream ssKey(record.first.begin(), record.first.end(), SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(record.second.begin(), record.second.end(), SER_DISK, CLIENT_VERSION);
+            string strType;
+            ssKey >> strType;
+            if (rec.strType == "tx")
+                rec.fValid = ReadWalletTx(ssKey, ssValue, rec.hash, rec.wtx, rec.fUpgraded, rec.strErr);
+            else
+                rec.fValid = ReadWalletKey(rec.strType, ssKey, ssValue, rec.vchPubKey, rec.key, rec.strErr);
+        } catch (...) {
+            rec.fValid = false;
+        }
+    }
+}
+
+static bool LoadWalletRecord(CWallet* pwallet, CWalletLoadRecord& rec, CWalletScanState& wss, string& strErr)
+{
+    strErr = rec.strErr;
+    if (!rec.fValid)
+        return false;
+    if (rec.strType == "tx")
+    {
+        LoadWalletTx(pwallet, wss, rec.hash, rec.wtx, rec.fUpgraded);
+        return true;
+    }
+    if (rec.strType == "key")
+        wss.nKeys++;
+    if (!pwallet->LoadKey(rec.key, rec.vchPubKey))
+    {
+        strErr = "Error reading wallet database: LoadKey failed";
+        return false;
+    }
+    return true;
+}
+
 DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 {
     pwallet->vchDefaultKey = CPubKey();
@@ -589,6 +687,12 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     bool fNoncriticalErrors = false;
     DBErrors result = DB_LOAD_OK;
 
+    // Transactions and keys are decoded and checked on the script verification
+    // threads' worth of cores, everything else is cheap and stays inline
+    int nThreads = std::max(nScriptCheckThreads, 1);
+    unsigned int nRecords = 0;
+    int64_t nTimeRead = 0, nTimeDecode = 0, nTimeLoad = 0;
+
     try {
         LOCK(pwallet->cs_wallet);
         int nMinVersion = 0;
@@ -607,12 +711,14 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             return DB_CORRUPT;
         }
 
+        CSerializeData vchBuffer(WALLET_LOAD_BUFFER_SIZE);
+        WalletRecords vRecords;
         while (true)
         {
-            // Read next record
-            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-            int ret = ReadAtCursor(pcursor, ssKey, ssValue);
+            // Read next batch of records
+            int64_t nStart = GetTimeMicros();
+            vRecords.clear();
+            int ret = ReadAtCursorBulk(pcursor, vchBuffer, vRecords);
             if (ret == DB_NOTFOUND)
                 break;
             else if (ret != 0)
@@ -620,26 +726,78 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 LogPrintf("Error reading next record from wallet database\n");
                 return DB_CORRUPT;
             }
+            nRecords += vRecords.size();
+            int64_t nReadDone = GetTimeMicros();
+            nTimeRead += nReadDone - nStart;
 
-            // Try to be tolerant of single corrupt records:
-            string strType, strErr;
-            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
+            std::vector<CWalletLoadRecord> vDecoded;
+            for (size_t i = 0; i < vRecords.size(); i++)
+            {
+                string strType;
+                try {
+                    CDataStream ssKey(vRecords[i].first.begin(), vRecords[i].first.end(), SER_DISK, CLIENT_VERSION);
+                    ssKey >> strType;
+                } catch (...) {
+                    continue;
+                }
+                if (strType == "tx" || strType == "key" || strType == "wkey")
+                    vDecoded.push_back(CWalletLoadRecord(i, strType));
+            }
+
+            // Only fan out when there is enough work to pay for the threads
+            size_t nStep = std::min((size_t)nThreads, 1 + vDecoded.size() / 64);
+            boost::thread_group threadGroup;
+            size_t nStarted = 1;
+            try {
+                for (; nStarted < nStep; nStarted++)
+                    threadGroup.create_thread(boost::bind(&DecodeWalletRecords, boost::cref(vRecords), boost::ref(vDecoded), nStarted, nStep));
+            } catch (boost::thread_resource_error&) {}
+            // Strides without a thread of their own are decoded here
+            DecodeWalletRecords(vRecords, vDecoded, 0, nStep);
+            for (size_t n = nStarted; n < nStep; n++)
+                DecodeWalletRecords(vRecords, vDecoded, n, nStep);
+            threadGroup.join_all();
+            int64_t nDecodeDone = GetTimeMicros();
+            nTimeDecode += nDecodeDone - nReadDone;
+
+            // Add everything to the wallet in database order
+            std::vector<CWalletLoadRecord>::iterator itDecoded = vDecoded.begin();
+            for (size_t i = 0; i < vRecords.size(); i++)
             {
-                // losing keys is considered a catastrophic error, anything else
-                // we assume the user can live with:
-                if (IsKeyType(strType))
-                    result = DB_CORRUPT;
+                // Try to be tolerant of single corrupt records:
+                string strType, strErr;
+                bool fLoaded;
+                if (itDecoded != vDecoded.end() && itDecoded->nRecord == i)
+                {
+                    strType = itDecoded->strType;
+                    fLoaded = LoadWalletRecord(pwallet, *itDecoded, wss, strErr);
+                    ++itDecoded;
+                }
                 else
                 {
-                    // Leave other errors alone, if we try to fix them we might make things worse.
-                    fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
-                    if (strType == "tx")
-                        // Rescan if there is a bad transaction record:
-                        SoftSetBoolArg("-rescan", true);
+                    CDataStream ssKey(vRecords[i].first.begin(), vRecords[i].first.end(), SER_DISK, CLIENT_VERSION);
+                    CDataStream ssValue(vRecords[i].second.begin(), vRecords[i].second.end(), SER_DISK, CLIENT_VERSION);
+                    fLoaded = ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr);
                 }
+                if (!fLoaded)
+                {
+                    // losing keys is considered a catastrophic error, anything else
+                    // we assume the user can live with:
+                    if (IsKeyType(strType))
+                        result = DB_CORRUPT;
+                    else
+                    {
+                        // Leave other errors alone, if we try to fix them we might make things worse.
+                        fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
+                        if (strType == "tx")
+                            // Rescan if there is a bad transaction record:
+                            SoftSetBoolArg("-rescan", true);
+                    }
+                }
+                if (!strErr.empty())
+                    LogPrintf("%s\n", strErr);
             }
-            if (!strErr.empty())
-                LogPrintf("%s\n", strErr);
+            nTimeLoad += GetTimeMicros() - nDecodeDone;
         }
         pcursor->close();
     }
@@ -650,6 +808,9 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         result = DB_CORRUPT;
     }
 
+    LogPrintf("LoadWallet : %u records, read %dms, decoded %dms (%d threads), loaded %dms\n",
+              nRecords, nTimeRead / 1000, nTimeDecode / 1000, nThreads, nTimeLoad / 1000);
+
     if (fNoncriticalErrors && result == DB_LOAD_OK)
         result = DB_NONCRITICAL_ERROR;
 
@@ -667,6 +828,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     if ((wss.nKeys + wss.nCKeys) != wss.nKeyMeta)
         pwallet->nTimeFirstKey = 1; // 0 would be considered 'no value'
 
+    int64_t nStart = GetTimeMicros();
     BOOST_FOREACH(uint256 hash, wss.vWalletUpgrade)
         WriteTx(hash, pwallet->mapWallet[hash]);
 
@@ -680,6 +842,8 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     if (wss.fAnyUnordered)
         result = ReorderTransactions(pwallet);
 
+    LogPrintf("LoadWallet : upgrades and reordering %dms\n", (GetTimeMicros() - nStart) / 1000);
+
     return result;
 }
 
@@ -790,6 +954,9 @@ void ThreadFlushWalletDB(const string& strFile)
 
         if (nLastFlushed != nWalletDBUpdated && GetTime() - nLastWalletUpdate >= 2)
         {
+            // Queued writes have to be in wallet.dat before it can be self contained
+            bitdb.journal.Flush(strFile);
+
             TRY_LOCK(bitdb.cs_db,lockDb);
             if (lockDb)
             {
@@ -829,6 +996,7 @@ bool BackupWallet(const CWallet& wallet, const string& strDest)
 {
     if (!wallet.fFileBacked)
         return false;
+    bitdb.journal.Flush(wallet.strWalletFile);
     while (true)
     {
         {
@@ -954,11 +1122,11 @@ bool CWalletDB::Recover(CDBEnv& dbenv, std::string filename)
 bool CWalletDB::WriteDestData(const std::string &address, const std::string &key, const std::string &value)
 {
     nWalletDBUpdated++;
-    return Write(boost::make_tuple(std::string("destdata"), address, key), value);
+    return WriteBehind(boost::make_tuple(std::string("destdata"), address, key), value);
 }
 
 bool CWalletDB::EraseDestData(const std::string &address, const std::string &key)
 {
     nWalletDBUpdated++;
-    return Erase(boost::make_tuple(string("destdata"), address, key));
+    return EraseBehind(boost::make_tuple(string("destdata"), address, key));
 }